@@ -1,4 +1,6 @@
 #include "SuperpoweredAndroidAudioIO.h"
+#include "SuperpoweredAndroidAudioIOFifo.h"
+#include "SuperpoweredSimple.h"
 #include <SLES/OpenSLES.h>
 #include <SLES/OpenSLES_Android.h>
 #include <SLES/OpenSLES_AndroidConfiguration.h>
@@ -7,15 +9,20 @@
 #include <stdlib.h>
 
 #define NUM_CHANNELS 2
+#define LATENCY_WINDOW_SECONDS 2 // reads without an underrun before the fifo may shrink
 
 typedef struct SuperpoweredAndroidAudioIOInternals {
     void *clientdata;
     audioProcessingCallback callback;
     SLObjectItf openSLEngine, outputMix, outputBufferQueue, inputBufferQueue;
     SLAndroidSimpleBufferQueueItf outputBufferQueueInterface, inputBufferQueueInterface;
-    short int *fifobuffer, *silence;
-    int samplerate, buffersize, silenceSamples, latencySamples, numBuffers, bufferStep, readBufferIndex, writeBufferIndex;
+    SuperpoweredAndroidAudioIOFifo fifo;
+    float *silence;
+    short int *inputShorts, *outputShorts; // where a queue only takes 16-bit, it plays or records these instead of float
+    float *inputStereo; // a mono input the device only opens in stereo is recorded here, then folded
+    int samplerate, buffersize, silenceSamples, inputBytes, outputBytes, inputChannels, recordedChannels;
     bool hasOutput, hasInput, foreground, started;
+    unsigned int inputUnderruns, outputUnderruns, silenceSubstitutions; // updated with atomic builtins, read from any thread
 } SuperpoweredAndroidAudioIOInternals;
 
 // The entire operation is based on two Android Simple Buffer Queues, one for the audio input and one for the audio output.
@@ -50,54 +57,69 @@ static void stopQueues(SuperpoweredAndroidAudioIOInternals *internals) {
     };
 }
 
+// What the input queue records into next: the fifo's buffer, or one of ours to convert or fold from.
+static void *inputQueueBuffer(SuperpoweredAndroidAudioIOInternals *internals) {
+    if (internals->inputShorts) return internals->inputShorts;
+    if (internals->inputStereo) return internals->inputStereo;
+    return SuperpoweredAndroidAudioIOFifo_recordBuffer(&internals->fifo);
+}
+
 // This is called periodically by the input audio queue. Audio input is received from the media server at this point.
 static void SuperpoweredAndroidAudioIO_InputCallback(SLAndroidSimpleBufferQueueItf caller, void *pContext) {
     SuperpoweredAndroidAudioIOInternals *internals = (SuperpoweredAndroidAudioIOInternals *)pContext;
-    short int *buffer = internals->fifobuffer + internals->writeBufferIndex * internals->bufferStep;
-    if (internals->writeBufferIndex < internals->numBuffers - 1) internals->writeBufferIndex++; else internals->writeBufferIndex = 0;
+    SuperpoweredAndroidAudioIOFifo *fifo = &internals->fifo;
+    float *record = SuperpoweredAndroidAudioIOFifo_recordBuffer(fifo);
+    if (internals->inputShorts) SuperpoweredShortIntToFloat(internals->inputShorts, internals->inputStereo ? internals->inputStereo : record, (unsigned int)internals->buffersize, (unsigned int)internals->recordedChannels);
+    if (internals->inputStereo) SuperpoweredStereoToMono(internals->inputStereo, record, 0.5f, 0.5f, 0.5f, 0.5f, (unsigned int)internals->buffersize);
+    SuperpoweredAndroidAudioIOFifo_recorded(fifo); // the buffer just recorded, unless the output fell so far behind that it is recorded over
 
     if (!internals->hasOutput) { // When there is no audio output configured.
-        int buffersAvailable = internals->writeBufferIndex - internals->readBufferIndex;
-        if (buffersAvailable < 0) buffersAvailable = internals->numBuffers - (internals->readBufferIndex - internals->writeBufferIndex);
-        if (buffersAvailable * internals->buffersize >= internals->latencySamples) { // if we have enough audio input available
-            internals->callback(internals->clientdata, internals->fifobuffer + internals->readBufferIndex * internals->bufferStep, internals->buffersize, internals->samplerate);
-            if (internals->readBufferIndex < internals->numBuffers - 1) internals->readBufferIndex++; else internals->readBufferIndex = 0;
+        float *input = SuperpoweredAndroidAudioIOFifo_readBuffer(fifo);
+        if (input) { // if we have enough audio input available
+            internals->callback(internals->clientdata, input, internals->buffersize, internals->samplerate);
+            SuperpoweredAndroidAudioIOFifo_consume(fifo);
         };
     }
-    (*caller)->Enqueue(caller, buffer, (SLuint32)internals->buffersize * NUM_CHANNELS * 2);
+    (*caller)->Enqueue(caller, inputQueueBuffer(internals), (SLuint32)internals->inputBytes);
 }
 
 // This is called periodically by the output audio queue. Audio for the user should be provided here.
 static void SuperpoweredAndroidAudioIO_OutputCallback(SLAndroidSimpleBufferQueueItf caller, void *pContext) {
     SuperpoweredAndroidAudioIOInternals *internals = (SuperpoweredAndroidAudioIOInternals *)pContext;
-
-    int buffersAvailable = internals->writeBufferIndex - internals->readBufferIndex;
-    if (buffersAvailable < 0) buffersAvailable = internals->numBuffers - (internals->readBufferIndex - internals->writeBufferIndex);
-    short int *output = internals->fifobuffer + internals->readBufferIndex * internals->bufferStep;
+    SuperpoweredAndroidAudioIOFifo *fifo = &internals->fifo;
+    float *output;
 
     if (internals->hasInput) { // If audio input is enabled.
-        if (buffersAvailable * internals->buffersize >= internals->latencySamples) { // if we have enough audio input available
+        output = SuperpoweredAndroidAudioIOFifo_readBuffer(fifo);
+        if (output) { // if we have enough audio input available
             if (!internals->callback(internals->clientdata, output, internals->buffersize, internals->samplerate)) {
-                memset(output, 0, (size_t)internals->buffersize * NUM_CHANNELS * 2);
+                memset(output, 0, (size_t)internals->buffersize * NUM_CHANNELS * sizeof(float));
                 internals->silenceSamples += internals->buffersize;
             } else internals->silenceSamples = 0;
-        } else output = NULL; // dropout, not enough audio input
+        } else { // dropout, not enough audio input
+            __atomic_add_fetch(&internals->inputUnderruns, 1, __ATOMIC_RELAXED);
+        };
     } else { // If audio input is not enabled.
-        short int *audioToGenerate = internals->fifobuffer + internals->writeBufferIndex * internals->bufferStep;
+        float *audioToGenerate = SuperpoweredAndroidAudioIOFifo_writeBuffer(fifo);
 
         if (!internals->callback(internals->clientdata, audioToGenerate, internals->buffersize, internals->samplerate)) {
-            memset(audioToGenerate, 0, (size_t)internals->buffersize * NUM_CHANNELS * 2);
+            memset(audioToGenerate, 0, (size_t)internals->buffersize * NUM_CHANNELS * sizeof(float));
             internals->silenceSamples += internals->buffersize;
         } else internals->silenceSamples = 0;
 
-        if (internals->writeBufferIndex < internals->numBuffers - 1) internals->writeBufferIndex++; else internals->writeBufferIndex = 0;
-        if ((buffersAvailable + 1) * internals->buffersize < internals->latencySamples) output = NULL; // dropout, not enough audio generated
+        SuperpoweredAndroidAudioIOFifo_publish(fifo);
+        output = SuperpoweredAndroidAudioIOFifo_readBuffer(fifo);
+        if (!output) { // dropout, not enough audio generated
+            __atomic_add_fetch(&internals->outputUnderruns, 1, __ATOMIC_RELAXED);
+        };
     };
 
-    if (output) {
-        if (internals->readBufferIndex < internals->numBuffers - 1) internals->readBufferIndex++; else internals->readBufferIndex = 0;
-    };
-    (*caller)->Enqueue(caller, output ? output : internals->silence, (SLuint32)internals->buffersize * NUM_CHANNELS * 2);
+    if (output) SuperpoweredAndroidAudioIOFifo_consume(fifo); // still ours while it plays, see SuperpoweredAndroidAudioIOFifo
+    else __atomic_add_fetch(&internals->silenceSubstitutions, 1, __ATOMIC_RELAXED);
+    if (output && internals->outputShorts) { // the one buffer queued has finished playing, so it can be converted into
+        SuperpoweredFloatToShortInt(output, internals->outputShorts, (unsigned int)internals->buffersize, NUM_CHANNELS);
+        (*caller)->Enqueue(caller, internals->outputShorts, (SLuint32)internals->outputBytes);
+    } else (*caller)->Enqueue(caller, output ? output : internals->silence, (SLuint32)internals->outputBytes);
 
     if (!internals->foreground && (internals->silenceSamples > internals->samplerate)) {
         internals->silenceSamples = 0;
@@ -105,7 +127,7 @@ static void SuperpoweredAndroidAudioIO_OutputCallback(SLAndroidSimpleBufferQueue
     };
 }
 
-SuperpoweredAndroidAudioIO::SuperpoweredAndroidAudioIO(int samplerate, int buffersize, bool enableInput, bool enableOutput, audioProcessingCallback callback, void *clientdata, int inputStreamType, int outputStreamType, int latencySamples) {
+SuperpoweredAndroidAudioIO::SuperpoweredAndroidAudioIO(int samplerate, int buffersize, bool enableInput, bool enableOutput, audioProcessingCallback callback, void *clientdata, int inputStreamType, int outputStreamType, int latencySamples, int minLatencySamples, int maxLatencySamples, int numberOfInputChannels) {
     static const SLboolean requireds[2] = { SL_BOOLEAN_TRUE, SL_BOOLEAN_FALSE };
 
     internals = new SuperpoweredAndroidAudioIOInternals;
@@ -116,18 +138,13 @@ SuperpoweredAndroidAudioIO::SuperpoweredAndroidAudioIO(int samplerate, int buffe
     internals->callback = callback;
     internals->hasInput = enableInput;
     internals->hasOutput = enableOutput;
+    internals->inputChannels = internals->recordedChannels = numberOfInputChannels == 1 ? 1 : NUM_CHANNELS;
     internals->foreground = true;
     internals->started = false;
-    internals->silence = (short int *)malloc((size_t)buffersize * NUM_CHANNELS * 2);
-    memset(internals->silence, 0, (size_t)buffersize * NUM_CHANNELS * 2);
-    internals->latencySamples = latencySamples < buffersize ? buffersize : latencySamples;
-
-    internals->numBuffers = (internals->latencySamples / buffersize) * 2;
-    if (internals->numBuffers < 32) internals->numBuffers = 32;
-    internals->bufferStep = (buffersize + 64) * NUM_CHANNELS;
-    size_t fifoBufferSizeBytes = internals->numBuffers * internals->bufferStep * sizeof(short int);
-    internals->fifobuffer = (short int *)malloc(fifoBufferSizeBytes);
-    memset(internals->fifobuffer, 0, fifoBufferSizeBytes);
+    internals->silence = (float *)calloc((size_t)buffersize * NUM_CHANNELS, sizeof(float)); // silence in 16-bit too
+    if (!enableInput || !enableOutput) minLatencySamples = maxLatencySamples = latencySamples; // one thread, no jitter between the sides
+    SuperpoweredAndroidAudioIOFifo_init(&internals->fifo, buffersize, latencySamples, minLatencySamples, maxLatencySamples, samplerate * LATENCY_WINDOW_SECONDS / buffersize, NUM_CHANNELS);
+    if (enableInput && enableOutput) SuperpoweredAndroidAudioIOFifo_compensateDrift(&internals->fifo, samplerate, internals->inputChannels); // the input device may run on a clock of its own
 
     // Create the OpenSL ES engine.
     slCreateEngine(&internals->openSLEngine, 0, NULL, 0, NULL, NULL);
@@ -143,10 +160,22 @@ SuperpoweredAndroidAudioIO::SuperpoweredAndroidAudioIO(int samplerate, int buffe
         SLDataLocator_IODevice deviceInputLocator = { SL_DATALOCATOR_IODEVICE, SL_IODEVICE_AUDIOINPUT, SL_DEFAULTDEVICEID_AUDIOINPUT, NULL };
         SLDataSource inputSource = { &deviceInputLocator, NULL };
         SLDataLocator_AndroidSimpleBufferQueue inputLocator = { SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE, 1 };
-        SLDataFormat_PCM inputFormat = { SL_DATAFORMAT_PCM, NUM_CHANNELS, (SLuint32)samplerate * 1000, SL_PCMSAMPLEFORMAT_FIXED_16, SL_PCMSAMPLEFORMAT_FIXED_16, SL_SPEAKER_FRONT_LEFT | SL_SPEAKER_FRONT_RIGHT, SL_BYTEORDER_LITTLEENDIAN };
-        SLDataSink inputSink = { &inputLocator, &inputFormat };
         const SLInterfaceID inputInterfaces[2] = { SL_IID_ANDROIDSIMPLEBUFFERQUEUE, SL_IID_ANDROIDCONFIGURATION };
-        (*openSLEngineInterface)->CreateAudioRecorder(openSLEngineInterface, &internals->inputBufferQueue, &inputSource, &inputSink, 2, inputInterfaces, requireds);
+        // Float, or 16-bit before Android 6. A mono input the device doesn't open is recorded in stereo and folded.
+        bool inputShorts = false, created = false;
+        for (int attempt = 0; attempt < 4 && !created; attempt++) {
+            SLuint32 channels = attempt < 2 ? (SLuint32)internals->inputChannels : NUM_CHANNELS, channelMask = channels == 1 ? SL_SPEAKER_FRONT_CENTER : SL_SPEAKER_FRONT_LEFT | SL_SPEAKER_FRONT_RIGHT;
+            if (attempt == 2 && internals->inputChannels == NUM_CHANNELS) break;
+            SLAndroidDataFormat_PCM_EX inputFloatFormat = { SL_ANDROID_DATAFORMAT_PCM_EX, channels, (SLuint32)samplerate * 1000, SL_PCMSAMPLEFORMAT_FIXED_32, SL_PCMSAMPLEFORMAT_FIXED_32, channelMask, SL_BYTEORDER_LITTLEENDIAN, SL_ANDROID_PCM_REPRESENTATION_FLOAT };
+            SLDataFormat_PCM inputFormat = { SL_DATAFORMAT_PCM, channels, (SLuint32)samplerate * 1000, SL_PCMSAMPLEFORMAT_FIXED_16, SL_PCMSAMPLEFORMAT_FIXED_16, channelMask, SL_BYTEORDER_LITTLEENDIAN };
+            inputShorts = (attempt & 1) != 0;
+            SLDataSink inputSink = { &inputLocator, inputShorts ? (void *)&inputFormat : (void *)&inputFloatFormat };
+            created = (*openSLEngineInterface)->CreateAudioRecorder(openSLEngineInterface, &internals->inputBufferQueue, &inputSource, &inputSink, 2, inputInterfaces, requireds) == SL_RESULT_SUCCESS;
+            internals->recordedChannels = (int)channels;
+        };
+        if (inputShorts) internals->inputShorts = (short int *)calloc((size_t)buffersize * internals->recordedChannels, sizeof(short int));
+        if (internals->recordedChannels != internals->inputChannels) internals->inputStereo = (float *)calloc((size_t)buffersize * NUM_CHANNELS, sizeof(float));
+        internals->inputBytes = buffersize * internals->recordedChannels * (inputShorts ? (int)sizeof(short int) : (int)sizeof(float));
 
         if (inputStreamType == -1) inputStreamType = (int)SL_ANDROID_RECORDING_PRESET_VOICE_RECOGNITION; // Configure the voice recognition preset which has no signal processing for lower latency.
         if (inputStreamType > -1) {
@@ -162,11 +191,17 @@ SuperpoweredAndroidAudioIO::SuperpoweredAndroidAudioIO(int samplerate, int buffe
 
     if (enableOutput) { // Create the audio output buffer queue.
         SLDataLocator_AndroidSimpleBufferQueue outputLocator = { SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE, 1 };
+        SLAndroidDataFormat_PCM_EX outputFloatFormat = { SL_ANDROID_DATAFORMAT_PCM_EX, NUM_CHANNELS, (SLuint32)samplerate * 1000, SL_PCMSAMPLEFORMAT_FIXED_32, SL_PCMSAMPLEFORMAT_FIXED_32, SL_SPEAKER_FRONT_LEFT | SL_SPEAKER_FRONT_RIGHT, SL_BYTEORDER_LITTLEENDIAN, SL_ANDROID_PCM_REPRESENTATION_FLOAT };
         SLDataFormat_PCM outputFormat = { SL_DATAFORMAT_PCM, NUM_CHANNELS, (SLuint32)samplerate * 1000, SL_PCMSAMPLEFORMAT_FIXED_16, SL_PCMSAMPLEFORMAT_FIXED_16, SL_SPEAKER_FRONT_LEFT | SL_SPEAKER_FRONT_RIGHT, SL_BYTEORDER_LITTLEENDIAN };
-        SLDataSource outputSource = { &outputLocator, &outputFormat };
+        SLDataSource outputSource = { &outputLocator, &outputFloatFormat };
         const SLInterfaceID outputInterfaces[2] = { SL_IID_BUFFERQUEUE, SL_IID_ANDROIDCONFIGURATION };
         SLDataSink outputSink = { &outputMixLocator, NULL };
-        (*openSLEngineInterface)->CreateAudioPlayer(openSLEngineInterface, &internals->outputBufferQueue, &outputSource, &outputSink, 2, outputInterfaces, requireds);
+        if ((*openSLEngineInterface)->CreateAudioPlayer(openSLEngineInterface, &internals->outputBufferQueue, &outputSource, &outputSink, 2, outputInterfaces, requireds) != SL_RESULT_SUCCESS) { // no float playback before Android 5
+            outputSource.pFormat = &outputFormat;
+            (*openSLEngineInterface)->CreateAudioPlayer(openSLEngineInterface, &internals->outputBufferQueue, &outputSource, &outputSink, 2, outputInterfaces, requireds);
+            internals->outputShorts = (short int *)calloc((size_t)buffersize * NUM_CHANNELS, sizeof(short int));
+        };
+        internals->outputBytes = buffersize * NUM_CHANNELS * (internals->outputShorts ? (int)sizeof(short int) : (int)sizeof(float));
 
         // Configure the stream type.
         if (outputStreamType > -1) {
@@ -183,13 +218,13 @@ SuperpoweredAndroidAudioIO::SuperpoweredAndroidAudioIO(int samplerate, int buffe
     if (enableInput) { // Initialize the audio input buffer queue.
         (*internals->inputBufferQueue)->GetInterface(internals->inputBufferQueue, SL_IID_ANDROIDSIMPLEBUFFERQUEUE, &internals->inputBufferQueueInterface);
         (*internals->inputBufferQueueInterface)->RegisterCallback(internals->inputBufferQueueInterface, SuperpoweredAndroidAudioIO_InputCallback, internals);
-        (*internals->inputBufferQueueInterface)->Enqueue(internals->inputBufferQueueInterface, internals->fifobuffer, (SLuint32)buffersize * NUM_CHANNELS * 2);
+        (*internals->inputBufferQueueInterface)->Enqueue(internals->inputBufferQueueInterface, inputQueueBuffer(internals), (SLuint32)internals->inputBytes);
     };
 
     if (enableOutput) { // Initialize the audio output buffer queue.
         (*internals->outputBufferQueue)->GetInterface(internals->outputBufferQueue, SL_IID_BUFFERQUEUE, &internals->outputBufferQueueInterface);
         (*internals->outputBufferQueueInterface)->RegisterCallback(internals->outputBufferQueueInterface, SuperpoweredAndroidAudioIO_OutputCallback, internals);
-        (*internals->outputBufferQueueInterface)->Enqueue(internals->outputBufferQueueInterface, internals->fifobuffer, (SLuint32)buffersize * NUM_CHANNELS * 2);
+        (*internals->outputBufferQueueInterface)->Enqueue(internals->outputBufferQueueInterface, internals->silence, (SLuint32)internals->outputBytes);
     };
 
     startQueues(internals);
@@ -212,6 +247,17 @@ void SuperpoweredAndroidAudioIO::stop() {
     stopQueues(internals);
 }
 
+void SuperpoweredAndroidAudioIO::getDropouts(unsigned int *inputUnderruns, unsigned int *outputUnderruns, unsigned int *silenceSubstitutions, unsigned int *inputOverruns) {
+    *inputUnderruns = __atomic_load_n(&internals->inputUnderruns, __ATOMIC_RELAXED);
+    *outputUnderruns = __atomic_load_n(&internals->outputUnderruns, __ATOMIC_RELAXED);
+    *silenceSubstitutions = __atomic_load_n(&internals->silenceSubstitutions, __ATOMIC_RELAXED);
+    *inputOverruns = __atomic_load_n(&internals->fifo.overruns, __ATOMIC_RELAXED);
+}
+
+int SuperpoweredAndroidAudioIO::getLatency() {
+    return SuperpoweredAndroidAudioIOFifo_getLatency(&internals->fifo);
+}
+
 SuperpoweredAndroidAudioIO::~SuperpoweredAndroidAudioIO() {
     stopQueues(internals);
     usleep(200000);
@@ -219,7 +265,10 @@ SuperpoweredAndroidAudioIO::~SuperpoweredAndroidAudioIO() {
     if (internals->inputBufferQueue) (*internals->inputBufferQueue)->Destroy(internals->inputBufferQueue);
     (*internals->outputMix)->Destroy(internals->outputMix);
     (*internals->openSLEngine)->Destroy(internals->openSLEngine);
-    free(internals->fifobuffer);
+    SuperpoweredAndroidAudioIOFifo_free(&internals->fifo);
     free(internals->silence);
+    free(internals->inputShorts);
+    free(internals->inputStereo);
+    free(internals->outputShorts);
     delete internals;
 }
@@ -9,11 +9,11 @@ struct SuperpoweredAndroidAudioIOInternals;
  If the application requires both audio input and audio output, this callback is called once (there is no separate audio input and audio output callback). Audio input is available in audioIO, and the application should change it's contents for audio output.
 
  @param clientdata A custom pointer your callback receives.
- @param audioIO 16-bit stereo interleaved audio input and/or output.
+ @param audioIO 32-bit floating point stereo interleaved audio input and/or output. With a mono input, the input is the first numberOfSamples values, and the output is stereo over the whole buffer.
  @param numberOfSamples The number of samples received and/or requested.
  @param samplerate The current sample rate in Hz.
 */
-typedef bool (*audioProcessingCallback) (void *clientdata, short int *audioIO, int numberOfSamples, int samplerate);
+typedef bool (*audioProcessingCallback) (void *clientdata, float *audioIO, int numberOfSamples, int samplerate);
 
 /**
  @brief Easy handling of OpenSL ES audio input and/or output.
@@ -23,6 +23,10 @@ public:
 /**
  @brief Creates an audio I/O instance. Audio input and/or output immediately starts after calling this.
 
+ Audio is float from the device to the callback and back where OpenSL ES takes it, on Android 5 and up for output and 6 and up for input; otherwise that side is converted from or to 16-bit at the buffer queue.
+
+ With both input and output enabled, the input is resampled to the output's clock when the two drift apart, such as a USB microphone with the built-in speaker.
+
  @param samplerate The requested sample rate in Hz.
  @param buffersize The requested buffer size (number of samples).
  @param enableInput Enable audio input.
@@ -31,9 +35,12 @@ public:
  @param clientdata A custom pointer the callback receives.
  @param inputStreamType OpenSL ES stream type, such as SL_ANDROID_RECORDING_PRESET_GENERIC. -1 means default. SLES/OpenSLES_AndroidConfiguration.h has them.
  @param outputStreamType OpenSL ES stream type, such as SL_ANDROID_STREAM_MEDIA or SL_ANDROID_STREAM_VOICE. -1 means default. SLES/OpenSLES_AndroidConfiguration.h has them.
- @param latencySamples How many samples to have in the internal fifo buffer minimum. Works only when both input and output are enabled. Might help if you have many dropouts.
+ @param latencySamples How many samples of audio input to have in the internal fifo buffer before processing starts. Might help if you have many dropouts.
+ @param minLatencySamples With both input and output enabled, the fifo adapts to the callback jitter it sees: it fills up further after a dropout and gives back latency when it isn't needed, within minLatencySamples and maxLatencySamples. 0 keeps it at latencySamples.
+ @param maxLatencySamples See minLatencySamples.
+ @param numberOfInputChannels 1 for a mono input, 2 for stereo. A device that only records stereo is folded to mono. The output is always stereo.
  */
-    SuperpoweredAndroidAudioIO(int samplerate, int buffersize, bool enableInput, bool enableOutput, audioProcessingCallback callback, void *clientdata, int inputStreamType = -1, int outputStreamType = -1, int latencySamples = 0);
+    SuperpoweredAndroidAudioIO(int samplerate, int buffersize, bool enableInput, bool enableOutput, audioProcessingCallback callback, void *clientdata, int inputStreamType = -1, int outputStreamType = -1, int latencySamples = 0, int minLatencySamples = 0, int maxLatencySamples = 0, int numberOfInputChannels = 2);
     ~SuperpoweredAndroidAudioIO();
 
 /*
@@ -56,6 +63,21 @@ public:
  @brief Stops audio input and/or output.
 */
     void stop();
+/*
+ @brief Dropout counters since the instance was created. Can be called from any thread.
+
+ @param inputUnderruns Output callbacks that found not enough audio input in the fifo.
+ @param outputUnderruns Output callbacks that found not enough generated audio in the fifo.
+ @param silenceSubstitutions Buffers of silence enqueued instead of audio because of the above.
+ @param inputOverruns Recorded buffers lost because the fifo was full.
+*/
+    void getDropouts(unsigned int *inputUnderruns, unsigned int *outputUnderruns, unsigned int *silenceSubstitutions, unsigned int *inputOverruns);
+/*
+ @brief The current latency of the internal fifo buffer in samples. Can be called from any thread.
+
+ Audio input reaches the callback this much later than if it had never waited in the fifo. It changes by a buffer when the fifo plays silence to fill up, or drops or loses a buffer of input.
+*/
+    int getLatency();
 
 private:
     SuperpoweredAndroidAudioIOInternals *internals;
@@ -0,0 +1,269 @@
+#ifndef Header_SuperpoweredAndroidAudioIOFifo
+#define Header_SuperpoweredAndroidAudioIOFifo
+
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define FIFO_DRIFT_SETTLE_BLOCKS 4 // blocks of about a second before the fill level to hold is taken
+#define FIFO_DRIFT_CORRECTION_SECONDS 8 // a fill level error is corrected over about this much
+#define FIFO_DRIFT_TRACKING_SECONDS 32 // the drift estimate follows the correction over about this much
+#define FIFO_DRIFT_MAX_PPM 1000
+#define FIFO_DRIFT_HISTORY_FRAMES 3 // input frames the interpolator keeps from the buffer before
+
+/**
+ @brief The ring of buffers between the input and the output callback of SuperpoweredAndroidAudioIO.
+
+ Buffers are 32-bit float, interleaved.
+
+ Single producer, single consumer: with both input and output enabled, the input callback records into the ring and the output callback processes and plays from it, each on its own OpenSL ES thread. With only one of them enabled, one thread does both.
+
+ written and read count buffers since the start, they never decrease. Only the producer stores written and only the consumer stores read; each stores its counter with release after it is done with the buffer and loads the other's with acquire before it touches one, so a buffer is never seen half recorded or reused while it is read. numBuffers is a power of two, so the counters can wrap.
+
+ Besides the published buffers, two are taken: the one being recorded into and the one the output queue is playing. The producer doesn't publish into them; when the ring is full it records over its last buffer and counts an overrun instead, and the next buffer it publishes carries the count in lostBefore.
+
+ The consumer keeps the ring at a target fill level, a jitter buffer: it waits for the target before it starts reading, and after that reads as long as there is a buffer. An underrun raises the target by a buffer, up to maxLatencySamples, and waits for it again. A window of windowBuffers reads in which at least one buffer was always left over lowers the target by a buffer, down to minLatencySamples, and drops the oldest buffers the window shows were more than the target needs.
+
+ latencySamples is how much later the consumer gets each buffer than if nothing had ever waited in the ring: every callback that played silence while the input went on adds a buffer, every buffer dropped or lost to an overrun takes one away once the consumer gets past it. Buffers that arrive early or late by jitter don't change it.
+
+ When input and output run on separate clocks, the ring fills or drains by the difference, and the consumer would keep underrunning or dropping. With drift compensation the producer records into a buffer of its own and resamples it into the ring, measuring the fill level against latencySamples at every buffer: silence and drops move both by as much, so only the drift and jitter are left. The output plays on between its callbacks, so the time since its last one counts as played; otherwise the level would only move by whole buffers, whenever the callbacks of the two sides slide past each other. Until the mean of a block of about a second gets half a buffer off the level it settled at, the rate stays 1, which passes the input through unchanged but for a delay of two frames, as with a shared clock. From then on a PI loop sets the rate of a 4-point Hermite interpolator, its slow integral part being the drift estimate, and the consumer keeps a buffer more, as the input now arrives at any point of the output's period.
+*/
+typedef struct SuperpoweredAndroidAudioIOFifo {
+    float *buffer;
+    unsigned int *lostBefore; // per buffer, overruns since the buffer published before it
+    int buffersize, numBuffers, bufferStep;
+    unsigned int written, read;
+    unsigned int overrunning; // the producer's only
+    // The consumer's only.
+    int minLatencySamples, maxLatencySamples, targetSamples, windowBuffers, windowReads, windowMinimum, dropping;
+    bool priming, primed;
+    // Updated with atomic builtins, read from any thread.
+    int latencySamples;
+    unsigned int overruns, drops;
+    // Drift compensation, the producer's only.
+    float *recordBuffer; // FIFO_DRIFT_HISTORY_FRAMES frames of the buffer before, then the one recorded
+    double rate, position; // input frames per output frame, and the input frame the next output frame is at
+    long long (*clock)(void); // nanoseconds
+    long long callbackNanos; // the consumer's last callback, updated with atomic builtins
+    int samplerate, channels, slotFrames, driftBlockBuffers, driftBlockCount, driftBlocks;
+    double driftSum, driftReference, driftIntegral;
+    bool resampling; // the clocks were seen drifting apart, stored with an atomic builtin for the consumer
+} SuperpoweredAndroidAudioIOFifo;
+
+/*
+ Starts at a target of latencySamples, kept between minLatencySamples and maxLatencySamples; 0 for either bound means latencySamples. The ring holds twice the largest target, at least 32 buffers.
+*/
+static inline void SuperpoweredAndroidAudioIOFifo_init(SuperpoweredAndroidAudioIOFifo *fifo, int buffersize, int latencySamples, int minLatencySamples, int maxLatencySamples, int windowBuffers, int numberOfChannels) {
+    memset(fifo, 0, sizeof(SuperpoweredAndroidAudioIOFifo));
+    fifo->buffersize = buffersize;
+    fifo->targetSamples = latencySamples < buffersize ? buffersize : latencySamples;
+    fifo->minLatencySamples = minLatencySamples <= 0 || minLatencySamples > fifo->targetSamples ? fifo->targetSamples : minLatencySamples;
+    if (fifo->minLatencySamples < buffersize) fifo->minLatencySamples = buffersize;
+    fifo->maxLatencySamples = maxLatencySamples < fifo->targetSamples ? fifo->targetSamples : maxLatencySamples;
+    fifo->windowBuffers = windowBuffers > 0 ? windowBuffers : 1;
+    fifo->windowMinimum = INT_MAX;
+    fifo->priming = true;
+    fifo->latencySamples = fifo->targetSamples;
+
+    int numBuffers = ((fifo->maxLatencySamples + buffersize - 1) / buffersize) * 2;
+    fifo->numBuffers = 32;
+    while (fifo->numBuffers < numBuffers) fifo->numBuffers *= 2;
+    fifo->channels = numberOfChannels;
+    fifo->bufferStep = (buffersize + 64) * numberOfChannels;
+    size_t bytes = (size_t)fifo->numBuffers * fifo->bufferStep * sizeof(float);
+    fifo->buffer = (float *)malloc(bytes);
+    memset(fifo->buffer, 0, bytes);
+    fifo->lostBefore = (unsigned int *)calloc((size_t)fifo->numBuffers, sizeof(unsigned int));
+}
+
+static inline long long SuperpoweredAndroidAudioIOFifo_monotonicNanos(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Before the first buffer is recorded. The input may have fewer channels than the buffers have room for.
+static inline void SuperpoweredAndroidAudioIOFifo_compensateDrift(SuperpoweredAndroidAudioIOFifo *fifo, int samplerate, int numberOfChannels) {
+    fifo->channels = numberOfChannels;
+    fifo->recordBuffer = (float *)calloc((size_t)fifo->bufferStep + FIFO_DRIFT_HISTORY_FRAMES * fifo->channels, sizeof(float));
+    fifo->rate = 1.0;
+    fifo->position = 1.0; // the interpolator needs a frame before the one it is at
+    fifo->clock = SuperpoweredAndroidAudioIOFifo_monotonicNanos;
+    fifo->samplerate = samplerate;
+    fifo->driftBlockBuffers = samplerate / fifo->buffersize > 0 ? samplerate / fifo->buffersize : 1;
+}
+
+static inline void SuperpoweredAndroidAudioIOFifo_free(SuperpoweredAndroidAudioIOFifo *fifo) {
+    free(fifo->buffer);
+    free(fifo->lostBefore);
+    free(fifo->recordBuffer);
+    fifo->buffer = fifo->recordBuffer = NULL;
+    fifo->lostBefore = NULL;
+}
+
+// Producer. The buffer to record or generate into next.
+static inline float *SuperpoweredAndroidAudioIOFifo_writeBuffer(SuperpoweredAndroidAudioIOFifo *fifo) {
+    unsigned int written = __atomic_load_n(&fifo->written, __ATOMIC_RELAXED);
+    return fifo->buffer + (written & (fifo->numBuffers - 1)) * fifo->bufferStep;
+}
+
+// Producer. Publishes the buffer of writeBuffer(). Returns false, publishing nothing, if the ring is full.
+static inline bool SuperpoweredAndroidAudioIOFifo_publish(SuperpoweredAndroidAudioIOFifo *fifo) {
+    unsigned int written = __atomic_load_n(&fifo->written, __ATOMIC_RELAXED);
+    unsigned int read = __atomic_load_n(&fifo->read, __ATOMIC_ACQUIRE);
+    if (written + 1 - read > (unsigned int)fifo->numBuffers - 2) { // the next buffer is still queued or playing
+        __atomic_add_fetch(&fifo->overruns, 1, __ATOMIC_RELAXED);
+        fifo->overrunning++;
+        return false;
+    };
+    fifo->lostBefore[written & (fifo->numBuffers - 1)] = fifo->overrunning;
+    fifo->overrunning = 0;
+    __atomic_store_n(&fifo->written, written + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/*
+ Consumer. The oldest published buffer, or NULL if the callback has to play silence: the ring is filling up to the target, or ran empty.
+*/
+static inline float *SuperpoweredAndroidAudioIOFifo_readBuffer(SuperpoweredAndroidAudioIOFifo *fifo) {
+    unsigned int read = __atomic_load_n(&fifo->read, __ATOMIC_RELAXED);
+    unsigned int written = __atomic_load_n(&fifo->written, __ATOMIC_ACQUIRE);
+    int available = (int)(written - read);
+    if (fifo->recordBuffer) __atomic_store_n(&fifo->callbackNanos, fifo->clock(), __ATOMIC_RELAXED);
+
+    if (fifo->priming) {
+        if (available * fifo->buffersize < fifo->targetSamples) {
+            if (fifo->primed) __atomic_add_fetch(&fifo->latencySamples, fifo->buffersize, __ATOMIC_RELAXED);
+            return NULL;
+        };
+        if (!fifo->primed) __atomic_add_fetch(&fifo->latencySamples, available * fifo->buffersize - fifo->targetSamples, __ATOMIC_RELAXED);
+        fifo->priming = false;
+        fifo->primed = true;
+    } else if (available < 1) { // underrun: the input is late by more than the target covers
+        if (fifo->targetSamples < fifo->maxLatencySamples) fifo->targetSamples += fifo->buffersize;
+        if (fifo->targetSamples > fifo->maxLatencySamples) fifo->targetSamples = fifo->maxLatencySamples;
+        fifo->priming = true;
+        fifo->dropping = 0;
+        fifo->windowReads = 0;
+        fifo->windowMinimum = INT_MAX;
+        __atomic_add_fetch(&fifo->latencySamples, fifo->buffersize, __ATOMIC_RELAXED);
+        return NULL;
+    };
+
+    int lost = 0;
+    if (fifo->dropping > 0) { // the buffer before this one finished playing, so the oldest can go
+        int drop = fifo->dropping < available ? fifo->dropping : available - 1;
+        for (int n = 0; n < drop; n++) lost += 1 + (int)fifo->lostBefore[(read + n) & (fifo->numBuffers - 1)];
+        read += drop;
+        available -= drop;
+        fifo->dropping = 0;
+        __atomic_store_n(&fifo->read, read, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&fifo->drops, drop, __ATOMIC_RELAXED);
+    };
+    lost += (int)fifo->lostBefore[read & (fifo->numBuffers - 1)];
+    if (lost > 0) __atomic_add_fetch(&fifo->latencySamples, -lost * fifo->buffersize, __ATOMIC_RELAXED);
+    if (available < fifo->windowMinimum) fifo->windowMinimum = available;
+    return fifo->buffer + (read & (fifo->numBuffers - 1)) * fifo->bufferStep;
+}
+
+// Consumer. Done with the buffer of readBuffer(). Until the next read the producer still leaves it alone, as it is the one playing.
+static inline void SuperpoweredAndroidAudioIOFifo_consume(SuperpoweredAndroidAudioIOFifo *fifo) {
+    unsigned int read = __atomic_load_n(&fifo->read, __ATOMIC_RELAXED);
+    __atomic_store_n(&fifo->read, read + 1, __ATOMIC_RELEASE);
+
+    if (++fifo->windowReads < fifo->windowBuffers) return;
+    // A buffer was left over at every read of the window: lower the target, and keep no more than it at the fullest.
+    if (fifo->windowMinimum > 1) {
+        int minimum = fifo->minLatencySamples + (__atomic_load_n(&fifo->resampling, __ATOMIC_RELAXED) ? fifo->buffersize : 0);
+        fifo->targetSamples -= fifo->buffersize;
+        if (fifo->targetSamples < minimum) fifo->targetSamples = minimum;
+        int keep = fifo->targetSamples / fifo->buffersize;
+        fifo->dropping = fifo->windowMinimum - (keep > 1 ? keep : 1);
+    };
+    fifo->windowReads = 0;
+    fifo->windowMinimum = INT_MAX;
+}
+
+// Producer. The buffer to record into next: the ring's own, or with drift compensation the producer's.
+static inline float *SuperpoweredAndroidAudioIOFifo_recordBuffer(SuperpoweredAndroidAudioIOFifo *fifo) {
+    return fifo->recordBuffer ? fifo->recordBuffer + FIFO_DRIFT_HISTORY_FRAMES * fifo->channels : SuperpoweredAndroidAudioIOFifo_writeBuffer(fifo);
+}
+
+// Producer. A block of fill level errors is in: engages and corrects the rate.
+static inline void SuperpoweredAndroidAudioIOFifo_followDrift(SuperpoweredAndroidAudioIOFifo *fifo, double error) {
+    if (fifo->driftBlocks < FIFO_DRIFT_SETTLE_BLOCKS) { // priming and the first adaptations
+        if (++fifo->driftBlocks == FIFO_DRIFT_SETTLE_BLOCKS) fifo->driftReference = error;
+        return;
+    };
+    error -= fifo->driftReference;
+    if (!fifo->resampling) {
+        if (fabs(error) < fifo->buffersize / 2) return;
+        __atomic_store_n(&fifo->resampling, true, __ATOMIC_RELAXED);
+    };
+    double seconds = (double)fifo->driftBlockBuffers * fifo->buffersize / fifo->samplerate, perFrame = 1.0 / ((double)fifo->samplerate * FIFO_DRIFT_CORRECTION_SECONDS);
+    double integral = fifo->driftIntegral + error * seconds;
+    double estimate = integral * perFrame / FIFO_DRIFT_TRACKING_SECONDS, ratio = estimate + error * perFrame;
+    if (fabs(ratio) <= FIFO_DRIFT_MAX_PPM * 1e-6) fifo->driftIntegral = integral; // no windup at the limit
+    else ratio = ratio < 0 ? -FIFO_DRIFT_MAX_PPM * 1e-6 : FIFO_DRIFT_MAX_PPM * 1e-6;
+    fifo->rate = 1.0 + ratio; // above 1 it takes more input for each output frame
+}
+
+// Producer. Interpolates the recorded buffer into the ring at the current rate, publishing as buffers fill up.
+static inline void SuperpoweredAndroidAudioIOFifo_resample(SuperpoweredAndroidAudioIOFifo *fifo) {
+    int channels = fifo->channels, end = fifo->buffersize + 1; // the last frame the interpolator can be at needs two after it
+    double position = fifo->position;
+    float *slot = SuperpoweredAndroidAudioIOFifo_writeBuffer(fifo) + fifo->slotFrames * channels;
+    while (position < end) {
+        int frame = (int)position;
+        float t = (float)(position - frame);
+        const float *x = fifo->recordBuffer + (frame - 1) * channels;
+        for (int c = 0; c < channels; c++) {
+            float x0 = x[c], x1 = x[channels + c], x2 = x[channels * 2 + c], x3 = x[channels * 3 + c];
+            float c1 = 0.5f * (x2 - x0), c2 = x0 - 2.5f * x1 + 2.0f * x2 - 0.5f * x3, c3 = 0.5f * (x3 - x0) + 1.5f * (x1 - x2);
+            *slot++ = ((c3 * t + c2) * t + c1) * t + x1; // exactly x1 at t = 0
+        };
+        position += fifo->rate;
+        if (++fifo->slotFrames == fifo->buffersize) {
+            SuperpoweredAndroidAudioIOFifo_publish(fifo); // if full, the next buffer is recorded over this one
+            fifo->slotFrames = 0;
+            slot = SuperpoweredAndroidAudioIOFifo_writeBuffer(fifo);
+        };
+    };
+    fifo->position = position - fifo->buffersize;
+    memmove(fifo->recordBuffer, fifo->recordBuffer + fifo->buffersize * channels, FIFO_DRIFT_HISTORY_FRAMES * channels * sizeof(float));
+}
+
+/*
+ Producer. The buffer of recordBuffer() is recorded: publishes it, or with drift compensation resamples it into the ring, publishing as buffers fill up, and measures the drift.
+*/
+static inline void SuperpoweredAndroidAudioIOFifo_recorded(SuperpoweredAndroidAudioIOFifo *fifo) {
+    if (!fifo->recordBuffer) {
+        SuperpoweredAndroidAudioIOFifo_publish(fifo);
+        return;
+    };
+    SuperpoweredAndroidAudioIOFifo_resample(fifo);
+
+    unsigned int read = __atomic_load_n(&fifo->read, __ATOMIC_ACQUIRE);
+    double played = (double)(fifo->clock() - __atomic_load_n(&fifo->callbackNanos, __ATOMIC_RELAXED)) * fifo->samplerate * 1e-9;
+    if (played < 0) played = 0; else if (played > fifo->buffersize) played = fifo->buffersize;
+    int fill = (int)(fifo->written - read) * fifo->buffersize + fifo->slotFrames;
+    fifo->driftSum += fill - played - __atomic_load_n(&fifo->latencySamples, __ATOMIC_RELAXED);
+    if (++fifo->driftBlockCount < fifo->driftBlockBuffers) return;
+    SuperpoweredAndroidAudioIOFifo_followDrift(fifo, fifo->driftSum / fifo->driftBlockCount);
+    fifo->driftSum = 0;
+    fifo->driftBlockCount = 0;
+}
+
+// Producer. The input clock against the output clock as resampled, in parts per million; 0 until they drift apart.
+static inline double SuperpoweredAndroidAudioIOFifo_getDrift(SuperpoweredAndroidAudioIOFifo *fifo) {
+    return fifo->resampling ? (fifo->rate - 1.0) * 1e6 : 0;
+}
+
+// Any thread. The effective latency of the ring in samples, see above.
+static inline int SuperpoweredAndroidAudioIOFifo_getLatency(SuperpoweredAndroidAudioIOFifo *fifo) {
+    return __atomic_load_n(&fifo->latencySamples, __ATOMIC_RELAXED);
+}
+
+#endif
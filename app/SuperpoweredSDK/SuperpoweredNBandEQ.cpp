@@ -44,7 +44,7 @@ SuperpoweredNBandEQ::~SuperpoweredNBandEQ() {
     for (int n = 0; n < internals->numFilters; n++) delete internals->filters[n];
     delete[] internals->filters;
     delete internals;
-    delete decibels;
+    delete[] decibels;
 }
 
 void SuperpoweredNBandEQ::setSamplerate(unsigned int samplerate) {
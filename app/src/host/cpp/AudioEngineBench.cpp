@@ -0,0 +1,201 @@
+//
+// Micro-benchmarks for the engine's hot path kernels, run on the host build.
+//
+
+#include "Mixer.h"
+#include "MasterBus.h"
+#include <SuperpoweredSimple.h>
+#include <malloc.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_MAX_TRACKS 32
+#define BENCH_SAMPLE_RATE 44100
+// Most the summing bus may differ from add-in-place once the gains are steady.
+#define BENCH_MAX_ERROR 1e-5f
+
+static double nowSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static float *allocateStereo(unsigned int numberOfSamples) {
+    return (float *)memalign(16, (numberOfSamples + 16) * sizeof(float) * 2);
+}
+
+// What the engine did before the summing bus: every player adds into the output with its volume.
+// A mono track is first spread to stereo, as a player renders it.
+static void mixAddInPlace(float **tracks, int count, int channels, float *stereo, float *output,
+                          unsigned int numberOfSamples) {
+    memset(output, 0, numberOfSamples * sizeof(float) * 2);
+    for (int i = 0; i < count; i++) {
+        float *track = tracks[i];
+        if (channels == 1) {
+            for (unsigned int n = 0; n < numberOfSamples; n++) {
+                stereo[n * 2] = stereo[n * 2 + 1] = tracks[i][n];
+            }
+            track = stereo;
+        }
+        SuperpoweredVolumeAdd(track, output, 0.5f, 0.5f, numberOfSamples);
+    }
+}
+
+// Returns false if the summing bus doesn't match add-in-place.
+static bool benchSumming(int count, int channels, unsigned int numberOfSamples, int iterations) {
+    float *tracks[BENCH_MAX_TRACKS];
+    MixerInput inputs[BENCH_MAX_TRACKS] = {};
+    for (int i = 0; i < count; i++) {
+        tracks[i] = allocateStereo(numberOfSamples);
+        for (unsigned int n = 0; n < numberOfSamples * channels; n++) {
+            tracks[i][n] = sinf(0.01f * (n + i * 17));
+        }
+        inputs[i].buffer = tracks[i];
+        inputs[i].channels = channels;
+    }
+    float *stereo = allocateStereo(numberOfSamples);
+    float *output = allocateStereo(numberOfSamples);
+    float *reference = allocateStereo(numberOfSamples);
+
+    double start = nowSeconds();
+    for (int k = 0; k < iterations; k++) {
+        mixAddInPlace(tracks, count, channels, stereo, output, numberOfSamples);
+    }
+    double addInPlace = (nowSeconds() - start) / iterations;
+    memcpy(reference, output, numberOfSamples * sizeof(float) * 2);
+
+    start = nowSeconds();
+    for (int k = 0; k < iterations; k++) {
+        for (int i = 0; i < count; i++) {
+            // Ramps in every block, the worst case for the summing bus.
+            inputs[i].leftStart = inputs[i].rightStart = (k & 1) ? 0.25f : 0.5f;
+            inputs[i].leftEnd = inputs[i].rightEnd = 0.5f;
+        }
+        mixStereo(inputs, count, output, numberOfSamples);
+    }
+    double fused = (nowSeconds() - start) / iterations;
+
+    // Same result as the add-in-place path once the gains are steady.
+    for (int i = 0; i < count; i++) {
+        inputs[i].leftStart = inputs[i].rightStart = 0.5f;
+    }
+    mixStereo(inputs, count, output, numberOfSamples);
+    float error = 0;
+    for (unsigned int n = 0; n < numberOfSamples * 2; n++) {
+        error = fmaxf(error, fabsf(output[n] - reference[n]));
+    }
+
+    printf("%2d %s tracks  add-in-place: %8.2f us  fused: %8.2f us  speedup: %.2fx  max error: %g\n",
+           count, channels == 1 ? "mono" : "stereo", addInPlace * 1e6, fused * 1e6, addInPlace / fused, error);
+
+    for (int i = 0; i < count; i++) {
+        free(tracks[i]);
+    }
+    free(stereo);
+    free(output);
+    free(reference);
+    return error <= BENCH_MAX_ERROR;
+}
+
+// The pan laws at both extremes and in the centre, for mono and stereo tracks with and without
+// effects: a mono track with effects is mixed in stereo, with the stereo law. Returns false if a gain is off.
+static bool checkPanGains() {
+    struct { float pan; int trackChannels; bool effects; float left, right; } expected[] = {
+            {-1, 1, false, 1, 0}, {0, 1, false, (float)M_SQRT1_2, (float)M_SQRT1_2}, {1, 1, false, 0, 1},
+            {-1, 1, true, 1, 0}, {0, 1, true, 1, 1}, {1, 1, true, 0, 1},
+            {-1, 2, false, 1, 0}, {0, 2, false, 1, 1}, {1, 2, false, 0, 1},
+    };
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+        float left, right;
+        panGains(0.8f, expected[i].pan, mixerChannels(expected[i].trackChannels, expected[i].effects), &left, &right);
+        if (fabsf(left - 0.8f * expected[i].left) > 1e-6f || fabsf(right - 0.8f * expected[i].right) > 1e-6f) {
+            printf("pan %g %s%s: gains %g, %g, expected %g, %g\n", expected[i].pan,
+                   expected[i].trackChannels == 1 ? "mono" : "stereo", expected[i].effects ? " with effects" : "",
+                   left, right, 0.8f * expected[i].left, 0.8f * expected[i].right);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// The output stage on a mix loud enough to clip: conversion alone, then behind the master bus.
+static void benchMasterBus(unsigned int numberOfSamples, int iterations) {
+    float *mix = allocateStereo(numberOfSamples);
+    float *buffer = allocateStereo(numberOfSamples);
+    short int *output = (short int *)malloc((numberOfSamples + 16) * sizeof(short int) * 2);
+    for (unsigned int n = 0; n < numberOfSamples * 2; n++) {
+        mix[n] = 2.f * sinf(0.01f * n); // 8 tracks at half scale, summed
+    }
+
+    double start = nowSeconds();
+    for (int k = 0; k < iterations; k++) {
+        memcpy(buffer, mix, numberOfSamples * sizeof(float) * 2);
+        SuperpoweredFloatToShortInt(buffer, output, numberOfSamples);
+    }
+    double plain = (nowSeconds() - start) / iterations;
+
+    MasterBus bus(BENCH_SAMPLE_RATE);
+    bus.setEnabled(true);
+    float peak = 0;
+    start = nowSeconds();
+    for (int k = 0; k < iterations; k++) {
+        memcpy(buffer, mix, numberOfSamples * sizeof(float) * 2);
+        bus.process(buffer, numberOfSamples);
+        SuperpoweredFloatToShortInt(buffer, output, numberOfSamples);
+    }
+    double limited = (nowSeconds() - start) / iterations;
+    for (unsigned int n = 0; n < numberOfSamples * 2; n++) {
+        peak = fmaxf(peak, fabsf(buffer[n]));
+    }
+
+    double budget = (double)numberOfSamples / BENCH_SAMPLE_RATE;
+    printf("conversion: %8.2f us  with master bus: %8.2f us  bus: %.3f%% of the block at %d Hz  peak: %.3f\n",
+           plain * 1e6, limited * 1e6, (limited - plain) / budget * 100, BENCH_SAMPLE_RATE, peak);
+
+    free(mix);
+    free(buffer);
+    free(output);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -b <frames>   buffer size in frames (default 512)\n"
+            "  -i <count>    iterations per measurement (default 20000)\n",
+            name);
+}
+
+int main(int argc, char **argv) {
+    int bufferSize = 512, iterations = 20000;
+    int opt;
+    while ((opt = getopt(argc, argv, "b:i:h")) != -1) {
+        switch (opt) {
+            case 'b': bufferSize = atoi(optarg); break;
+            case 'i': iterations = atoi(optarg); break;
+            default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (bufferSize < 8 || iterations <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    printf("summing bus, %d frames per block\n", bufferSize);
+    int counts[] = {2, 8, 32};
+    bool ok = checkPanGains();
+    for (int channels = 2; channels >= 1; channels--) {
+        for (int i = 0; i < 3; i++) {
+            ok = benchSumming(counts[i], channels, (unsigned int)bufferSize, iterations) && ok;
+        }
+    }
+
+    printf("master bus, %d frames per block\n", bufferSize);
+    benchMasterBus((unsigned int)bufferSize, iterations);
+    printf(ok ? "passed\n" : "failed\n");
+    return ok ? 0 : 1;
+}
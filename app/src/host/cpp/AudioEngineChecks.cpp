@@ -0,0 +1,394 @@
+//
+// End-to-end timing checks for the host build: each one drives the engine against a virtual
+// device, sample by sample, and asserts on what it played or recorded.
+//
+
+#include "AudioEngine.h"
+#include <atomic>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#define CHECK_SAMPLE_RATE 44100
+#define CHECK_BUFFER_SIZE 512
+// Frames before the markers of a fixture track repeat, below 16-bit full scale.
+#define CHECK_MARKER_PERIOD 30000
+// Callbacks to wait for an event from the engine before giving up.
+#define CHECK_TIMEOUT_CALLBACKS 2000
+// Frames from the output back to the input of the virtual device, for the checks that record.
+#define CHECK_LOOPBACK_DELAY 1500
+// Largest difference between a faded sample of a take and the value it should have.
+#define CHECK_MAX_ERROR 1e-6f
+
+class CheckListener : public AudioEngineListener {
+public:
+    std::atomic<bool> prepared;
+    std::atomic<bool> recordFinished;
+    std::atomic<bool> latencyMeasured;
+    std::atomic<int> lastError;
+
+    CheckListener() : prepared(false), recordFinished(false), latencyMeasured(false), lastError(-1) {}
+
+    void onPlayersPrepared() override { prepared = true; }
+    void onError(int errorCode) override { lastError = errorCode; }
+    void onPlayerEnded(int) override {}
+    void onRecordFinished() override { recordFinished = true; }
+    void onBounceProgress(float) override {}
+    void onBounceFinished(bool) override {}
+    void onLatencyMeasured(int) override { latencyMeasured = true; }
+    void onTrackPrepared(int, float) override {}
+    void onPrepareFailed(int, int errorCode) override { lastError = errorCode; }
+};
+
+// The value of a fixture track at frame: its own position, so every sample tells where it was played from.
+static int marker(long long frame) {
+    return (int)(frame % CHECK_MARKER_PERIOD) + 1;
+}
+
+// The marker a 16-bit sample carries, once it went through the engine at unity gain.
+static int markerOf(float sample) {
+    return (int)lrintf(sample * 32767.f);
+}
+
+// A 16-bit stereo WAV of frames markers, on the left and/or the right channel, silence on the other.
+static bool writeFixture(const char *path, long long frames, bool left, bool right) {
+    FILE *file = createWAV(path, CHECK_SAMPLE_RATE, 2);
+    if (file == NULL) {
+        return false;
+    }
+    for (long long n = 0; n < frames; n++) {
+        short int frame[2] = {(short int)(left ? marker(n) : 0), (short int)(right ? marker(n) : 0)};
+        fwrite(frame, sizeof(frame), 1, file);
+    }
+    closeWAV(file);
+    return true;
+}
+
+// The samples of a float take and its channel count, false if it isn't one.
+static bool readTake(const char *path, std::vector<float> *samples, int *channels) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    char riff[12];
+    bool ok = fread(riff, 1, 12, file) == 12 && memcmp(riff, "RIFF", 4) == 0 && memcmp(riff + 8, "WAVE", 4) == 0;
+    bool isFloat = false;
+    *channels = 0;
+    while (ok) {
+        unsigned char chunk[8];
+        if (fread(chunk, 1, 8, file) != 8) {
+            ok = false;
+            break;
+        }
+        unsigned int size = chunk[4] | chunk[5] << 8 | chunk[6] << 16 | (unsigned int)chunk[7] << 24;
+        if (memcmp(chunk, "fmt ", 4) == 0) {
+            unsigned char format[16];
+            ok = size >= 16 && fread(format, 1, 16, file) == 16 && fseek(file, size - 16, SEEK_CUR) == 0;
+            isFloat = (format[0] | format[1] << 8) == 3 && (format[14] | format[15] << 8) == 32;
+            *channels = format[2] | format[3] << 8;
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            ok = isFloat && *channels > 0;
+            if (ok) {
+                samples->resize(size / sizeof(float));
+                ok = fread(samples->data(), sizeof(float), samples->size(), file) == samples->size();
+            }
+            break;
+        } else {
+            ok = fseek(file, size, SEEK_CUR) == 0;
+        }
+    }
+    fclose(file);
+    return ok;
+}
+
+/**
+ * The engine's IO, one callback at a time on the calling thread: the output is
+ * kept, and comes back on the input loopbackDelay frames later, or never with
+ * a delay of 0. A delay shorter than a buffer isn't supported.
+ */
+class VirtualDevice {
+public:
+    std::vector<float> played; // interleaved stereo, every frame the engine played
+
+    VirtualDevice(AudioEngine *engine, int loopbackDelay) : engine(engine), loopbackDelay(loopbackDelay) {}
+
+    void callback() {
+        float audioIO[CHECK_BUFFER_SIZE * 2];
+        long long start = (long long)played.size() / 2;
+        for (int n = 0; n < CHECK_BUFFER_SIZE; n++) {
+            long long source = start + n - loopbackDelay;
+            bool heard = loopbackDelay > 0 && source >= 0;
+            audioIO[n * 2] = heard ? played[source * 2] : 0;
+            audioIO[n * 2 + 1] = heard ? played[source * 2 + 1] : 0;
+        }
+        if (!engine->process(audioIO, CHECK_BUFFER_SIZE)) {
+            memset(audioIO, 0, sizeof(audioIO));
+        }
+        played.insert(played.end(), audioIO, audioIO + CHECK_BUFFER_SIZE * 2);
+    }
+
+    // Runs callbacks until done is set, false if that took too long.
+    bool runUntil(const std::atomic<bool> &done) {
+        for (int i = 0; i < CHECK_TIMEOUT_CALLBACKS && !done; i++) {
+            callback();
+            usleep(1000); // lets the notifier and writer threads keep up with the virtual clock
+        }
+        return done;
+    }
+
+private:
+    AudioEngine *engine;
+    int loopbackDelay;
+};
+
+static bool prepare(AudioEngine *engine, CheckListener *listener, const char *const *paths, int count, bool loop) {
+    engine->init(2, count, loop, 0);
+    for (int i = 0; i < count; i++) {
+        engine->preparePlayer(paths[i], 0, 0);
+    }
+    for (int waited = 0; !listener->prepared && listener->lastError < 0 && waited < 10000; waited++) {
+        usleep(1000);
+    }
+    if (!listener->prepared) {
+        printf("players not prepared\n");
+        return false;
+    }
+    return true;
+}
+
+// A looped session wraps without a gap or a repeated frame, and every track restarts on the same
+// sample: the main track, markers on the left, and a longer one cut by the loop, markers on the right.
+static bool checkLoop(const char *directory) {
+    const long long loopFrames = 20011; // wraps in the middle of a callback
+    char main[1024], longer[1024];
+    snprintf(main, sizeof(main), "%s/check_loop_main.wav", directory);
+    snprintf(longer, sizeof(longer), "%s/check_loop_longer.wav", directory);
+    if (!writeFixture(main, loopFrames, true, false) || !writeFixture(longer, loopFrames + 5000, false, true)) {
+        printf("can't write the fixtures in %s\n", directory);
+        return false;
+    }
+
+    CheckListener listener;
+    AudioEngine *engine = new AudioEngine(CHECK_SAMPLE_RATE, CHECK_BUFFER_SIZE, &listener);
+    const char *paths[] = {main, longer};
+    bool ok = prepare(engine, &listener, paths, 2, true);
+    VirtualDevice device(engine, 0);
+    if (ok) {
+        engine->startPlaying(true);
+        while ((long long)device.played.size() / 2 < loopFrames * 7 / 2) {
+            device.callback();
+        }
+    }
+    delete engine;
+
+    long long frames = (long long)device.played.size() / 2, first = 0;
+    while (first < frames && device.played[first * 2] == 0) {
+        first++;
+    }
+    long long checked = 0;
+    for (long long n = first; ok && n < frames; n++, checked++) {
+        int expected = marker((n - first) % loopFrames);
+        int left = markerOf(device.played[n * 2]), right = markerOf(device.played[n * 2 + 1]);
+        if (left != expected || right != expected) {
+            printf("loop: output frame %lld plays %d on the left and %d on the right, expected %d\n", n, left, right,
+                   expected);
+            ok = false;
+        }
+    }
+    ok = ok && checked >= loopFrames * 3;
+    printf("loop: %lld frames checked from frame %lld, %lld wraps: %s\n", checked, first, checked / loopFrames,
+           ok ? "passed" : "FAILED");
+    return ok;
+}
+
+// A punched take starts and ends at fixed transport samples, wherever the input comes back: it is
+// exactly the region and its fades long, the input is kept as it was inside the region and faded
+// with the engine's gains on the edges. The track plays the markers on both channels.
+static bool checkPunch(const char *directory) {
+    const long long punchIn = 10007, punchOut = 25013;
+    char track[1024], take[1024], takeFile[1024];
+    snprintf(track, sizeof(track), "%s/check_punch_track.wav", directory);
+    snprintf(take, sizeof(take), "%s/check_punch_take", directory);
+    snprintf(takeFile, sizeof(takeFile), "%s.wav", take);
+    if (!writeFixture(track, punchOut * 2, true, true)) {
+        printf("can't write the fixture in %s\n", directory);
+        return false;
+    }
+
+    CheckListener listener;
+    AudioEngine *engine = new AudioEngine(CHECK_SAMPLE_RATE, CHECK_BUFFER_SIZE, &listener);
+    const char *paths[] = {track};
+    bool ok = prepare(engine, &listener, paths, 1, false);
+    if (ok) {
+        VirtualDevice device(engine, CHECK_LOOPBACK_DELAY);
+        engine->setRecordLatency(CHECK_LOOPBACK_DELAY);
+        engine->setRecordingFormat(RECORDER_FORMAT_FLOAT);
+        engine->setPunchRegion(punchIn, punchOut);
+        engine->startPlaying(true);
+        engine->startRecording(take, take);
+        ok = device.runUntil(listener.recordFinished);
+        if (!ok) {
+            printf("punch: the take never finished\n");
+        }
+    }
+    delete engine;
+
+    std::vector<float> samples;
+    int channels = 0;
+    if (ok && !readTake(takeFile, &samples, &channels)) {
+        printf("punch: can't read the take %s\n", takeFile);
+        ok = false;
+    }
+    long long fade = (long long)CHECK_SAMPLE_RATE * PUNCH_FADE_MS / 1000;
+    long long takeStart = punchIn - fade, takeEnd = punchOut + fade;
+    long long frames = channels > 0 ? (long long)samples.size() / channels : 0;
+    if (ok && frames != takeEnd - takeStart) {
+        printf("punch: the take is %lld frames long, expected %lld\n", frames, takeEnd - takeStart);
+        ok = false;
+    }
+    for (long long i = 0; ok && i < frames; i++) {
+        long long sample = takeStart + i;
+        float gain = 1.f;
+        if (sample < punchIn) {
+            gain = (sample - takeStart + 0.5f) / fade;
+        } else if (sample >= punchOut) {
+            gain = (takeEnd - sample - 0.5f) / fade;
+        }
+        float expected = marker(sample) / 32767.f * gain;
+        for (int c = 0; c < channels; c++) {
+            float value = samples[i * channels + c];
+            if (fabsf(value - expected) > CHECK_MAX_ERROR) {
+                printf("punch: take frame %lld, transport sample %lld, channel %d is %f (marker %d), expected %f\n", i,
+                       sample, c, value, markerOf(value), expected);
+                ok = false;
+                break;
+            }
+        }
+    }
+    printf("punch: region %lld to %lld, take %lld frames: %s\n", punchIn, punchOut, frames, ok ? "passed" : "FAILED");
+    return ok;
+}
+
+// A take lines up with the playback once the round trip is calibrated, through an IO that holds
+// input back: every marker is recorded at the sample it was played on, and the take is as long
+// as the playback. The IO's latency adds to the loopback delay, as on a device.
+static bool checkLatency(const char *directory) {
+    const long long playFrames = 40009;
+    char track[1024], take[1024], takeFile[1024];
+    snprintf(track, sizeof(track), "%s/check_latency_track.wav", directory);
+    snprintf(take, sizeof(take), "%s/check_latency_take", directory);
+    snprintf(takeFile, sizeof(takeFile), "%s.wav", take);
+    if (!writeFixture(track, playFrames * 2, true, true)) {
+        printf("can't write the fixture in %s\n", directory);
+        return false;
+    }
+
+    CheckListener listener;
+    AudioEngine *engine = new AudioEngine(CHECK_SAMPLE_RATE, CHECK_BUFFER_SIZE, &listener);
+    const char *paths[] = {track};
+    bool ok = prepare(engine, &listener, paths, 1, false);
+    int ioLatency = engine->getIoLatency(), loopback = CHECK_LOOPBACK_DELAY + ioLatency;
+    VirtualDevice device(engine, loopback);
+    long long playedFrom = 0;
+    if (ok && ioLatency <= 0) {
+        printf("latency: the IO holds no input back\n");
+        ok = false;
+    }
+    if (ok) {
+        engine->measureLatency();
+        ok = device.runUntil(listener.latencyMeasured) && engine->getRecordLatency() == loopback;
+        if (!ok) {
+            printf("latency: measured %d samples, the loopback is %d\n", engine->getRecordLatency(), loopback);
+        }
+    }
+    if (ok) {
+        engine->setRecordingFormat(RECORDER_FORMAT_FLOAT);
+        engine->startPlaying(true);
+        engine->startRecording(take, take);
+        playedFrom = (long long)device.played.size() / 2;
+        while ((long long)device.played.size() / 2 - playedFrom < playFrames) {
+            device.callback();
+        }
+        engine->stopRecording();
+        ok = device.runUntil(listener.recordFinished);
+        if (!ok) {
+            printf("latency: the take never finished\n");
+        }
+    }
+    delete engine;
+
+    long long played = 0;
+    for (long long n = playedFrom; ok && n < (long long)device.played.size() / 2; n++) {
+        if (device.played[n * 2] != 0) {
+            played++;
+        }
+    }
+    std::vector<float> samples;
+    int channels = 0;
+    if (ok && !readTake(takeFile, &samples, &channels)) {
+        printf("latency: can't read the take %s\n", takeFile);
+        ok = false;
+    }
+    long long frames = channels > 0 ? (long long)samples.size() / channels : 0;
+    if (ok && frames != played) {
+        printf("latency: the take is %lld frames long, %lld were played\n", frames, played);
+        ok = false;
+    }
+    for (long long k = 0; ok && k < frames; k++) {
+        for (int c = 0; c < channels; c++) {
+            int recorded = markerOf(samples[k * channels + c]);
+            if (recorded != marker(k)) {
+                printf("latency: take frame %lld, channel %d holds marker %d, expected %d\n", k, c, recorded,
+                       marker(k));
+                ok = false;
+                break;
+            }
+        }
+    }
+    printf("latency: IO latency %d, loopback %d, take %lld frames: %s\n", ioLatency, loopback, frames,
+           ok ? "passed" : "FAILED");
+    return ok;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [options] check ...\n"
+            "  -d <dir>      where to write the fixtures (default .)\n"
+            "checks:\n"
+            "  loop          a looped session wraps sample-aligned, every track on the same sample\n"
+            "  punch         a punched take has the region's length and edges, on the transport's samples\n"
+            "  latency       a take lines up with the playback after latency calibration\n",
+            name);
+}
+
+int main(int argc, char **argv) {
+    const char *directory = ".";
+    int opt;
+    while ((opt = getopt(argc, argv, "d:h")) != -1) {
+        switch (opt) {
+            case 'd': directory = optarg; break;
+            default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind == argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    bool ok = true;
+    for (int i = optind; i < argc; i++) {
+        if (strcmp(argv[i], "loop") == 0) {
+            ok = checkLoop(directory) && ok;
+        } else if (strcmp(argv[i], "punch") == 0) {
+            ok = checkPunch(directory) && ok;
+        } else if (strcmp(argv[i], "latency") == 0) {
+            ok = checkLatency(directory) && ok;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    return ok ? 0 : 1;
+}
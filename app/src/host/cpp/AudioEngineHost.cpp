@@ -0,0 +1,510 @@
+//
+// Host driver for AudioEngine: runs the engine against a virtual clock so the
+// mixing/recording hot path can be profiled on an ordinary Linux machine.
+//
+
+#include "AudioEngine.h"
+#include <SuperpoweredSimple.h>
+#include <algorithm>
+#include <atomic>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#define PREPARE_TIMEOUT_SECONDS 10
+#define TEST_TONE_HZ 440.0
+#define TEST_TONE_AMPLITUDE 0.25
+
+class HostListener : public AudioEngineListener {
+public:
+    std::atomic<bool> prepared;
+    std::atomic<bool> recordFinished;
+    std::atomic<bool> bounceFinished;
+    std::atomic<bool> bounceSucceeded;
+    std::atomic<int> lastError;
+    std::atomic<bool> latencyMeasured;
+    std::atomic<int> latency;
+
+    HostListener() : prepared(false), recordFinished(false), bounceFinished(false), bounceSucceeded(false),
+                     lastError(-1), latencyMeasured(false), latency(-1) {}
+
+    void onPlayersPrepared() override {
+        printf("event: players prepared\n");
+        prepared = true;
+    }
+
+    void onError(int errorCode) override {
+        printf("event: error %d\n", errorCode);
+        lastError = errorCode;
+    }
+
+    void onPlayerEnded(int index) override {
+        printf("event: player %d ended\n", index);
+    }
+
+    void onRecordFinished() override {
+        printf("event: record finished\n");
+        recordFinished = true;
+    }
+
+    void onBounceProgress(float progress) override {
+        if ((int)(progress * 100) % 10 == 0) {
+            printf("event: bounce %d%%\n", (int)(progress * 100));
+        }
+    }
+
+    void onBounceFinished(bool success) override {
+        printf("event: bounce finished, success: %d\n", success);
+        bounceSucceeded = success;
+        bounceFinished = true;
+    }
+
+    void onLatencyMeasured(int samples) override {
+        printf("event: latency measured, %d samples\n", samples);
+        latency = samples;
+        latencyMeasured = true;
+    }
+
+    void onTrackPrepared(int index, float progress) override {
+        printf("event: track %d prepared, %d%%\n", index, (int)(progress * 100));
+    }
+
+    void onPrepareFailed(int index, int errorCode) override {
+        printf("event: prepare failed, track %d, error %d\n", index, errorCode);
+        lastError = errorCode;
+    }
+};
+
+/**
+ * What the simulated device feeds the engine's input: a test tone or, with a
+ * loopback delay, the engine's own output coming back that many samples later.
+ * A mono input hears both sides of the line.
+ */
+class VirtualDevice {
+public:
+    long long clock;
+
+    VirtualDevice(int sampleRate, int bufferSize, int loopbackDelay, int inputChannels) : clock(0),
+                                                                                         sampleRate(sampleRate),
+                                                                                         loopbackDelay(loopbackDelay),
+                                                                                         inputChannels(inputChannels) {
+        if (loopbackDelay > 0) {
+            line.assign((size_t)(loopbackDelay + bufferSize) * 2, 0);
+        }
+    }
+
+    void fillInput(float *audioIO, int numberOfSamples) {
+        double phaseStep = 2.0 * M_PI * TEST_TONE_HZ / sampleRate;
+        long long lineFrames = (long long)line.size() / 2;
+        for (int n = 0; n < numberOfSamples; n++) {
+            long long frame = clock + n;
+            float left, right;
+            if (loopbackDelay > 0) {
+                long long source = frame - loopbackDelay;
+                left = source < 0 ? 0 : line[(source % lineFrames) * 2];
+                right = source < 0 ? 0 : line[(source % lineFrames) * 2 + 1];
+            } else {
+                left = right = (float)(TEST_TONE_AMPLITUDE * sin(phaseStep * frame));
+            }
+            if (inputChannels == 1) {
+                audioIO[n] = (left + right) * 0.5f;
+            } else {
+                audioIO[n * 2] = left;
+                audioIO[n * 2 + 1] = right;
+            }
+        }
+    }
+
+    // Takes what the engine wrote, silence if process() returned false, and moves the clock on.
+    void playOutput(float *audioIO, bool hasAudio, int numberOfSamples) {
+        if (!hasAudio) {
+            memset(audioIO, 0, numberOfSamples * sizeof(float) * 2);
+        }
+        if (loopbackDelay > 0) {
+            long long lineFrames = (long long)line.size() / 2;
+            for (int n = 0; n < numberOfSamples; n++) {
+                long long frame = (clock + n) % lineFrames;
+                line[frame * 2] = audioIO[n * 2];
+                line[frame * 2 + 1] = audioIO[n * 2 + 1];
+            }
+        }
+        clock += numberOfSamples;
+    }
+
+private:
+    int sampleRate;
+    int loopbackDelay;
+    int inputChannels;
+    std::vector<float> line;
+};
+
+static double nowSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void sleepUntil(double deadline) {
+    double remaining = deadline - nowSeconds();
+    if (remaining > 0) {
+        usleep((useconds_t)(remaining * 1e6));
+    }
+}
+
+struct TrackEffect {
+    int index;
+    Effect effect;
+};
+
+// Gives each track the chain of effects listed for it.
+static void setEffects(AudioEngine *engine, const std::vector<TrackEffect> &effects) {
+    for (size_t i = 0; i < effects.size(); i++) {
+        bool first = true;
+        for (size_t j = 0; j < i; j++) {
+            first = first && effects[j].index != effects[i].index;
+        }
+        if (!first) {
+            continue;
+        }
+        std::vector<Effect> chain;
+        for (size_t j = i; j < effects.size(); j++) {
+            if (effects[j].index == effects[i].index) {
+                chain.push_back(effects[j].effect);
+            }
+        }
+        engine->setTrackEffects(effects[i].index, &chain[0], (int)chain.size());
+    }
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [options] [track.wav ...]\n"
+            "  -r <rate>     sample rate in Hz (default 44100)\n"
+            "  -b <frames>   buffer size in frames (default 512)\n"
+            "  -s <seconds>  virtual seconds to run (default 10)\n"
+            "  -x <speed>    virtual clock speed relative to real time, 0 = unpaced (default 1)\n"
+            "  -m <index>    main player index (default 0)\n"
+            "  -l            loop the session\n"
+            "  -o <path>     record the simulated input to <path>.wav\n"
+            "  -f <format>   sample format of the take: 16, 24 or float (default 16)\n"
+            "  -i <channels> input channels, 1 for a mono input and takes (default 2)\n"
+            "  -H <seconds>  run the input this long before recording, and start the take with it\n"
+            "  -p <in>,<out> punch the take in and out at these transport samples\n"
+            "  -w <path>     write the engine output to a 16-bit WAV file\n"
+            "  -M            limit and soft-clip the mix before it leaves the engine\n"
+            "  -a <path>     add this track halfway through the run\n"
+            "  -c <clip>     add a clip, path:offset:start:length:fade in samples, to a track of clips\n"
+            "                played after the other tracks; repeat for more clips\n"
+            "  -d <index>    remove this track halfway through the run\n"
+            "  -e <effect>   add an insert effect, index:type:p0,p1,... with type lowpass, highpass,\n"
+            "                parametric, compressor, eq or reverb, to the chain of track index\n"
+            "  -E <index>    bypass the effects of this track halfway through the run\n"
+            "  -L <samples>  feed the output back to the input this much later, at least one buffer\n"
+            "                (default: a test tone on the input)\n"
+            "  -C            calibrate the round-trip latency before starting\n"
+            "  -B <path>     bounce the session offline to <path> instead of running the clock\n"
+            "  -D <bytes>    memory budget for tracks decoded whole, 0 streams every track\n"
+            "  -P <ms>       prepare the tracks as one batch, failing after this long (0: no deadline)\n"
+            "  -R <count>    prepare the session this many times, resetting in between, and time each\n"
+            "  -S <path>     load the session saved at <path> instead of the tracks given\n"
+            "  -W <path>     save the session to <path> once prepared\n",
+            name);
+}
+
+int main(int argc, char **argv) {
+    int sampleRate = 44100, bufferSize = 512, mainPlayerIndex = 0;
+    double seconds = 10, speed = 1, historySeconds = 0;
+    bool loop = false;
+    const char *recordPath = NULL, *bouncePath = NULL, *outputPath = NULL, *addPath = NULL;
+    const char *sessionPath = NULL, *saveSessionPath = NULL;
+    int removeIndex = -1, loopbackDelay = 0;
+    bool calibrate = false;
+    int sessions = 1;
+    long long decodedBudget = -1;
+    int batchTimeoutMs = -1;
+    long long punchIn = 0, punchOut = 0;
+    bool masterBus = false;
+    int recordingFormat = RECORDER_FORMAT_PCM16;
+    int inputChannels = 2;
+    std::vector<Clip> clips;
+    std::vector<TrackEffect> effects;
+    int bypassIndex = -1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:b:s:x:m:lo:f:i:H:p:w:Ma:c:d:e:E:L:CB:R:D:P:S:W:h")) != -1) {
+        switch (opt) {
+            case 'r': sampleRate = atoi(optarg); break;
+            case 'b': bufferSize = atoi(optarg); break;
+            case 's': seconds = atof(optarg); break;
+            case 'x': speed = atof(optarg); break;
+            case 'm': mainPlayerIndex = atoi(optarg); break;
+            case 'l': loop = true; break;
+            case 'o': recordPath = optarg; break;
+            case 'f':
+                recordingFormat = strcmp(optarg, "24") == 0 ? RECORDER_FORMAT_PCM24 :
+                                  strcmp(optarg, "float") == 0 ? RECORDER_FORMAT_FLOAT :
+                                  strcmp(optarg, "16") == 0 ? RECORDER_FORMAT_PCM16 : -1;
+                break;
+            case 'i': inputChannels = atoi(optarg); break;
+            case 'H': historySeconds = atof(optarg); break;
+            case 'p': sscanf(optarg, "%lld,%lld", &punchIn, &punchOut); break;
+            case 'w': outputPath = optarg; break;
+            case 'M': masterBus = true; break;
+            case 'a': addPath = optarg; break;
+            case 'c': {
+                Clip clip;
+                char *colon = strchr(optarg, ':');
+                if (colon == NULL || sscanf(colon + 1, "%lld:%lld:%lld:%d", &clip.sourceOffset, &clip.timelineStart,
+                                            &clip.length, &clip.fade) != 4) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                *colon = 0;
+                clip.path = optarg;
+                clips.push_back(clip);
+                break;
+            }
+            case 'd': removeIndex = atoi(optarg); break;
+            case 'e': {
+                static const char *types[] = {"lowpass", "highpass", "parametric", "compressor", "eq", "reverb"};
+                char type[16];
+                int index, consumed = 0;
+                TrackEffect effect = {};
+                if (sscanf(optarg, "%d:%15[a-z]:%n", &index, type, &consumed) != 2 || consumed == 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                effect.index = index;
+                effect.effect.type = (EffectType)-1;
+                for (int t = 0; t < 6; t++) {
+                    if (strcmp(type, types[t]) == 0) {
+                        effect.effect.type = (EffectType)t;
+                    }
+                }
+                if ((int)effect.effect.type < 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                effect.effect.enabled = true;
+                char *parameter = optarg + consumed;
+                for (int n = 0; n < EFFECT_PARAMETERS && *parameter != 0; n++) {
+                    effect.effect.parameters[n] = strtof(parameter, &parameter);
+                    if (*parameter == ',') parameter++;
+                }
+                effects.push_back(effect);
+                break;
+            }
+            case 'E': bypassIndex = atoi(optarg); break;
+            case 'L': loopbackDelay = atoi(optarg); break;
+            case 'C': calibrate = true; break;
+            case 'B': bouncePath = optarg; break;
+            case 'R': sessions = atoi(optarg); break;
+            case 'D': decodedBudget = atoll(optarg); break;
+            case 'P': batchTimeoutMs = atoi(optarg); break;
+            case 'S': sessionPath = optarg; break;
+            case 'W': saveSessionPath = optarg; break;
+            default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (sampleRate <= 0 || bufferSize < 8 || seconds <= 0 || speed < 0 || (loopbackDelay > 0 && loopbackDelay < bufferSize) ||
+        sessions < 1 || recordingFormat < 0 || (inputChannels != 1 && inputChannels != 2)) {
+        usage(argv[0]);
+        return 1;
+    }
+    int filesCount = argc - optind;
+    int playersCount = filesCount + (clips.empty() ? 0 : 1);
+
+    HostListener listener;
+    AudioEngine *engine = new AudioEngine(sampleRate, bufferSize, &listener);
+    if (decodedBudget >= 0) {
+        engine->setDecodedAudioBudget(decodedBudget);
+    }
+    if (masterBus) {
+        engine->setMasterBus(true);
+    }
+    engine->setRecordingFormat(recordingFormat);
+    for (int session = 0; session < sessions; session++) {
+        if (session > 0) {
+            engine->reset(); // like switching takes in the app
+            listener.prepared = false;
+        }
+        double prepareStart = nowSeconds();
+        if (sessionPath != NULL) {
+            if (!engine->loadSession(sessionPath)) {
+                delete engine;
+                return 1;
+            }
+        } else if (batchTimeoutMs >= 0) {
+            engine->init(inputChannels, playersCount, loop, mainPlayerIndex);
+            engine->prepareTracks(argv + optind, NULL, NULL, filesCount, batchTimeoutMs);
+        } else {
+            engine->init(inputChannels, playersCount, loop, mainPlayerIndex);
+            for (int i = optind; i < argc; i++) {
+                engine->preparePlayer(argv[i], 0, 0);
+            }
+        }
+        if (sessionPath == NULL && !clips.empty()) {
+            engine->setTrackClips(filesCount, &clips[0], (int)clips.size());
+        }
+
+        double prepareDeadline = prepareStart + PREPARE_TIMEOUT_SECONDS;
+        while (!listener.prepared && listener.lastError < 0 && nowSeconds() < prepareDeadline) {
+            usleep(100);
+        }
+        if (!listener.prepared) {
+            fprintf(stderr, "players not prepared\n");
+            delete engine;
+            return 1;
+        }
+        if (sessions > 1) {
+            printf("session %d prepared in %.2f ms\n", session, (nowSeconds() - prepareStart) * 1000);
+        }
+    }
+    setEffects(engine, effects);
+    if (saveSessionPath != NULL && !engine->saveSession(saveSessionPath)) {
+        fprintf(stderr, "can't save the session to %s\n", saveSessionPath);
+    }
+
+    if (bouncePath != NULL) {
+        double bounceStart = nowSeconds();
+        if (engine->bounce(bouncePath)) {
+            while (!listener.bounceFinished) {
+                usleep(1000);
+            }
+        }
+        double bounceTime = nowSeconds() - bounceStart;
+        delete engine;
+        printf("bounce: %.2f wall s\n", bounceTime);
+        return listener.bounceSucceeded ? 0 : 1;
+    }
+
+    float *audioIO = (float *)malloc((bufferSize + 16) * sizeof(float) * 2);
+    short int *shortOutput = (short int *)malloc((bufferSize + 16) * sizeof(short int) * 2);
+    VirtualDevice device(sampleRate, bufferSize, loopbackDelay, inputChannels);
+    if (calibrate) {
+        engine->measureLatency();
+        double calibrationDeadline = nowSeconds() + PREPARE_TIMEOUT_SECONDS;
+        while (!listener.latencyMeasured && nowSeconds() < calibrationDeadline) {
+            device.fillInput(audioIO, bufferSize);
+            device.playOutput(audioIO, engine->process(audioIO, (unsigned int)bufferSize), bufferSize);
+        }
+        printf("record latency: %d samples\n", engine->getRecordLatency());
+    }
+
+    char tempPath[256];
+    if (recordPath != NULL) {
+        snprintf(tempPath, sizeof(tempPath), "%s.tmp", recordPath);
+        // The engine keeps the input it sees while the IO runs, the take can start with it.
+        for (long long frames = 0; frames < (long long)(historySeconds * sampleRate); frames += bufferSize) {
+            device.fillInput(audioIO, bufferSize);
+            device.playOutput(audioIO, engine->process(audioIO, (unsigned int)bufferSize), bufferSize);
+        }
+        if (punchOut > punchIn) {
+            engine->setPunchRegion(punchIn, punchOut);
+        }
+        engine->startRecording(tempPath, recordPath, historySeconds > 0);
+    } else {
+        engine->startPlaying(true);
+    }
+
+    FILE *output = outputPath != NULL ? createWAV(outputPath, (unsigned int)sampleRate, 2) : NULL;
+    long long totalSamples = (long long)(seconds * sampleRate), clock = 0, startClock = device.clock;
+    std::vector<double> durations;
+    durations.reserve((size_t)(totalSamples / bufferSize + 1));
+
+    double startTime = nowSeconds();
+    long long changeClock = totalSamples / 2;
+    while (clock < totalSamples) {
+        if (clock <= changeClock && changeClock < clock + bufferSize) {
+            if (addPath != NULL) {
+                printf("add track %s: slot %d\n", addPath, engine->addTrack(addPath, 0, 0));
+            }
+            for (size_t i = 0; bypassIndex >= 0 && i < effects.size(); i++) {
+                if (effects[i].index == bypassIndex) {
+                    printf("bypass effects of track %d\n", bypassIndex);
+                    for (int effect = 0; effect < EFFECT_CHAIN_CAPACITY; effect++) {
+                        engine->setTrackEffectEnabled(bypassIndex, effect, false);
+                    }
+                    break;
+                }
+            }
+            if (removeIndex >= 0) {
+                printf("remove track %d\n", removeIndex);
+                engine->removeTrack(removeIndex);
+            }
+        }
+        device.fillInput(audioIO, bufferSize);
+
+        double callbackStart = nowSeconds();
+        bool hasAudio = engine->process(audioIO, (unsigned int)bufferSize);
+        durations.push_back(nowSeconds() - callbackStart);
+
+        device.playOutput(audioIO, hasAudio, bufferSize);
+        if (output != NULL) {
+            SuperpoweredFloatToShortInt(audioIO, shortOutput, (unsigned int)bufferSize);
+            fwrite(shortOutput, sizeof(short int) * 2, (size_t)bufferSize, output);
+        }
+
+        clock = device.clock - startClock;
+        if (speed > 0) {
+            sleepUntil(startTime + (double)clock / sampleRate / speed);
+        }
+    }
+    double wallTime = nowSeconds() - startTime;
+    AudioEngineStats stats;
+    engine->getStats(&stats);
+    if (output != NULL) {
+        closeWAV(output);
+    }
+
+    if (recordPath != NULL) {
+        // Transport changes are applied by the audio thread, so keep the clock running until the take is closed.
+        engine->stopRecording();
+        double recordDeadline = nowSeconds() + PREPARE_TIMEOUT_SECONDS;
+        while (!listener.recordFinished && nowSeconds() < recordDeadline) {
+            device.fillInput(audioIO, bufferSize);
+            device.playOutput(audioIO, engine->process(audioIO, (unsigned int)bufferSize), bufferSize);
+            usleep((useconds_t)(1e6 * bufferSize / sampleRate));
+        }
+        if (historySeconds > 0) {
+            printf("take history: %d samples\n", engine->getRecordHistoryFrames());
+        }
+    }
+    delete engine;
+    free(audioIO);
+    free(shortOutput);
+
+    double budget = (double)bufferSize / sampleRate, sum = 0;
+    int overBudget = 0;
+    for (size_t i = 0; i < durations.size(); i++) {
+        sum += durations[i];
+        if (durations[i] > budget) overBudget++;
+    }
+    std::sort(durations.begin(), durations.end());
+    double mean = sum / durations.size();
+
+    printf("callbacks: %zu (%d Hz, %d frames, %.1f virtual s in %.2f wall s)\n",
+           durations.size(), sampleRate, bufferSize, (double)clock / sampleRate, wallTime);
+    printf("budget: %.1f us  mean: %.1f us  p50: %.1f us  p99: %.1f us  max: %.1f us\n",
+           budget * 1e6, mean * 1e6,
+           durations[durations.size() / 2] * 1e6,
+           durations[durations.size() * 99 / 100] * 1e6,
+           durations.back() * 1e6);
+    printf("load: %.2f%%  over budget: %d\n", mean / budget * 100.0, overBudget);
+
+    printf("engine stats: %llu callbacks  mean: %.1f us  max: %.1f us  near budget: %llu  over budget: %llu\n",
+           stats.callbacks, stats.meanMicros, stats.maxMicros, stats.nearBudget, stats.overBudget);
+    printf("dropouts: input %u  output %u  silence %u  input overruns %u\n",
+           stats.inputUnderruns, stats.outputUnderruns, stats.silenceSubstitutions, stats.inputOverruns);
+    for (int i = 0; i < CALLBACK_HISTOGRAM_BUCKETS; i++) {
+        if (stats.histogram[i] > 0) {
+            printf("  %7d us+: %llu\n", i == 0 ? 0 : 1 << i, stats.histogram[i]);
+        }
+    }
+    // Fails a scripted run on an error event, or a take that was never finished.
+    return listener.lastError >= 0 || (recordPath != NULL && !listener.recordFinished) ? 1 : 0;
+}
@@ -0,0 +1,331 @@
+//
+// Stress run of the duplex fifo of SuperpoweredAndroidAudioIO: an input and an
+// output thread call it the way the OpenSL ES callbacks do, at the same rate
+// but with random wake-up jitter, and every buffer is checked on the way out,
+// along with the latency the fifo reports as it adapts.
+//
+// With -d the input and output run on two simulated clocks that drift apart
+// instead, in virtual time on one thread, so hours of drift take seconds: the
+// input records a sine, and the output checks it stays continuous once the
+// fifo's drift compensation had time to settle.
+//
+
+#include "AndroidIO/SuperpoweredAndroidAudioIOFifo.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define STRESS_CHANNELS 2
+#define DRIFT_SETTLE_SECONDS 120 // dropouts while the compensation converges don't count
+#define DRIFT_SINE_HZ 440.0
+#define DRIFT_SINE_AMPLITUDE 0.25
+#define DRIFT_GLITCH 0.002 // a sample further than this from the sine through the two before it is a glitch
+
+struct Stress {
+    SuperpoweredAndroidAudioIOFifo fifo;
+    int buffers;          // recorded by the input thread
+    long periodNanos;
+    long jitterNanos;     // each wake-up is late by up to this much
+    long stallNanos;      // the output thread misses its deadlines once by this much, halfway through
+    volatile bool inputDone;
+
+    // Output thread results.
+    unsigned int delivered, lost, underruns, duplicates, torn, overwritten, misreported;
+    int minimumLatency, maximumLatency;
+};
+
+// Every sample of buffer number sequence, so a buffer read while it is recorded over doesn't pass.
+static float sampleOf(unsigned int sequence, int n) {
+    return (float)(short int)(sequence * 2654435761u + (unsigned int)n * 40503u);
+}
+
+static void fill(float *buffer, int samples, unsigned int sequence) {
+    for (int n = 0; n < samples; n++) {
+        buffer[n] = sampleOf(sequence, n);
+    }
+}
+
+// The sequence number of the buffer, or -1 if its samples are not all from one buffer.
+static long long sequenceOf(const float *buffer, int samples, unsigned int first, unsigned int last) {
+    for (unsigned int sequence = first; sequence <= last; sequence++) {
+        if (buffer[0] != sampleOf(sequence, 0) || buffer[1] != sampleOf(sequence, 1)) {
+            continue;
+        }
+        for (int n = 2; n < samples; n++) {
+            if (buffer[n] != sampleOf(sequence, n)) {
+                return -1;
+            }
+        }
+        return sequence;
+    }
+    return -1;
+}
+
+static void waitUntil(struct timespec *deadline, long nanos, long jitterNanos, unsigned int *seed) {
+    deadline->tv_nsec += nanos;
+    while (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_nsec -= 1000000000L;
+        deadline->tv_sec++;
+    }
+    struct timespec wake = *deadline;
+    if (jitterNanos > 0) {
+        wake.tv_nsec += rand_r(seed) % jitterNanos;
+        if (wake.tv_nsec >= 1000000000L) {
+            wake.tv_nsec -= 1000000000L;
+            wake.tv_sec++;
+        }
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+}
+
+// Like SuperpoweredAndroidAudioIO_InputCallback: the queue fills the buffer it was given, then the callback publishes it.
+static void *inputThread(void *context) {
+    Stress *stress = (Stress *)context;
+    int samples = stress->fifo.buffersize * STRESS_CHANNELS;
+    unsigned int seed = 1;
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    for (int sequence = 0; sequence < stress->buffers; sequence++) {
+        fill(SuperpoweredAndroidAudioIOFifo_writeBuffer(&stress->fifo), samples, (unsigned int)sequence);
+        waitUntil(&deadline, stress->periodNanos, stress->jitterNanos, &seed);
+        SuperpoweredAndroidAudioIOFifo_publish(&stress->fifo);
+    }
+    __atomic_store_n(&stress->inputDone, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// Like SuperpoweredAndroidAudioIO_OutputCallback with input: takes a recorded buffer, or plays silence.
+static void *outputThread(void *context) {
+    Stress *stress = (Stress *)context;
+    int samples = stress->fifo.buffersize * STRESS_CHANNELS;
+    unsigned int seed = 2, last = 0;
+    bool started = false;
+    const float *playing = NULL;
+    long long playingSequence = -1, offset = 0;
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    for (int callback = 0; ; callback++) {
+        bool inputDone = __atomic_load_n(&stress->inputDone, __ATOMIC_ACQUIRE);
+        long stall = callback == stress->buffers / 2 ? stress->stallNanos : 0;
+        waitUntil(&deadline, stress->periodNanos + stall, stress->jitterNanos, &seed);
+
+        // The queue played the previous buffer until now, so it must be as it was taken.
+        if (playing != NULL && sequenceOf(playing, samples, (unsigned int)playingSequence,
+                                          (unsigned int)playingSequence) != playingSequence) {
+            stress->overwritten++;
+        }
+        float *output = SuperpoweredAndroidAudioIOFifo_readBuffer(&stress->fifo);
+        if (output == NULL) {
+            if (inputDone) {
+                break;
+            }
+            stress->underruns++;
+            playing = NULL;
+            continue;
+        }
+        long long sequence = sequenceOf(output, samples, started ? last + 1 : 0, (unsigned int)stress->buffers - 1);
+        if (sequence < 0) {
+            // Not a buffer after the last one: either torn, or one already delivered.
+            if (started && sequenceOf(output, samples, 0, last) >= 0) {
+                stress->duplicates++;
+            } else {
+                stress->torn++;
+            }
+        } else {
+            // Each callback that played silence, each buffer lost, moves the input against the
+            // callbacks by a buffer; jitter doesn't. The latency must have moved by as much.
+            int latency = SuperpoweredAndroidAudioIOFifo_getLatency(&stress->fifo);
+            long long expected = callback - sequence - latency / stress->fifo.buffersize;
+            if (!started) {
+                offset = expected;
+                stress->minimumLatency = stress->maximumLatency = latency;
+            } else if (expected != offset) {
+                stress->misreported++;
+                offset = expected;
+            }
+            if (latency < stress->minimumLatency) stress->minimumLatency = latency;
+            if (latency > stress->maximumLatency) stress->maximumLatency = latency;
+            stress->lost += (unsigned int)(sequence - (started ? last + 1 : 0));
+            stress->delivered++;
+            last = (unsigned int)sequence;
+            started = true;
+        }
+        playing = output;
+        playingSequence = sequence;
+        SuperpoweredAndroidAudioIOFifo_consume(&stress->fifo);
+    }
+    return NULL;
+}
+
+struct DriftResults {
+    unsigned int underruns, glitches, overruns, drops; // after settling
+    unsigned int delivered;
+    double drift;
+};
+
+static long long virtualNanos;
+
+static long long virtualClock(void) {
+    return virtualNanos;
+}
+
+// The input clock runs ppm faster than the output clock; both callbacks wake up late by up to jitter.
+static void simulateDrift(SuperpoweredAndroidAudioIOFifo *fifo, int samplerate, int buffers, double ppm,
+                          double jitter, DriftResults *results) {
+    int frames = fifo->buffersize;
+    double outputPeriod = (double)frames / samplerate, inputPeriod = outputPeriod / (1.0 + ppm * 1e-6);
+    double step = 2.0 * M_PI * DRIFT_SINE_HZ / samplerate, recurrence = 2.0 * cos(step);
+    unsigned int seed = 3, overrunsSettled = 0, dropsSettled = 0;
+    long long recordedFrames = 0, inputCallbacks = 0, outputCallbacks = 0;
+    double inputTime = 0, outputTime = outputPeriod * 0.5; // any phase between the two
+    double before[2] = {0, 0}; // the last two samples played, when continuous
+    int continuous = 0;
+    bool settled = false;
+    if (fifo->recordBuffer != NULL) {
+        fifo->clock = virtualClock;
+    }
+
+    while (inputCallbacks < buffers) {
+        virtualNanos = llround((inputTime <= outputTime ? inputTime : outputTime) * 1e9);
+        if (inputTime <= outputTime) {
+            float *record = SuperpoweredAndroidAudioIOFifo_recordBuffer(fifo);
+            for (int n = 0; n < frames; n++, recordedFrames++) {
+                record[n * 2] = record[n * 2 + 1] = (float)(DRIFT_SINE_AMPLITUDE * sin(step * (double)recordedFrames));
+            }
+            SuperpoweredAndroidAudioIOFifo_recorded(fifo);
+            inputTime = ++inputCallbacks * inputPeriod + jitter * rand_r(&seed) / RAND_MAX;
+            continue;
+        }
+        if (!settled && outputTime >= DRIFT_SETTLE_SECONDS) {
+            settled = true;
+            overrunsSettled = fifo->overruns;
+            dropsSettled = fifo->drops;
+        }
+        outputTime = (++outputCallbacks + 0.5) * outputPeriod + jitter * rand_r(&seed) / RAND_MAX;
+        float *output = SuperpoweredAndroidAudioIOFifo_readBuffer(fifo);
+        if (output == NULL) {
+            if (settled) results->underruns++;
+            continuous = 0;
+            continue;
+        }
+        for (int n = 0; n < frames; n++) {
+            double sample = output[n * 2];
+            if (continuous >= 2 && fabs(sample - (recurrence * before[1] - before[0])) > DRIFT_GLITCH && settled) {
+                results->glitches++;
+            }
+            before[0] = before[1];
+            before[1] = sample;
+            continuous++;
+        }
+        results->delivered++;
+        SuperpoweredAndroidAudioIOFifo_consume(fifo);
+    }
+    results->overruns = fifo->overruns - overrunsSettled;
+    results->drops = fifo->drops - dropsSettled;
+    results->drift = SuperpoweredAndroidAudioIOFifo_getDrift(fifo);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -b <frames>   buffer size in frames (default 192)\n"
+            "  -l <frames>   fifo latency to start at, in frames (default 2 buffers)\n"
+            "  -m <frames>   least the fifo may adapt down to (default 1 buffer)\n"
+            "  -M <frames>   most the fifo may adapt up to (default 8 buffers)\n"
+            "  -w <count>    reads without an underrun before the fifo shrinks (default 1000)\n"
+            "  -n <count>    buffers to record (default 20000)\n"
+            "  -p <us>       callback period (default 500)\n"
+            "  -j <us>       wake-up jitter of either callback (default 1500)\n"
+            "  -s <us>       stall the output once by this much, to overrun the fifo (default 0)\n"
+            "  -d <ppm>      simulate an input clock this much faster than the output, in virtual time\n"
+            "  -r <Hz>       sample rate of the simulated clocks (default 48000)\n"
+            "  -u            don't compensate the drift\n",
+            name);
+}
+
+int main(int argc, char **argv) {
+    int bufferSize = 192, latency = -1, minLatency = -1, maxLatency = -1, window = 1000;
+    int buffers = 20000, period = 500, jitter = 1500, stall = 0, samplerate = 48000;
+    double ppm = 0;
+    bool drifting = false, compensate = true;
+    int opt;
+    while ((opt = getopt(argc, argv, "b:l:m:M:w:n:p:j:s:d:r:uh")) != -1) {
+        switch (opt) {
+            case 'b': bufferSize = atoi(optarg); break;
+            case 'l': latency = atoi(optarg); break;
+            case 'm': minLatency = atoi(optarg); break;
+            case 'M': maxLatency = atoi(optarg); break;
+            case 'w': window = atoi(optarg); break;
+            case 'n': buffers = atoi(optarg); break;
+            case 'p': period = atoi(optarg); break;
+            case 'j': jitter = atoi(optarg); break;
+            case 's': stall = atoi(optarg); break;
+            case 'd': ppm = atof(optarg); drifting = true; break;
+            case 'r': samplerate = atoi(optarg); break;
+            case 'u': compensate = false; break;
+            default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (bufferSize < 2 || buffers <= 0 || period <= 0 || jitter < 0 || stall < 0 || samplerate < bufferSize) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Stress stress = {};
+    SuperpoweredAndroidAudioIOFifo_init(&stress.fifo, bufferSize, latency < 0 ? bufferSize * 2 : latency,
+                                        minLatency < 0 ? bufferSize : minLatency,
+                                        maxLatency < 0 ? bufferSize * 8 : maxLatency, window, STRESS_CHANNELS);
+    if (drifting) {
+        if (compensate) {
+            SuperpoweredAndroidAudioIOFifo_compensateDrift(&stress.fifo, samplerate, STRESS_CHANNELS);
+        }
+        DriftResults results = {};
+        simulateDrift(&stress.fifo, samplerate, buffers, ppm, jitter * 1e-6, &results);
+        printf("%d buffers of %d frames at %d Hz, %.1f s, input %+.1f ppm, compensated %+.1f ppm, latency %d frames\n",
+               buffers, bufferSize, samplerate, (double)buffers * bufferSize / samplerate, ppm, results.drift,
+               stress.fifo.latencySamples);
+        printf("delivered: %u  after %d s: overruns: %u  drops: %u  underruns: %u  glitches: %u\n",
+               results.delivered, DRIFT_SETTLE_SECONDS, results.overruns, results.drops, results.underruns,
+               results.glitches);
+        // Once settled, the sine plays through unbroken, at the rate the clocks drift apart.
+        bool passed = results.overruns == 0 && results.drops == 0 && results.underruns == 0 && results.glitches == 0;
+        printf("%s\n", passed ? "passed" : "FAILED");
+        SuperpoweredAndroidAudioIOFifo_free(&stress.fifo);
+        return passed ? 0 : 1;
+    }
+    stress.buffers = buffers;
+    stress.periodNanos = period * 1000L;
+    stress.jitterNanos = jitter * 1000L;
+    stress.stallNanos = stall * 1000L;
+
+    pthread_t input, output;
+    pthread_create(&output, NULL, outputThread, &stress);
+    pthread_create(&input, NULL, inputThread, &stress);
+    pthread_join(input, NULL);
+    pthread_join(output, NULL);
+
+    unsigned int overruns = __atomic_load_n(&stress.fifo.overruns, __ATOMIC_RELAXED);
+    unsigned int drops = __atomic_load_n(&stress.fifo.drops, __ATOMIC_RELAXED);
+    unsigned int left = stress.fifo.written - stress.fifo.read;
+    // Buffers recorded after the last one delivered that aren't left either were lost to overruns at the end.
+    stress.lost += (unsigned int)buffers - (stress.delivered + stress.lost) - left;
+    printf("%d buffers of %d frames through %d, latency %d frames (%d to %d), target %d frames (%d to %d)\n",
+           buffers, bufferSize, stress.fifo.numBuffers, stress.fifo.latencySamples, stress.minimumLatency,
+           stress.maximumLatency, stress.fifo.targetSamples, stress.fifo.minLatencySamples,
+           stress.fifo.maxLatencySamples);
+    printf("delivered: %u  left in the fifo: %u  lost: %u  overruns: %u  drops: %u  underruns: %u\n",
+           stress.delivered, left, stress.lost, overruns, drops, stress.underruns);
+    printf("duplicated: %u  torn: %u  overwritten while playing: %u  latency misreported: %u\n",
+           stress.duplicates, stress.torn, stress.overwritten, stress.misreported);
+
+    // Every recorded buffer comes out once, except those the fifo reported it had no room for or dropped,
+    // and the latency it reports follows every buffer it played silence for or lost.
+    bool passed = stress.duplicates == 0 && stress.torn == 0 && stress.overwritten == 0 && stress.misreported == 0 &&
+                  stress.lost == overruns + drops && stress.delivered + left + overruns + drops == (unsigned int)buffers;
+    printf("%s\n", passed ? "passed" : "FAILED");
+    SuperpoweredAndroidAudioIOFifo_free(&stress.fifo);
+    return passed ? 0 : 1;
+}
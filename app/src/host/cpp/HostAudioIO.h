@@ -0,0 +1,61 @@
+#ifndef AUDIO_HOSTAUDIOIO_H
+#define AUDIO_HOSTAUDIOIO_H
+
+/**
+ * Same prototype as the one in SuperpoweredAndroidAudioIO.h, so AudioEngine
+ * builds unchanged against either IO.
+ */
+typedef bool (*audioProcessingCallback) (void *clientdata, float *audioIO, int numberOfSamples, int samplerate);
+
+/**
+ * Stand-in for SuperpoweredAndroidAudioIO on host builds.
+ *
+ * There is no device behind it: the host driver owns the (virtual) clock and
+ * calls AudioEngine::process directly, this class only keeps the start/stop
+ * state the engine expects from its IO.
+ */
+class HostAudioIO {
+public:
+    HostAudioIO(int samplerate, int buffersize, bool enableInput, bool enableOutput,
+                audioProcessingCallback callback, void *clientdata,
+                int inputStreamType = -1, int outputStreamType = -1, int latencySamples = 0,
+                int minLatencySamples = 0, int maxLatencySamples = 0, int numberOfInputChannels = 2)
+            : started(true), latency(latencySamples) {
+        (void)samplerate;
+        (void)buffersize;
+        (void)enableInput;
+        (void)enableOutput;
+        (void)callback;
+        (void)clientdata;
+        (void)inputStreamType;
+        (void)outputStreamType;
+        (void)minLatencySamples;
+        (void)maxLatencySamples;
+        (void)numberOfInputChannels;
+    }
+
+    void onForeground() { started = true; }
+    void onBackground() {}
+    void start() { started = true; }
+    void stop() { started = false; }
+
+    bool isStarted() const { return started; }
+
+    // The virtual clock never drops a buffer.
+    void getDropouts(unsigned int *inputUnderruns, unsigned int *outputUnderruns, unsigned int *silenceSubstitutions,
+                     unsigned int *inputOverruns) {
+        *inputUnderruns = *outputUnderruns = *silenceSubstitutions = *inputOverruns = 0;
+    }
+
+    // Input and output are the same virtual buffer, so the fifo never adapts.
+    int getLatency() { return latency; }
+
+private:
+    bool started;
+    int latency;
+
+    HostAudioIO(const HostAudioIO&);
+    HostAudioIO& operator=(const HostAudioIO&);
+};
+
+#endif //AUDIO_HOSTAUDIOIO_H
@@ -3,119 +3,259 @@
 //
 
 #include "AudioEngine.h"
+#include "Log.h"
 #include <SuperpoweredSimple.h>
 #include <stdlib.h>
-#include <android/log.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <malloc.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
 #include <SuperpoweredCPU.h>
+
+#ifdef __ANDROID__
 #include <SLES/OpenSLES_AndroidConfiguration.h>
 #include <SLES/OpenSLES.h>
 
+#define INPUT_STREAM_TYPE SL_ANDROID_RECORDING_PRESET_GENERIC
+#define OUTPUT_STREAM_TYPE SL_ANDROID_STREAM_MEDIA
+#else
+#define INPUT_STREAM_TYPE -1
+#define OUTPUT_STREAM_TYPE -1
+#endif
 
-JavaVM *javaVM;
-jobject g_jniCallbackInstance = NULL;
-jclass g_jniCallbackClazz = NULL;
-// methods
-jmethodID jniMethodOnPlayersPrepared;
-jmethodID jniMethodOnError;   // params: int - error code
-jmethodID jniMethodOnPlayerEnded; // params: int - index of player
-jmethodID jniMethodOnRecordFinished;
+// How long the offline render waits for a player's decoder to catch up before giving up.
+#define BOUNCE_BUFFERING_TIMEOUT_MS 5000
+// How often the notifier retries freeing retired tracks that a callback may still be using.
+#define RECLAIM_RETRY_MS 5
+// A batch reads at most this much of each file ahead of opening it.
+#define PREPARE_WARM_MAX_BYTES (64 * 1024 * 1024)
+#define PREPARE_WARM_CHUNK_BYTES (1024 * 1024)
 
-bool needDetachJvm = false;
+#ifndef __unused
+#define __unused __attribute__((unused))
+#endif
 
 
-#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, "AudioEngine", __VA_ARGS__)
+static void onRecorderFlushedData(void *clientData, bool success) {
+    LOGI("recorder flushed data to file!");
+    AudioEngine *recorder = (AudioEngine *)clientData;
+    if (recorder != NULL) {
+        recorder->notifyRecordFinished(success);
+    }
+}
 
-JNIEnv* getEnv() {
-    JNIEnv *env;
-    int status = javaVM->GetEnv((void**)&env, JNI_VERSION_1_6);
-    LOGI("getEnv: status: %d", status);
-    if(status != JNI_OK) {
-        needDetachJvm = true;
-        status = javaVM->AttachCurrentThread(&env, NULL);
-        if(status != JNI_OK) {
-            return NULL;
-        }
+static void playerEventCallback(void *clientData, SuperpoweredAdvancedAudioPlayerEvent event, void *value) {
+    PlayerWrapper *playerWrapper = (PlayerWrapper *)clientData;
+    if (event == SuperpoweredAdvancedAudioPlayerEvent_EOF) {
+        *((bool *)value) = true; // stay paused at the end, the engine transport decides where to go next
+    }
+    if (playerWrapper->engine != NULL) {
+        playerWrapper->engine->onPlayerStateChangedPrepared(playerWrapper, event);
+    }
+    if (event == SuperpoweredAdvancedAudioPlayerEvent_LoadSuccess ||
+        event == SuperpoweredAdvancedAudioPlayerEvent_LoadError) {
+        playerWrapper->opening = false; // the last touch: a retired track may be freed from here on
+    }
+}
+
+static bool audioProcessing(void *clientdata, float *audioIO, int numberOfSamples, int __unused samplerate) {
+    return ((AudioEngine *)clientdata)->process(audioIO, (unsigned int)numberOfSamples);
+}
+
+static void *notifierThreadFunction(void *param) {
+    ((AudioEngine *)param)->runNotifier();
+    return NULL;
+}
+
+static void *bounceThreadFunction(void *param) {
+    ((AudioEngine *)param)->renderOffline();
+    return NULL;
+}
+
+// A track plays through either a SuperpoweredAdvancedAudioPlayer or, for PCM and float WAVs at
+// the engine rate, a MemoryTrack. These helpers hide which one.
+static void playTrack(PlayerWrapper *track) {
+    if (track->memory != NULL) {
+        track->memory->play();
     } else {
-        needDetachJvm = false;
+        track->player->play(false);
     }
-    return env;
 }
 
-void detachAfterCallbackDone() {
-    if (needDetachJvm) {
-        needDetachJvm = false;
-        javaVM->DetachCurrentThread();
+static void pauseTrack(PlayerWrapper *track) {
+    if (track->memory != NULL) {
+        track->memory->pause();
+    } else {
+        track->player->pause();
     }
 }
 
+static bool isTrackPlaying(const PlayerWrapper *track) {
+    return track->memory != NULL ? track->memory->playing : track->player->playing;
+}
 
+static bool isTrackLooping(const PlayerWrapper *track) {
+    return track->memory != NULL ? track->memory->looping : track->player->looping;
+}
 
-static void onRecorderFlushedData(void *clientData) {
-    LOGI("recorder flushed data to file!");
-    AudioEngine *recorder = *((AudioEngine **)clientData);
-    if (recorder != NULL) {
-        recorder->notifyRecordFinished();
+static void exitTrackLoop(PlayerWrapper *track) {
+    if (track->memory != NULL) {
+        track->memory->exitLoop();
+    } else {
+        track->player->exitLoop();
     }
 }
 
-static void playerEventCallback(void *clientData, SuperpoweredAdvancedAudioPlayerEvent event, void * __unused value) {
-    void **params = (void **)(clientData);
-    AudioEngine *recorder = (AudioEngine *) params[0];
-    PlayerWrapper *playerWrapper = (PlayerWrapper *) params[1];
-//    int *playerIndex = (int *) params[1];
-    if (recorder != NULL) {
-        recorder->onPlayerStateChangedPrepared(playerWrapper, event);
+// Channels the track is rendered in for the mixer, as it is now: its effects may come and go.
+static int trackChannels(const PlayerWrapper *track) {
+    int channels = track->memory != NULL ? track->memory->getChannels() : 2;
+    return mixerChannels(channels, track->effects.load(std::memory_order_acquire) != NULL);
+}
+
+// Renders the track into its own buffer at unity volume, in channels frames. False when it has
+// nothing to play.
+static bool processTrack(PlayerWrapper *track, unsigned int numberOfSamples, int channels) {
+    if (track->memory != NULL) {
+        return track->memory->process(track->buffer, numberOfSamples, channels);
     }
+    return track->player->process(track->buffer, false, numberOfSamples);
 }
 
-static bool audioProcessing(void *clientdata, short int *audioIO, int numberOfSamples, int __unused samplerate) {
-    return ((AudioEngine *)clientdata)->process(audioIO, (unsigned int)numberOfSamples);
+static void *prepareThreadFunction(void *param) {
+    ((AudioEngine *)param)->runPrepareWorker();
+    return NULL;
+}
+
+static long long monotonicNanoseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
 }
 
-void freePlayersMemory(PlayerWrapper **players, int playersCount) {
-    for (int i = 0; i < playersCount; i++) {
-        players[i]->player->pause();
-        delete players[i]->player;
-        delete players[i];
+// Reads the start of a file into the page cache, so that opening it under the engine mutex
+// (mapping it, or a player reading its header) doesn't wait for the disk.
+static void warmFile(const char *path, int fileOffset, int fileSize, const std::atomic<bool> &cancelled) {
+    int file = open(path, O_RDONLY);
+    if (file < 0) {
+        return;
     }
-    delete[] players;
+    long long remaining = fileSize > 0 ? fileSize : PREPARE_WARM_MAX_BYTES;
+    if (remaining > PREPARE_WARM_MAX_BYTES) remaining = PREPARE_WARM_MAX_BYTES;
+    char *chunk = (char *)malloc(PREPARE_WARM_CHUNK_BYTES);
+    if (chunk != NULL && lseek(file, fileOffset, SEEK_SET) >= 0) {
+        while (remaining > 0 && !cancelled) {
+            ssize_t bytes = read(file, chunk, remaining < PREPARE_WARM_CHUNK_BYTES ? (size_t)remaining : PREPARE_WARM_CHUNK_BYTES);
+            if (bytes <= 0) {
+                break;
+            }
+            remaining -= bytes;
+        }
+    }
+    free(chunk);
+    close(file);
 }
 
-void cacheObjects() {
-    JNIEnv *env = getEnv();
-    if (env != NULL) {
-        jclass jniCallbackClazz = env->FindClass("com/delicacyset/superpowered/AudioEngine");
-        // check error
-        g_jniCallbackClazz = reinterpret_cast<jclass>(env->NewGlobalRef(jniCallbackClazz));
+static void *decodeTrackThreadFunction(void *param) {
+    PlayerWrapper *track = (PlayerWrapper *)param;
+    track->engine->loadDecodedTrack(track);
+    return NULL;
+}
 
+static void *clipTrackThreadFunction(void *param) {
+    PlayerWrapper *track = (PlayerWrapper *)param;
+    track->engine->loadClipTrack(track);
+    return NULL;
+}
 
-        jniMethodOnPlayersPrepared = env->GetMethodID(g_jniCallbackClazz,
-                                                      "onPlayersPrepared", "()V");
-        jniMethodOnError = env->GetMethodID(g_jniCallbackClazz,
-                                            "onError", "(I)V");
-        jniMethodOnPlayerEnded = env->GetMethodID(g_jniCallbackClazz,
-                                                  "onPlayerEnded", "(I)V");
-        jniMethodOnRecordFinished = env->GetMethodID(g_jniCallbackClazz,
-                                                     "onRecordFinished", "()V");
+static void setAnalysis(PlayerWrapper *track, const void *data, unsigned int size) {
+    free(track->analysis);
+    track->analysis = size > 0 ? malloc(size) : NULL;
+    track->analysisSize = track->analysis != NULL ? size : 0;
+    if (track->analysis != NULL) {
+        memcpy(track->analysis, data, size);
     }
 }
 
-AudioEngine::AudioEngine(int sampleRate, int bufferSize) : sampleRate(sampleRate),
-                                                               bufferSize(bufferSize) {
-    cacheObjects();
+static void freeTrack(PlayerWrapper *track) {
+    if (track->loaderRunning) {
+        if (pthread_equal(track->loader, pthread_self())) {
+            pthread_detach(track->loader); // freed by its own loader, which is about to return
+        } else {
+            pthread_join(track->loader, NULL);
+        }
+    }
+    if (track->memory != NULL) {
+        delete track->memory;
+    } else if (track->player != NULL) {
+        track->player->pause();
+        delete track->player;
+    }
+    delete track->clips;
+    delete track->effects.load();
+    if (track->decoded != NULL) {
+        track->decoded->cache->release(track->decoded);
+    }
+    free(track->buffer);
+    free(track->analysis);
+    PlayerCache::release(&track->source);
+    delete track;
+}
 
+AudioEngine::AudioEngine(int sampleRate, int bufferSize, AudioEngineListener *listener) : audioSuspended(0),
+                                                                                          inProcess(false),
+                                                                                          notifierRunning(true),
+                                                                                          listener(listener),
+                                                                                          tracksCount(0),
+                                                                                          processCount(0),
+                                                                                          decodedAudio(sampleRate),
+                                                                                          playerCache(freeTrack),
+                                                                                          masterBus((unsigned int)sampleRate),
+                                                                                          sampleRate(sampleRate),
+                                                                                          bufferSize(bufferSize),
+                                                                                          prepareCancelled(false),
+                                                                                          prepareDeadline(0),
+                                                                                          prepareNext(0),
+                                                                                          bouncing(false),
+                                                                                          bounceCancelled(false),
+                                                                                          latencyCalibration(sampleRate),
+                                                                                          recordLatency(0),
+                                                                                          recordLatencyIo(bufferSize * IO_LATENCY_BUFFERS),
+                                                                                          ioLatency(bufferSize * IO_LATENCY_BUFFERS),
+                                                                                          ioLatencySeen(bufferSize * IO_LATENCY_BUFFERS),
+                                                                                          recordHistoryFrames(0),
+                                                                                          captureHistory(sampleRate,
+                                                                                                         CAPTURE_HISTORY_SECONDS) {
     pthread_mutex_init(&mutex, NULL); // This will keep our player volumes and playback states in sync.
+    pthread_mutex_init(&commandMutex, NULL);
+    pthread_mutex_init(&commandDrainMutex, NULL);
+    sem_init(&eventsAvailable, 0, 0);
+    pthread_create(&notifierThread, NULL, notifierThreadFunction, this);
     stereoBufferPlayback = (float *)memalign(16, (bufferSize + 16) * sizeof(float) * 2);
-    stereoBufferRecording = (float *)memalign(16, (bufferSize + 16) * sizeof(float) * 2);
 }
 
 void AudioEngine::init(int numberOfChannels, int playersCount, bool loop, int mainPlayerIndex) {
     initialized = true;
+    numberOfChannels = numberOfChannels == 1 ? 1 : 2;
+    if (numberOfChannels != this->numberOfChannels) {
+        // The input opens with the take's channels: reopen it with the new count on the next start.
+        AudioIO *io = audioSystem.exchange(NULL);
+        if (io != NULL) {
+            io->stop();
+            delete io;
+        }
+        ioLatency = ioLatencySeen = bufferSize * IO_LATENCY_BUFFERS;
+        ioLatencyDue = 0;
+        captureHistory.setChannels(numberOfChannels);
+    }
     this->numberOfChannels = numberOfChannels;
     this->playersCount = playersCount;
+    this->loop = loop;
     this->mainPlayerIndex = mainPlayerIndex;
 
-    players = new PlayerWrapper *[MAX_PLAYERS_COUNT];
+    ensureSlotCapacity(playersCount);
     if (playersCount == 0) {
         prepared = true;
         notifyPlayersPrepared();
@@ -124,35 +264,35 @@ void AudioEngine::init(int numberOfChannels, int playersCount, bool loop, int ma
 
 AudioEngine::~AudioEngine() {
     reset();
+    pthread_mutex_lock(&mutex);
+    playerCache.clear();
+    pthread_mutex_unlock(&mutex);
+    free(bouncePath);
     if (audioSystem != NULL) {
-        audioSystem->stop();
-        delete audioSystem;
+        audioSystem.load()->stop();
+        delete audioSystem.load();
         audioSystem = NULL;
     }
-    freePlayersMemory(players, preparedPlayersCount);
-    players = NULL;
+    delete[] mixerInputs;
+    mixerInputs = NULL;
 
     if (recorder != NULL) {
         delete recorder;
         recorder = NULL;
     }
     free(stereoBufferPlayback);
-    free(stereoBufferRecording);
 
-    // DeleteGlobalRef
-    JNIEnv * env = getEnv();
-    if (env != NULL) {
-        if (g_jniCallbackInstance != NULL) {
-            env->DeleteGlobalRef(g_jniCallbackInstance);
-            g_jniCallbackInstance = NULL;
-        }
-        if (g_jniCallbackClazz != NULL) {
-            env->DeleteGlobalRef(g_jniCallbackClazz);
-            g_jniCallbackClazz = NULL;
-        }
-    }
+    // Delivers whatever is still queued, then exits.
+    notifierRunning = false;
+    sem_post(&eventsAvailable);
+    pthread_join(notifierThread, NULL);
+    sem_destroy(&eventsAvailable);
+    delete[] slots; // a player still opening looks its slot up when it calls back, before it is freed
+    slots = NULL;
 
     pthread_mutex_destroy(&mutex);
+    pthread_mutex_destroy(&commandMutex);
+    pthread_mutex_destroy(&commandDrainMutex);
 
     LOGI("DESTROYED");
 }
@@ -161,73 +301,421 @@ bool AudioEngine::isPrepared() const {
     return prepared;
 }
 
+bool AudioEngine::isBouncing() const {
+    return bouncing;
+}
+
 void AudioEngine::preparePlayer(const char *path, int fileOffset, int fileSize) {
-    SuperpoweredAdvancedAudioPlayer *player;
-    void **params = (void **) malloc(sizeof(AudioEngine) + sizeof(PlayerWrapper));
-    params[0] = static_cast<void *>(this);
+    addTrack(path, fileOffset, fileSize);
+}
 
-    PlayerWrapper *playerWrapper = new PlayerWrapper();
+void AudioEngine::prepareTracks(const char *const *paths, const int *fileOffsets, const int *fileSizes, int count,
+                                int timeoutMs) {
+    cancelPrepare();
+    if (!initialized) {
+        notifyError(ERROR_ENGINE_NOT_INITIALIZED);
+        return;
+    }
+    ensureSlotCapacity(count);
+    preparePaths = (char **)calloc((size_t)count + 1, sizeof(char *));
+    prepareOffsets = (int *)calloc((size_t)count + 1, sizeof(int));
+    prepareSizes = (int *)calloc((size_t)count + 1, sizeof(int));
+    for (int i = 0; i < count; i++) {
+        preparePaths[i] = strdup(paths[i]);
+        prepareOffsets[i] = fileOffsets != NULL ? fileOffsets[i] : 0;
+        prepareSizes[i] = fileSizes != NULL ? fileSizes[i] : 0;
+    }
+    prepareCount = count;
+    prepareNext = 0;
+    prepareCancelled = false;
 
-    params[1] = static_cast<void *>(playerWrapper);
+    pthread_mutex_lock(&mutex);
+    playersCount = count;
+    preparedPlayersCount = 0;
+    prepared = count == 0;
+    preparing = count > 0;
+    prepareDeadline = timeoutMs > 0 && count > 0 ? monotonicNanoseconds() + timeoutMs * 1000000LL : 0;
+    pthread_mutex_unlock(&mutex);
+    if (count == 0) {
+        notifyPlayersPrepared();
+        return;
+    }
+    sem_post(&eventsAvailable); // the notifier watches the deadline
 
-    player =
-            new SuperpoweredAdvancedAudioPlayer(params,
-                                                playerEventCallback,
-                                                (unsigned int) sampleRate,
-                                                0);
-    playerWrapper->player = player;
-    playerWrapper->index = playerIndexCounter;
-    players[playerIndexCounter++] = playerWrapper;
+    int threads = count < PREPARE_THREADS ? count : PREPARE_THREADS;
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&prepareThreads[prepareThreadsCount], NULL, prepareThreadFunction, this) == 0) {
+            prepareThreadsCount++;
+        }
+    }
+    if (prepareThreadsCount == 0) {
+        runPrepareWorker(); // opening is asynchronous anyway, only the warm-up is lost
+    }
+}
+
+void AudioEngine::cancelPrepare() {
+    pthread_mutex_lock(&mutex);
+    abortPrepare(-1, ERROR_PREPARE_CANCELLED);
+    pthread_mutex_unlock(&mutex);
+    joinPrepareThreads();
+}
+
+// Prepare threads. Each takes the next track of the batch, warms its file and opens it.
+void AudioEngine::runPrepareWorker() {
+    while (!prepareCancelled) {
+        int index = prepareNext++;
+        if (index >= prepareCount) {
+            break;
+        }
+        warmFile(preparePaths[index], prepareOffsets[index], prepareSizes[index], prepareCancelled);
+        PlayerWrapper *loaded = NULL;
+        pthread_mutex_lock(&mutex);
+        if (preparing) {
+            if (slots[index].loading != NULL) {
+                retireTrack(slots[index].loading);
+                slots[index].loading = NULL;
+            }
+            loaded = openTrack(index, preparePaths[index], prepareOffsets[index], prepareSizes[index]);
+        }
+        pthread_mutex_unlock(&mutex);
+        if (loaded != NULL) {
+            onPlayerStateChangedPrepared(loaded, SuperpoweredAdvancedAudioPlayerEvent_LoadSuccess);
+        }
+    }
+}
+
+int AudioEngine::addTrack(const char *path, int fileOffset, int fileSize) {
+    pthread_mutex_lock(&mutex);
+    int index = -1;
+    PlayerWrapper *loaded = NULL;
+    for (int i = 0; i < slotCount; i++) {
+        if (slots[i].track.load() == NULL && slots[i].loading == NULL) {
+            index = i;
+            loaded = openTrack(i, path, fileOffset, fileSize);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+    if (index < 0) {
+        LOGI("no free track slot for %s", path);
+        notifyError(ERROR_NO_FREE_TRACK_SLOT);
+    }
+    if (loaded != NULL) {
+        onPlayerStateChangedPrepared(loaded, SuperpoweredAdvancedAudioPlayerEvent_LoadSuccess);
+    }
+    return index;
+}
+
+int AudioEngine::replaceTrack(int index, const char *path, int fileOffset, int fileSize) {
+    if (index < 0 || index >= slotCount) {
+        notifyError(ERROR_NO_FREE_TRACK_SLOT);
+        return -1;
+    }
+    pthread_mutex_lock(&mutex);
+    if (slots[index].loading != NULL) {
+        retireTrack(slots[index].loading); // superseded before it finished loading
+        slots[index].loading = NULL;
+    }
+    PlayerWrapper *loaded = openTrack(index, path, fileOffset, fileSize);
+    pthread_mutex_unlock(&mutex);
+    if (loaded != NULL) {
+        onPlayerStateChangedPrepared(loaded, SuperpoweredAdvancedAudioPlayerEvent_LoadSuccess);
+    }
+    return index;
+}
+
+int AudioEngine::setTrackClips(int index, const Clip *clips, int count) {
+    if (index >= slotCount) {
+        notifyError(ERROR_NO_FREE_TRACK_SLOT);
+        return -1;
+    }
+    pthread_mutex_lock(&mutex);
+    for (int i = 0; index < 0 && i < slotCount; i++) {
+        if (slots[i].track.load() == NULL && slots[i].loading == NULL) {
+            index = i;
+        }
+    }
+    if (index >= 0) {
+        if (slots[index].loading != NULL) {
+            retireTrack(slots[index].loading); // an earlier edit, superseded before it loaded
+            slots[index].loading = NULL;
+        }
+        openClipTrack(index, clips, count);
+    }
+    pthread_mutex_unlock(&mutex);
+    if (index < 0) {
+        LOGI("no free track slot for clips");
+        notifyError(ERROR_NO_FREE_TRACK_SLOT);
+    }
+    return index;
+}
+
+void AudioEngine::removeTrack(int index) {
+    if (index < 0 || index >= slotCount) {
+        return;
+    }
+    pthread_mutex_lock(&mutex);
+    if (slots[index].loading != NULL) {
+        retireTrack(slots[index].loading);
+        slots[index].loading = NULL;
+    }
+    PlayerWrapper *track = slots[index].track.exchange(NULL);
+    if (track != NULL) {
+        tracksCount--;
+        retireTrack(track);
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+bool AudioEngine::loadSession(const char *path) {
+    SessionFile session;
+    if (!session.open(path) || session.getHeader()->sampleRate != (uint32_t)sampleRate) {
+        LOGI("can't load session %s", path);
+        notifyError(ERROR_SESSION);
+        return false;
+    }
+    const SessionHeader *header = session.getHeader();
+    int count = (int)header->tracksCount, tracks = 0;
+    for (int i = 0; i < count; i++) {
+        const SessionTrackRecord *record = session.getTrack(i);
+        if (session.getString(record->path) != NULL || record->clipsCount > 0) {
+            tracks++; // empty slots are kept, but not waited for
+        }
+    }
+    reset();
+    ensureSlotCapacity(count);
+    init(header->numberOfChannels, tracks, (header->flags & SESSION_FLAG_LOOP) != 0, header->mainTrack);
+    setRecordLatency(header->recordLatency);
+    if (header->loopEnd > header->loopStart) {
+        setLoopRegion(header->loopStart, header->loopEnd);
+    }
+
+    Clip *clips = NULL;
+    int clipsCapacity = 0;
+    for (int i = 0; i < count; i++) {
+        const SessionTrackRecord *record = session.getTrack(i);
+        const char *file = session.getString(record->path);
+        if (file == NULL && record->clipsCount == 0) {
+            continue;
+        }
+        int clipsCount = 0;
+        if (record->clipsCount > 0 || record->offset != 0) {
+            int needed = record->clipsCount > 0 ? (int)record->clipsCount : 1;
+            if (needed > clipsCapacity) {
+                delete[] clips;
+                clips = new Clip[needed];
+                clipsCapacity = needed;
+            }
+            for (int c = 0; c < (int)record->clipsCount; c++) {
+                const SessionClipRecord *clip = session.getClip(record, c);
+                if (clip != NULL && session.getString(clip->path) != NULL) {
+                    clips[clipsCount].path = session.getString(clip->path);
+                    clips[clipsCount].sourceOffset = clip->sourceOffset;
+                    clips[clipsCount].timelineStart = clip->timelineStart;
+                    clips[clipsCount].length = clip->length;
+                    clips[clipsCount].fade = clip->fade;
+                    clipsCount++;
+                }
+            }
+            if (record->clipsCount == 0) {
+                // A file shifted on the timeline plays as one clip of itself.
+                clips[0].path = file;
+                clips[0].sourceOffset = record->offset < 0 ? -(long long)record->offset : 0;
+                clips[0].timelineStart = record->offset > 0 ? record->offset : 0;
+                clips[0].length = 0;
+                clips[0].fade = 0;
+                clipsCount = 1;
+            }
+        }
+        PlayerWrapper *loaded = NULL;
+        pthread_mutex_lock(&mutex);
+        if (clipsCount > 0) {
+            openClipTrack(i, clips, clipsCount);
+        } else if (record->clipsCount == 0) {
+            loaded = openTrack(i, file, record->fileOffset, record->fileSize);
+        }
+        PlayerWrapper *track = slots[i].loading;
+        if (track != NULL) {
+            track->volume = record->volume;
+            track->pan = record->pan;
+            const void *analysis = session.getData(record->analysisOffset, record->analysisSize);
+            if (analysis != NULL) {
+                setAnalysis(track, analysis, record->analysisSize);
+            }
+        }
+        pthread_mutex_unlock(&mutex);
+        if (loaded != NULL) {
+            onPlayerStateChangedPrepared(loaded, SuperpoweredAdvancedAudioPlayerEvent_LoadSuccess);
+        } else if (clipsCount == 0 && record->clipsCount > 0) {
+            notifyError(ERROR_PLAYER_PREPARE); // every clip of the track was damaged
+        }
+    }
+    delete[] clips;
+    return true;
+}
+
+bool AudioEngine::saveSession(const char *path) {
+    // The mutex keeps the tracks, and the paths and data they own, from being retired meanwhile.
+    pthread_mutex_lock(&mutex);
+    int count = slotCount;
+    while (count > 0 && slotTrack(count - 1) == NULL) {
+        count--;
+    }
+    SessionTrack *tracks = new SessionTrack[count > 0 ? count : 1];
+    for (int i = 0; i < count; i++) {
+        const PlayerWrapper *track = slotTrack(i);
+        SessionTrack &saved = tracks[i];
+        memset(&saved, 0, sizeof(saved));
+        saved.volume = 1.f;
+        if (track == NULL) {
+            continue;
+        }
+        if (track->clips != NULL) {
+            Clip *clips = new Clip[track->clips->getClipsCount() + 1];
+            for (int c = 0; c < track->clips->getClipsCount(); c++) {
+                track->clips->getClip(c, &clips[c]);
+            }
+            saved.clips = clips;
+            saved.clipsCount = track->clips->getClipsCount();
+        } else {
+            saved.path = track->source.path;
+            saved.fileOffset = track->source.fileOffset;
+            saved.fileSize = track->source.fileSize;
+        }
+        saved.volume = track->volume;
+        saved.pan = track->pan;
+        saved.analysis = track->analysis;
+        saved.analysisSize = track->analysisSize;
+    }
+    Session session;
+    session.sampleRate = sampleRate;
+    session.numberOfChannels = numberOfChannels;
+    session.mainTrack = mainPlayerIndex;
+    session.loop = loop;
+    pthread_mutex_lock(&commandMutex);
+    session.loopStart = loopRegionStart;
+    session.loopEnd = loopRegionEnd;
+    pthread_mutex_unlock(&commandMutex);
+    session.recordLatency = recordLatency;
+    session.tracks = tracks;
+    session.tracksCount = count;
+    bool saved = SessionFile::write(path, session);
+    pthread_mutex_unlock(&mutex);
+
+    for (int i = 0; i < count; i++) {
+        delete[] tracks[i].clips;
+    }
+    delete[] tracks;
+    return saved;
+}
 
-    player->open(path, fileOffset, fileSize);
+bool AudioEngine::setTrackAnalysis(int index, const void *data, unsigned int size) {
+    if (index < 0 || index >= slotCount) {
+        return false;
+    }
+    pthread_mutex_lock(&mutex);
+    PlayerWrapper *track = slotTrack(index);
+    if (track != NULL) {
+        setAnalysis(track, data, size);
+    }
+    pthread_mutex_unlock(&mutex);
+    return track != NULL;
+}
+
+int AudioEngine::getTrackAnalysis(int index, void *buffer, unsigned int capacity) {
+    if (index < 0 || index >= slotCount) {
+        return -1;
+    }
+    pthread_mutex_lock(&mutex);
+    PlayerWrapper *track = slotTrack(index);
+    int size = track != NULL ? (int)track->analysisSize : -1;
+    if (size > 0 && buffer != NULL) {
+        memcpy(buffer, track->analysis, (unsigned int)size < capacity ? (size_t)size : capacity);
+    }
+    pthread_mutex_unlock(&mutex);
+    return size;
+}
+
+bool AudioEngine::setTrackEffects(int index, const Effect *effects, int count) {
+    if (index < 0 || index >= slotCount) {
+        return false;
+    }
+    EffectChain *chain = count > 0 ? new EffectChain(effects, count, (unsigned int)sampleRate) : NULL;
+    pthread_mutex_lock(&mutex);
+    // The playing track takes the chain; one still loading inherits it when it replaces that one.
+    PlayerWrapper *track = slots[index].track.load();
+    if (track == NULL) {
+        track = slots[index].loading;
+    }
+    if (track != NULL) {
+        retireEffects(track->effects.exchange(chain));
+    }
+    pthread_mutex_unlock(&mutex);
+    if (track == NULL) {
+        delete chain;
+    }
+    return track != NULL;
+}
+
+void AudioEngine::setTrackEffectParameter(int index, int effect, int parameter, float value) {
+    pthread_mutex_lock(&mutex);
+    EffectChain *chain = slotEffects(index);
+    if (chain != NULL) {
+        chain->setParameter(effect, parameter, value);
+    }
+    pthread_mutex_unlock(&mutex);
+}
 
-    player->syncMode = SuperpoweredAdvancedAudioPlayerSyncMode_TempoAndBeat;
+void AudioEngine::setTrackEffectEnabled(int index, int effect, bool enabled) {
+    pthread_mutex_lock(&mutex);
+    EffectChain *chain = slotEffects(index);
+    if (chain != NULL) {
+        chain->setEnabled(effect, enabled);
+    }
+    pthread_mutex_unlock(&mutex);
 }
 
-void AudioEngine::startRecording(const char *tempPath, const char *destinationPath) {
+void AudioEngine::startRecording(const char *tempPath, const char *destinationPath, bool withHistory) {
     LOGI("startRecording");
     if (!isReady()) {
         return;
     }
     tempRecorderPath = tempPath;
     destinationRecorderPath = destinationPath;
-    if (audioSystem == NULL) {
-        LOGI("audio system NULL");
-        audioSystem =
-                new SuperpoweredAndroidAudioIO(
-                        sampleRate,
-                        bufferSize,
-                        true,
-                        true,
-                        audioProcessing,
-                        this,
-                        SL_ANDROID_RECORDING_PRESET_GENERIC,
-                        SL_ANDROID_STREAM_MEDIA,
-                        bufferSize * 2);
-    } else {
-        audioSystem->start();
-    }
+    startAudioSystem();
     LOGI("start recording %s |\n %s", tempRecorderPath, destinationRecorderPath);
     if (!isReady()) {
         return;
     }
-    recorder = new SuperpoweredRecorder(tempRecorderPath,
-                                        (unsigned int) sampleRate,
-                                        1,
-                                        (unsigned char) numberOfChannels,
-                                        false,
-                                        onRecorderFlushedData, this);
-    recorder->start(destinationRecorderPath);
-    recording = true;
+    StreamingRecorder *newRecorder = new StreamingRecorder(sampleRate, numberOfChannels, recordingFormat,
+                                                           onRecorderFlushedData, this);
+    if (!newRecorder->start(destinationRecorderPath)) {
+        delete newRecorder;
+        notifyError(ERROR_RECORDER);
+        return;
+    }
+
+    // The audio thread may still be feeding the previous take, swap recorders between callbacks.
+    suspendAudio();
+    applySuspendedCommands();
+    if (recording) {
+        recorder->stop(); // cuts short the tail of the previous take
+        recording = stoppingRecording = false;
+    }
+    delete recorder;
+    recorder = newRecorder;
+    resumeAudio();
+
+    recordHistoryFrames = 0;
+    sendCommand(ENGINE_COMMAND_START_RECORDING, 0, withHistory ? 1 : 0);
     setPlay(true);
 }
 
 void AudioEngine::stopRecording() {
-    if (recording && recorder != NULL) {
+    if (recorder != NULL) {
         LOGI("stop recording");
-        recorder->stop();
-        recording = false;
-        setPlay(false);
+        sendCommand(ENGINE_COMMAND_STOP_RECORDING);
+        SuperpoweredCPU::setSustainedPerformanceMode(false);
     }
 }
 
@@ -236,143 +724,1054 @@ void AudioEngine::startPlaying(bool fromBeginning) {
     if (!isReady()) {
         return;
     }
-    if (audioSystem == NULL) {
-        LOGI("audio system NULL");
-        audioSystem =
-                new SuperpoweredAndroidAudioIO(
-                        sampleRate,
-                        bufferSize,
-                        true,
-                        true,
-                        audioProcessing,
-                        this,
-                        SL_ANDROID_RECORDING_PRESET_GENERIC,
-                        SL_ANDROID_STREAM_MEDIA,
-                        bufferSize * 2);
-    } else {
-        audioSystem->start();
-    }
+    startAudioSystem();
     if (fromBeginning) {
-        for (int i = 0; i < preparedPlayersCount; i++) {
-            players[i]->player->setPosition(0, true, false);
-        }
+        sendCommand(ENGINE_COMMAND_SEEK, 0, 0, 0);
     }
     setPlay(true);
-    playing = true;
-    recording = false;
 }
 
 void AudioEngine::setPlay(bool shouldPlay) {
-    for (int i = 0; i < preparedPlayersCount; i++) {
-        if (shouldPlay) {
-            players[i]->player->play(false);
-        } else{
-            players[i]->player->pause();
+    sendCommand(shouldPlay ? ENGINE_COMMAND_PLAY : ENGINE_COMMAND_PAUSE);
+    SuperpoweredCPU::setSustainedPerformanceMode(shouldPlay); // <-- Important to prevent audio dropouts.
+}
+
+void AudioEngine::setPlayerVolume(int index, float volume) {
+    sendCommand(ENGINE_COMMAND_SET_VOLUME, index, volume);
+}
+
+void AudioEngine::setPlayerPan(int index, float pan) {
+    if (pan < -1.f) pan = -1.f;
+    if (pan > 1.f) pan = 1.f;
+    sendCommand(ENGINE_COMMAND_SET_PAN, index, pan);
+}
+
+void AudioEngine::measureLatency() {
+    LOGI("measureLatency");
+    if (!initialized) {
+        notifyError(ERROR_ENGINE_NOT_INITIALIZED);
+        return;
+    }
+    startAudioSystem();
+    sendCommand(ENGINE_COMMAND_MEASURE_LATENCY);
+}
+
+void AudioEngine::setRecordLatency(int samples) {
+    recordLatencyIo = ioLatency.load();
+    recordLatency = samples > 0 ? samples : 0;
+}
+
+int AudioEngine::getRecordLatency() const {
+    return recordLatency;
+}
+
+int AudioEngine::getIoLatency() const {
+    return ioLatency;
+}
+
+int AudioEngine::getRecordHistoryFrames() const {
+    return recordHistoryFrames;
+}
+
+void AudioEngine::setDecodedAudioBudget(long long bytes) {
+    decodedAudio.setBudget(bytes);
+}
+
+void AudioEngine::setRecordingFormat(int format) {
+    recordingFormat = format;
+}
+
+void AudioEngine::setLoopRegion(long long startSample, long long endSample) {
+    pthread_mutex_lock(&commandMutex);
+    loopRegionStart = startSample;
+    loopRegionEnd = endSample;
+    pthread_mutex_unlock(&commandMutex);
+    sendCommand(ENGINE_COMMAND_SET_LOOP, 0, 0, startSample, endSample);
+}
+
+void AudioEngine::setMasterBus(bool enabled) {
+    sendCommand(ENGINE_COMMAND_SET_MASTER_BUS, enabled ? 1 : 0);
+}
+
+void AudioEngine::setPunchRegion(long long punchInSample, long long punchOutSample) {
+    sendCommand(ENGINE_COMMAND_SET_PUNCH, 0, 0, punchInSample, punchOutSample);
+}
+
+bool AudioEngine::process(float *audioIO, unsigned int numberOfSamples) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    // Paired with suspendAudio(): either the suspending thread sees us inside the callback,
+    // or we see the suspension and leave the players alone.
+    inProcess = true;
+    bool hasAudio = false;
+    if (audioSuspended == 0 && !bouncing) {
+        followIoLatency();
+        applyCommands();
+        captureHistory.write(audioIO, numberOfSamples);
+        if (latencyCalibration.isRunning()) {
+            if (latencyCalibration.process(audioIO, numberOfSamples, numberOfChannels)) {
+                int latency = latencyCalibration.getResult();
+                if (latency >= 0) {
+                    recordLatencyIo = ioLatency.load();
+                    recordLatency = latency;
+                }
+                notifyLatencyMeasured(latency);
+            }
+            hasAudio = true;
+        } else {
+            hasAudio = render(audioIO, numberOfSamples);
         }
     }
-    playing = shouldPlay;
-    SuperpoweredCPU::setSustainedPerformanceMode(shouldPlay); // <-- Important to prevent audio dropouts.
+    processCount++;
+    outputFrames += numberOfSamples;
+    inProcess = false;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double micros = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) * 1e-3;
+    callbackStats.record(micros, numberOfSamples * 1e6 / sampleRate);
+    return hasAudio;
 }
 
-bool AudioEngine::process(short int *audioIO, unsigned int numberOfSamples) {
+void AudioEngine::getStats(AudioEngineStats *stats) {
+    callbackStats.snapshot(stats);
+    stats->inputUnderruns = stats->outputUnderruns = stats->silenceSubstitutions = stats->inputOverruns = 0;
+    if (audioSystem != NULL) {
+        audioSystem.load()->getDropouts(&stats->inputUnderruns, &stats->outputUnderruns, &stats->silenceSubstitutions,
+                                 &stats->inputOverruns);
+    }
+}
 
-    bool silence = preparedPlayersCount > 0;
-    for (int i = 0; i < preparedPlayersCount; i++) {
-        bool processed = players[i]->player->process(stereoBufferPlayback, !silence, numberOfSamples, players[i]->volume);
-        if (processed) {
-            silence = false;
+bool AudioEngine::bounce(const char *destinationPath) {
+    LOGI("bounce: %s", destinationPath);
+    if (!isReady()) {
+        return false;
+    }
+    if (bouncing || tracksCount == 0) {
+        notifyError(ERROR_BOUNCE);
+        return false;
+    }
+    cancelBounce(); // joins the previous, already finished render thread
+    stopRecording();
+    setPlay(false);
+    suspendAudio();
+    applySuspendedCommands();
+
+    free(bouncePath);
+    bouncePath = strdup(destinationPath);
+    bounceCancelled = false;
+    bouncing = true;
+    resumeAudio();
+    if (pthread_create(&bounceThread, NULL, bounceThreadFunction, this) != 0) {
+        bouncing = false;
+        notifyError(ERROR_BOUNCE);
+        return false;
+    }
+    bounceThreadRunning = true;
+    return true;
+}
+
+void AudioEngine::renderOffline() {
+    PlayerWrapper *mainPlayer = mainTrack();
+    unsigned int totalSamples = mainPlayer != NULL ? (unsigned int)trackDuration(mainPlayer) : 0;
+
+    short int *shortBuffer = (short int *)malloc((bufferSize + 16) * sizeof(short int) * 2);
+    stereoBufferBounce = (float *)memalign(16, (bufferSize + 16) * sizeof(float) * 2);
+    // Without a main track to time it there is nothing to render: no file rather than an empty one.
+    FILE *file = totalSamples > 0 && shortBuffer != NULL && stereoBufferBounce != NULL ?
+                 createWAV(bouncePath, (unsigned int)sampleRate, 2) : NULL;
+    bool success = file != NULL;
+    if (!success) {
+        LOGI("bounce: can't render %u samples to %s", totalSamples, bouncePath);
+        notifyError(ERROR_BOUNCE);
+    }
+
+    for (int i = 0; i < slotCount; i++) {
+        PlayerWrapper *track = trackAt(i);
+        if (track != NULL) {
+            seekTrack(track, 0, false);
+            playTrack(track);
+            trackGains(track, trackChannels(track), &track->gainLeft, &track->gainRight);
+            track->attached = true;
         }
     }
 
-    if (recording) {
-        if (silence) {
-            recorder->process(NULL, numberOfSamples);
+    // The master bus delays the mix: leave out as much at the start and render that much past the
+    // end, in whole buffers, so the limiter sees every block it would live.
+    masterBus.clear();
+    bool delayed = masterBus.getLatency() > 0;
+    unsigned int skipped = (unsigned int)masterBus.getLatency();
+    unsigned int renderedSamples = 0;
+    int lastPercent = -1;
+    while (success && renderedSamples < totalSamples && !bounceCancelled) {
+        unsigned int numberOfSamples = (unsigned int)bufferSize;
+        if (!delayed && numberOfSamples > totalSamples - renderedSamples) {
+            numberOfSamples = totalSamples - renderedSamples;
+        }
+        if (!mixPlayers(stereoBufferBounce, numberOfSamples, true, NULL)) {
+            memset(stereoBufferBounce, 0, numberOfSamples * sizeof(float) * 2);
+        }
+        masterBus.process(stereoBufferBounce, numberOfSamples);
+        SuperpoweredFloatToShortInt(stereoBufferBounce, shortBuffer, numberOfSamples);
+        unsigned int from = skipped < numberOfSamples ? skipped : numberOfSamples;
+        unsigned int frames = numberOfSamples - from;
+        if (frames > totalSamples - renderedSamples) frames = totalSamples - renderedSamples;
+        skipped -= from;
+        if (fwrite(shortBuffer + from * 2, sizeof(short int) * 2, frames, file) != frames) {
+            success = false;
+        }
+        renderedSamples += frames;
+
+        int percent = (int)((unsigned long long)renderedSamples * 100 / totalSamples);
+        if (percent != lastPercent) {
+            lastPercent = percent;
+            notifyBounceProgress((float)renderedSamples / totalSamples);
+        }
+    }
+
+    // Live playback puts every track back on the transport position afterwards.
+    for (int i = 0; i < slotCount; i++) {
+        PlayerWrapper *track = trackAt(i);
+        if (track != NULL) {
+            pauseTrack(track);
+            track->attached = false;
+        }
+    }
+    if (file != NULL) {
+        closeWAV(file);
+    }
+    free(shortBuffer);
+    free(stereoBufferBounce);
+    stereoBufferBounce = NULL;
+
+    masterBus.clear();
+    success = success && !bounceCancelled;
+    LOGI("bounce finished: %d, %u samples", success, renderedSamples);
+    bouncing = false;
+    notifyBounceFinished(success);
+}
+
+void AudioEngine::runNotifier() {
+    if (listener != NULL) {
+        listener->onNotifierThreadStarted();
+    }
+    while (true) {
+        // Wakes up on its own to retry pending reclaims and to enforce a prepare deadline.
+        long long waitNs = -1;
+        if (pendingReclaimCount > 0 || pendingOverflow != NULL) {
+            waitNs = RECLAIM_RETRY_MS * 1000000LL;
+        }
+        long long prepareBy = prepareDeadline;
+        if (prepareBy != 0) {
+            long long untilDeadline = prepareBy - monotonicNanoseconds();
+            if (untilDeadline < 0) untilDeadline = 0;
+            if (waitNs < 0 || untilDeadline < waitNs) waitNs = untilDeadline;
+        }
+        int result;
+        if (waitNs < 0) {
+            result = sem_wait(&eventsAvailable);
         } else {
-            SuperpoweredShortIntToFloat(audioIO, stereoBufferRecording, numberOfSamples);
-            recorder->process(stereoBufferRecording, NULL, numberOfSamples);
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += waitNs / 1000000000LL;
+            deadline.tv_nsec += waitNs % 1000000000LL;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            result = sem_timedwait(&eventsAvailable, &deadline);
         }
+        if (result != 0 && errno == EINTR) {
+            continue;
+        }
+        EngineEvent event;
+        while (events.pop(event)) {
+            deliverEvent(event);
+        }
+        reclaimTracks(false);
+        checkPrepareDeadline();
+        if (!notifierRunning) {
+            break;
+        }
+    }
+    reclaimTracks(true); // the engine is going away, audio is already stopped
+    if (listener != NULL) {
+        listener->onNotifierThreadStopped();
+    }
+}
+
+// -------------------- PRIVATE ---------------------------------------
+
+bool AudioEngine::render(float *audioIO, unsigned int numberOfSamples) {
+    bool hasAudio = false;
+    bool hasTracks = tracksCount > 0;
+    if (hasTracks) {
+        // Split the buffer where the transport crosses the loop end, so every player wraps on the same sample.
+        unsigned int offset = 0;
+        while (offset < numberOfSamples) {
+            unsigned int chunk = numberOfSamples - offset;
+            bool wraps = false;
+            if (playing && loopEndSample > loopStartSample) {
+                long long untilLoopEnd = loopEndSample - transportPosition;
+                if (untilLoopEnd <= chunk) {
+                    wraps = true;
+                    chunk = untilLoopEnd > 0 ? (unsigned int)untilLoopEnd : 0;
+                }
+            }
+            if (chunk > 0) {
+                float *chunkBuffer = stereoBufferPlayback + offset * 2;
+                bool mainPlayerHasAudio = false;
+                if (mixPlayers(chunkBuffer, chunk, false, &mainPlayerHasAudio)) {
+                    hasAudio = true;
+                } else {
+                    memset(chunkBuffer, 0, chunk * sizeof(float) * 2);
+                }
+                // The transport is anchored to the main player: it only moves when the main player did.
+                if (mainPlayerHasAudio) {
+                    logTransport(outputFrames + offset, transportPosition, chunk);
+                    transportPosition += chunk;
+                }
+                offset += chunk;
+            }
+            if (wraps) {
+                wrapLoop();
+            }
+        }
+    }
+    bool silence = hasTracks && !hasAudio;
+
+    if (recording) {
+        recordInput(audioIO, numberOfSamples, silence);
     }
 
-    if (preparedPlayersCount > 0 && !silence) {
+    if (hasTracks && !silence) {
+        masterBus.process(stereoBufferPlayback, numberOfSamples);
         // write playback buffer to io stream audio
-        SuperpoweredFloatToShortInt(stereoBufferPlayback, audioIO, numberOfSamples);
+        memcpy(audioIO, stereoBufferPlayback, numberOfSamples * sizeof(float) * 2);
     }
-    return preparedPlayersCount > 0 && !silence;
+    if ((!hasTracks || silence) && masterBus.drain(stereoBufferPlayback, numberOfSamples)) {
+        // The players stopped: the master bus still plays out the end of what they played.
+        memcpy(audioIO, stereoBufferPlayback, numberOfSamples * sizeof(float) * 2);
+        return true;
+    }
+    return hasTracks && !silence;
 }
 
-// -------------------- PRIVATE ---------------------------------------
+// Frames from the output the players are mixed into to the input they come back on.
+int AudioEngine::roundTrip() const {
+    int frames = recordLatency + ioLatency - recordLatencyIo + masterBus.getLatency();
+    return frames > 0 ? frames : 0;
+}
+
+// Keeps takes lined up while the IO latency changes. Input the IO dropped is missing from now on,
+// so the take gets as much silence in its place. Silence the IO played while it filled up comes
+// back on the input only a round trip later; the take skips it then.
+void AudioEngine::followIoLatency() {
+    AudioIO *io = audioSystem;
+    if (io == NULL) {
+        return;
+    }
+    int latency = io->getLatency();
+    if (latency < ioLatencySeen) {
+        int dropped = latency - ioLatencySeen;
+        ioLatency += dropped;
+        recordSkipFrames += dropped;
+    } else if (latency > ioLatencySeen) {
+        ioLatencyDue = outputFrames + roundTrip();
+    }
+    ioLatencySeen = latency;
+    if (ioLatency < ioLatencySeen && outputFrames >= ioLatencyDue) {
+        recordSkipFrames += ioLatencySeen - ioLatency;
+        ioLatency = ioLatencySeen;
+    }
+}
+
+// Feeds the take. Until the players are heard there is nothing to record yet. After that the
+// first roundTrip() frames of input are dropped, so the take lines up with what the players
+// played, and after a stop the input keeps being recorded for as long. A take with history starts
+// with the input that came just before its first frame. While the IO latency changes,
+// followIoLatency() adds to the frames skipped, or takes away from them for silence to be recorded.
+void AudioEngine::recordInput(float *audioIO, unsigned int numberOfSamples, bool silence) {
+    if (recordPunchOut > recordPunchIn) {
+        recordPunch(audioIO, numberOfSamples);
+        return;
+    }
+    if (silence && !recordStarted) {
+        return;
+    }
+    recordStarted = true;
+    if (recordSkipFrames < 0) {
+        unsigned int missing = (unsigned int)-recordSkipFrames;
+        recordSkipFrames = 0;
+        if (stoppingRecording && missing > (unsigned int)recordTailFrames) {
+            missing = (unsigned int)recordTailFrames;
+        }
+        if (!recordWithHistory) { // else the take hasn't started yet, the history will come first
+            recordSilence(missing);
+            if (stoppingRecording) {
+                recordTailFrames -= missing;
+            }
+        }
+    }
+    unsigned int offset = 0;
+    if (recordSkipFrames > 0) {
+        offset = (unsigned int)recordSkipFrames < numberOfSamples ? (unsigned int)recordSkipFrames : numberOfSamples;
+        recordSkipFrames -= offset;
+    }
+    unsigned int frames = numberOfSamples - offset;
+    if (stoppingRecording && frames > (unsigned int)recordTailFrames) {
+        frames = (unsigned int)recordTailFrames;
+    }
+    if (frames > 0) {
+        if (recordWithHistory) {
+            recordWithHistory = false;
+            unsigned int after = numberOfSamples - offset; // already in the history, this callback's part of the take
+            unsigned int available = captureHistory.getAvailable() - after;
+            unsigned int historyFrames = available < captureHistory.getCapacity() ? available : captureHistory.getCapacity();
+            unsigned long long from = captureHistory.getPosition() - after - historyFrames;
+            recorder->prependHistory(&captureHistory, from, historyFrames);
+            recordHistoryFrames = (int)historyFrames;
+        }
+        recorder->process(audioIO + offset * numberOfChannels, frames);
+    }
+
+    if (stoppingRecording) {
+        recordTailFrames -= frames;
+        if (recordTailFrames <= 0) {
+            recorder->stop();
+            recording = stoppingRecording = false;
+        }
+    }
+}
+
+// Feeds a punched take. Each input frame is placed on the transport where the output it answers
+// was played, roundTrip() frames earlier; only the frames that land in the punch region and its
+// fades are recorded.
+void AudioEngine::recordPunch(float *audioIO, unsigned int numberOfSamples) {
+    long long fade = (long long)sampleRate * PUNCH_FADE_MS / 1000;
+    long long fadeIn = recordPunchIn < fade ? recordPunchIn : fade;
+    long long takeStart = recordPunchIn - fadeIn;
+    long long takeEnd = recordPunchOut + fade;
+    unsigned int n = 0;
+    if (punchedIn && recordSkipFrames > 0) {
+        // Silence the IO played while it filled up, it answers no output.
+        n = (unsigned int)recordSkipFrames < numberOfSamples ? (unsigned int)recordSkipFrames : numberOfSamples;
+        recordSkipFrames -= n;
+    } else if (punchedIn && recordSkipFrames < 0) {
+        // Input the IO dropped: silence stands in for it, so the rest of the take stays in place.
+        long long missing = -recordSkipFrames;
+        if (missing > takeEnd - punchNextPosition) {
+            missing = takeEnd - punchNextPosition;
+        }
+        recordSilence((unsigned int)missing);
+        punchNextPosition += missing;
+        recordSkipFrames = 0;
+    } else {
+        recordSkipFrames = 0; // until punched in, each frame is placed with roundTrip() as it is
+    }
+    while (recording && n < numberOfSamples) {
+        long long outputFrame = (long long)(outputFrames + n) - roundTrip();
+        long long position = 0;
+        unsigned int frames = numberOfSamples - n;
+        bool played = outputFrame >= 0 && transportAt((unsigned long long)outputFrame, &position, &frames);
+        if (frames > numberOfSamples - n) {
+            frames = numberOfSamples - n;
+        }
+        if (punchedIn && (!played || position != punchNextPosition || position >= takeEnd)) {
+            finishPunch(); // punched out, or the transport stopped or jumped
+            break;
+        }
+        if (played && position + frames > takeStart && position < takeEnd) {
+            unsigned int skip = position < takeStart ? (unsigned int)(takeStart - position) : 0;
+            position += skip;
+            n += skip;
+            frames -= skip;
+            if (position + frames > takeEnd) {
+                frames = (unsigned int)(takeEnd - position);
+            }
+            const float *input = audioIO + n * numberOfChannels;
+            if (position >= recordPunchIn && position + frames <= recordPunchOut) {
+                recorder->process(input, frames);
+            } else {
+                // An edge: fade through a small buffer on the stack.
+                float faded[256 * 2];
+                for (unsigned int done = 0; done < frames;) {
+                    unsigned int chunk = frames - done < 256 ? frames - done : 256;
+                    for (unsigned int i = 0; i < chunk; i++) {
+                        long long sample = position + done + i;
+                        float gain = 1.f;
+                        if (sample < recordPunchIn) {
+                            gain = (sample - takeStart + 0.5f) / fadeIn;
+                        } else if (sample >= recordPunchOut) {
+                            gain = (takeEnd - sample - 0.5f) / fade;
+                        }
+                        for (int c = 0; c < numberOfChannels; c++) {
+                            faded[i * numberOfChannels + c] = input[(done + i) * numberOfChannels + c] * gain;
+                        }
+                    }
+                    recorder->process(faded, chunk);
+                    done += chunk;
+                }
+            }
+            punchedIn = true;
+            punchNextPosition = position + frames;
+            if (punchNextPosition >= takeEnd) {
+                finishPunch();
+            }
+        }
+        n += frames;
+    }
+
+    if (recording && stoppingRecording) {
+        recordTailFrames -= numberOfSamples;
+        if (recordTailFrames <= 0) {
+            finishPunch();
+        }
+    }
+}
+
+// Audio thread. Adds frames of silence to the take.
+void AudioEngine::recordSilence(unsigned int frames) {
+    static const float silence[256 * 2] = {0};
+    for (unsigned int done = 0; done < frames;) {
+        unsigned int chunk = frames - done < 256 ? frames - done : 256;
+        recorder->process(silence, chunk);
+        done += chunk;
+    }
+}
+
+void AudioEngine::finishPunch() {
+    recorder->stop();
+    recording = stoppingRecording = false;
+}
+
+// Audio thread. Remembers that the transport played frames samples from position on, starting at
+// outputFrame; extends the last segment when it simply carries on.
+void AudioEngine::logTransport(unsigned long long outputFrame, long long position, unsigned int frames) {
+    if (transportSegmentsCount > 0) {
+        TransportSegment &last = transportSegments[transportSegmentsLast];
+        if (last.outputFrame + last.frames == outputFrame && last.position + last.frames == position &&
+            last.frames <= 0x7fffffffu - frames) {
+            last.frames += frames;
+            return;
+        }
+    }
+    transportSegmentsLast = (transportSegmentsLast + 1) % TRANSPORT_SEGMENTS;
+    if (transportSegmentsCount < TRANSPORT_SEGMENTS) {
+        transportSegmentsCount++;
+    }
+    TransportSegment &segment = transportSegments[transportSegmentsLast];
+    segment.outputFrame = outputFrame;
+    segment.position = position;
+    segment.frames = frames;
+}
+
+// Audio thread. Where the transport was when outputFrame was played, and for how many frames it
+// then carried on. Returns false if the transport was not moving, with frames up to when it did.
+bool AudioEngine::transportAt(unsigned long long outputFrame, long long *position, unsigned int *frames) const {
+    unsigned long long next = outputFrame + *frames;
+    for (int i = 0; i < transportSegmentsCount; i++) {
+        const TransportSegment &segment = transportSegments[i];
+        if (segment.outputFrame <= outputFrame && outputFrame < segment.outputFrame + segment.frames) {
+            *position = segment.position + (long long)(outputFrame - segment.outputFrame);
+            *frames = (unsigned int)(segment.outputFrame + segment.frames - outputFrame);
+            return true;
+        }
+        if (segment.outputFrame > outputFrame && segment.outputFrame < next) {
+            next = segment.outputFrame;
+        }
+    }
+    *frames = (unsigned int)(next - outputFrame);
+    return false;
+}
+
+void AudioEngine::sendCommand(EngineCommandType type, int index, float value, long long position, long long end) {
+    EngineCommand command;
+    command.type = type;
+    command.index = index;
+    command.value = value;
+    command.position = position;
+    command.end = end;
+
+    pthread_mutex_lock(&commandMutex);
+    bool queued = commands.push(command);
+    pthread_mutex_unlock(&commandMutex);
+    if (!queued) {
+        LOGI("command queue full, dropped command %d", type);
+    }
+}
+
+// Called at the top of every callback, or through applySuspendedCommands().
+void AudioEngine::applyCommands() {
+    EngineCommand command;
+    while (commands.pop(command)) {
+        applyCommand(command);
+    }
+}
+
+// A control thread inside suspendAudio() drains the queue in place of the audio thread. Several
+// may be suspended at once: they take turns, so the queue keeps a single consumer.
+void AudioEngine::applySuspendedCommands() {
+    pthread_mutex_lock(&commandDrainMutex);
+    applyCommands();
+    pthread_mutex_unlock(&commandDrainMutex);
+}
+
+// Moves the transport and every player to the same sample, paused.
+void AudioEngine::seekPlayers(long long position) {
+    for (int i = 0; i < slotCount; i++) {
+        PlayerWrapper *track = trackAt(i);
+        if (track != NULL && track->attached) {
+            seekTrack(track, position, true);
+        }
+    }
+    transportPosition = position;
+}
+
+// Moves one track to a transport sample; a player gets the nearest millisecond.
+void AudioEngine::seekTrack(PlayerWrapper *track, long long sample, bool andStop) {
+    if (track->memory != NULL) {
+        track->memory->setPosition(sample, andStop);
+    } else {
+        track->player->setPosition(sample * 1000.0 / sampleRate, andStop, false);
+    }
+}
+
+long long AudioEngine::trackDuration(const PlayerWrapper *track) const {
+    if (track->memory != NULL) {
+        return track->memory->durationSamples;
+    }
+    return (long long)((double)track->player->durationMs * sampleRate / 1000.0);
+}
+
+// Arms the track's own seamless loop with the engine region, if the region fits inside the track.
+void AudioEngine::armTrackLoop(PlayerWrapper *track) {
+    if (loopEndSample <= loopStartSample) {
+        exitTrackLoop(track);
+        return;
+    }
+    if (track->memory != NULL) {
+        track->memory->loopBetween(loopStartSample, loopEndSample); // exits the loop if it doesn't fit
+        return;
+    }
+    SuperpoweredAdvancedAudioPlayer *player = track->player;
+    double startMs = loopStartSample * 1000.0 / sampleRate, endMs = loopEndSample * 1000.0 / sampleRate;
+    if (endMs <= player->durationMs) {
+        player->loopBetween(startMs, endMs, false, LOOP_CACHE_POINT_ID, false);
+    } else {
+        player->exitLoop();
+        player->cachePosition(startMs, LOOP_CACHE_POINT_ID);
+    }
+}
+
+// Called on the sample where the transport reaches the loop end. Players with the region armed
+// wrap by themselves on this same sample, without the fade-in a seek would add. The ones that are
+// shorter than the region stopped at their EOF and are restarted from the loop start.
+void AudioEngine::wrapLoop() {
+    for (int i = 0; i < slotCount; i++) {
+        PlayerWrapper *track = trackAt(i);
+        if (track != NULL && track->attached && !isTrackLooping(track)) {
+            seekTrack(track, loopStartSample, false);
+            playTrack(track);
+        }
+    }
+    transportPosition = loopStartSample;
+}
+
+void AudioEngine::pausePlayers() {
+    for (int i = 0; i < slotCount; i++) {
+        PlayerWrapper *track = trackAt(i);
+        if (track != NULL) {
+            pauseTrack(track);
+        }
+    }
+    playing = false;
+}
+
+void AudioEngine::applyCommand(const EngineCommand &command) {
+    switch (command.type) {
+        case ENGINE_COMMAND_PLAY:
+            for (int i = 0; i < slotCount; i++) {
+                PlayerWrapper *track = trackAt(i);
+                if (track != NULL && track->attached) {
+                    playTrack(track);
+                }
+            }
+            playing = true;
+            break;
+        case ENGINE_COMMAND_PAUSE:
+            pausePlayers();
+            break;
+        case ENGINE_COMMAND_SEEK:
+            seekPlayers(command.position);
+            break;
+        case ENGINE_COMMAND_SET_LOOP:
+            loopStartSample = command.position;
+            loopEndSample = command.end;
+            for (int i = 0; i < slotCount; i++) {
+                PlayerWrapper *track = trackAt(i);
+                if (track != NULL && track->attached) {
+                    armTrackLoop(track);
+                }
+            }
+            break;
+        case ENGINE_COMMAND_SET_PUNCH:
+            punchInSample = command.position > 0 ? command.position : 0;
+            punchOutSample = command.end;
+            break;
+        case ENGINE_COMMAND_SET_VOLUME:
+            if (command.index >= 0 && command.index < slotCount) {
+                PlayerWrapper *track = trackAt(command.index);
+                if (track != NULL) {
+                    track->volume = command.value;
+                }
+            }
+            break;
+        case ENGINE_COMMAND_SET_PAN:
+            if (command.index >= 0 && command.index < slotCount) {
+                PlayerWrapper *track = trackAt(command.index);
+                if (track != NULL) {
+                    track->pan = command.value;
+                }
+            }
+            break;
+        case ENGINE_COMMAND_SET_MASTER_BUS:
+            masterBus.setEnabled(command.index != 0);
+            break;
+        case ENGINE_COMMAND_START_RECORDING:
+            recording = recorder != NULL;
+            recordStarted = stoppingRecording = false;
+            recordWithHistory = command.value != 0;
+            recordPunchIn = punchInSample;
+            recordPunchOut = punchOutSample;
+            recordSkipFrames = recordPunchOut > recordPunchIn ? 0 : roundTrip();
+            punchedIn = false;
+            break;
+        case ENGINE_COMMAND_STOP_RECORDING:
+            if (recording && !stoppingRecording) {
+                pausePlayers();
+                recordTailFrames = roundTrip();
+                if (recordTailFrames > 0) {
+                    stoppingRecording = true; // the last played audio is still on its way in
+                } else {
+                    recorder->stop();
+                    recording = false;
+                }
+            }
+            break;
+        case ENGINE_COMMAND_MEASURE_LATENCY:
+            if (recording) {
+                notifyError(ERROR_LATENCY_CALIBRATION);
+            } else {
+                pausePlayers();
+                latencyCalibration.start();
+            }
+            break;
+    }
+}
+
+// Keeps the audio callback away from players and recorder until the matching resumeAudio(). Never
+// blocks the audio thread: it only waits here for a callback that is already running to finish.
+// Any thread may suspend, also from inside another suspension: the audio only resumes once every
+// suspendAudio() has been paired with its resumeAudio().
+void AudioEngine::suspendAudio() {
+    audioSuspended++;
+    while (inProcess) {
+        sched_yield();
+    }
+}
+
+void AudioEngine::resumeAudio() {
+    audioSuspended--;
+}
 
 void AudioEngine::onPlayerStateChangedPrepared(PlayerWrapper *playerWrapper, SuperpoweredAdvancedAudioPlayerEvent state) {
-    LOGI("player prepared: %d", playerWrapper->index);
     if (state == SuperpoweredAdvancedAudioPlayerEvent_LoadSuccess) {
+        LOGI("player prepared: %d", playerWrapper->index);
         pthread_mutex_lock(&mutex);
-        if (++preparedPlayersCount == playersCount) {
+        if (slots[playerWrapper->index].loading != playerWrapper) {
+            pthread_mutex_unlock(&mutex); // replaced or removed while loading, already retired
+            return;
+        }
+        publishTrack(playerWrapper);
+        if (!prepared && ++preparedPlayersCount >= playersCount) {
             prepared = true;
+            if (preparing) {
+                notifyTrackPrepared(playerWrapper->index, 1.f);
+                preparing = false;
+                prepareDeadline = 0;
+            }
+            PlayerWrapper *mainPlayer = mainTrack();
+            pthread_mutex_lock(&commandMutex);
+            bool loopRegion = loopRegionEnd > loopRegionStart;
+            pthread_mutex_unlock(&commandMutex);
+            if (loop && !loopRegion && mainPlayer != NULL) {
+                setLoopRegion(0, trackDuration(mainPlayer));
+            }
             // call onPreparedSuccess!
             notifyPlayersPrepared();
+        } else if (preparing) {
+            notifyTrackPrepared(playerWrapper->index, (float)preparedPlayersCount / playersCount);
         }
         pthread_mutex_unlock(&mutex);
     } else if (state == SuperpoweredAdvancedAudioPlayerEvent_LoadError) {
         LOGI("error player prepare: %d", playerWrapper->index);
-        notifyError(ERROR_PLAYER_PREPARE);
+        pthread_mutex_lock(&mutex);
+        bool current = slots[playerWrapper->index].loading == playerWrapper;
+        bool batch = current && preparing;
+        if (current) {
+            slots[playerWrapper->index].loading = NULL;
+            retireTrack(playerWrapper);
+        }
+        if (batch) {
+            abortPrepare(playerWrapper->index, ERROR_PLAYER_PREPARE); // fail fast
+        }
+        pthread_mutex_unlock(&mutex);
+        if (current && !batch) {
+            notifyError(ERROR_PLAYER_PREPARE);
+        }
     } else if (state == SuperpoweredAdvancedAudioPlayerEvent_EOF) {
-        if (!loop && recording && mainPlayerIndex == playerWrapper->index) {
-            stopRecording();
+        if (bouncing) {
+            return;
         }
-        if (loop && mainPlayerIndex == playerWrapper->index) {
-            startPlaying(true);
+        // EOF arrives from inside player->process() on the audio thread: apply the transport change
+        // directly instead of going through the command queue, and leave logging and the listener
+        // to the notifier thread. Looping is handled by the transport in render(), not here.
+        if (!loop && recording && mainPlayerIndex == playerWrapper->index) {
+            applyCommand(EngineCommand{ENGINE_COMMAND_STOP_RECORDING, 0, 0, 0, 0});
         }
-        LOGI("end of player: %d", playerWrapper->index);
         notifyPlayerEnded(playerWrapper->index);
     }
 }
 
 void AudioEngine::notifyPlayersPrepared() {
-    JNIEnv *env = getEnv();
-    if (env != NULL && g_jniCallbackInstance != NULL && jniMethodOnPlayersPrepared != NULL) {
-        env->CallVoidMethod(g_jniCallbackInstance, jniMethodOnPlayersPrepared);
-    }
-    detachAfterCallbackDone();
+    postEvent(ENGINE_EVENT_PLAYERS_PREPARED);
 }
 
 void AudioEngine::notifyError(int errorCode) {
-    JNIEnv *env = getEnv();
-    if (env != NULL && g_jniCallbackInstance != NULL && jniMethodOnError != NULL) {
-        env->CallVoidMethod(g_jniCallbackInstance, jniMethodOnError, errorCode);
-    }
-    detachAfterCallbackDone();
+    postEvent(ENGINE_EVENT_ERROR, errorCode);
 }
 
 void AudioEngine::notifyPlayerEnded(int index) {
-    JNIEnv *env = getEnv();
-    if (env != NULL && g_jniCallbackInstance != NULL && jniMethodOnPlayerEnded != NULL) {
-        env->CallVoidMethod(g_jniCallbackInstance, jniMethodOnPlayerEnded, index);
+    postEvent(ENGINE_EVENT_PLAYER_ENDED, index);
+}
+
+// Recorder writer thread.
+void AudioEngine::notifyRecordFinished(bool success) {
+    if (!success) {
+        postEvent(ENGINE_EVENT_ERROR, ERROR_RECORDER);
+    }
+    postEvent(ENGINE_EVENT_RECORD_FINISHED);
+}
+
+void AudioEngine::notifyBounceProgress(float progress) {
+    postEvent(ENGINE_EVENT_BOUNCE_PROGRESS, 0, progress);
+}
+
+void AudioEngine::notifyBounceFinished(bool success) {
+    postEvent(ENGINE_EVENT_BOUNCE_FINISHED, success ? 1 : 0);
+}
+
+void AudioEngine::notifyLatencyMeasured(int samples) {
+    postEvent(ENGINE_EVENT_LATENCY_MEASURED, samples);
+}
+
+void AudioEngine::notifyTrackPrepared(int index, float progress) {
+    postEvent(ENGINE_EVENT_TRACK_PREPARED, index, progress);
+}
+
+void AudioEngine::notifyPrepareFailed(int index, int errorCode) {
+    postEvent(ENGINE_EVENT_PREPARE_FAILED, index, (float)errorCode);
+}
+
+// Safe on any thread, including the audio thread: no locks, no allocation, no JNI.
+void AudioEngine::postEvent(EngineEventType type, int index, float value) {
+    EngineEvent event;
+    event.type = type;
+    event.index = index;
+    event.value = value;
+    if (events.push(event)) {
+        sem_post(&eventsAvailable);
+    }
+}
+
+void AudioEngine::deliverEvent(const EngineEvent &event) {
+    if (listener == NULL) {
+        return;
+    }
+    switch (event.type) {
+        case ENGINE_EVENT_PLAYERS_PREPARED:
+            listener->onPlayersPrepared();
+            break;
+        case ENGINE_EVENT_ERROR:
+            listener->onError(event.index);
+            break;
+        case ENGINE_EVENT_PLAYER_ENDED:
+            LOGI("end of player: %d", event.index);
+            listener->onPlayerEnded(event.index);
+            break;
+        case ENGINE_EVENT_RECORD_FINISHED:
+            listener->onRecordFinished();
+            break;
+        case ENGINE_EVENT_BOUNCE_PROGRESS:
+            listener->onBounceProgress(event.value);
+            break;
+        case ENGINE_EVENT_BOUNCE_FINISHED:
+            listener->onBounceFinished(event.index != 0);
+            break;
+        case ENGINE_EVENT_LATENCY_MEASURED:
+            LOGI("round-trip latency: %d samples", event.index);
+            listener->onLatencyMeasured(event.index);
+            break;
+        case ENGINE_EVENT_TRACK_PREPARED:
+            listener->onTrackPrepared(event.index, event.value);
+            break;
+        case ENGINE_EVENT_PREPARE_FAILED:
+            LOGI("prepare failed: track %d, error %d", event.index, (int)event.value);
+            listener->onPrepareFailed(event.index, (int)event.value);
+            break;
+    }
+}
+
+// Renders every track into its own buffer and sums them into buffer, ramping each track's gains
+// to its current volume and pan. Returns false if none of them produced audio.
+// Offline a player that is still playing but returns no audio is waiting for its decoder
+// thread, so the block is retried instead of rendering the gap as silence.
+bool AudioEngine::mixPlayers(float *buffer, unsigned int numberOfSamples, bool waitForDecoder, bool *mainPlayerHasAudio) {
+    int inputsCount = 0;
+    bool mainPlayerFound = false;
+    for (int i = 0; i < slotCount; i++) {
+        PlayerWrapper *track = trackAt(i);
+        if (track == NULL) {
+            continue;
+        }
+        if (!track->attached) {
+            attachTrack(track);
+        }
+        EffectChain *effects = track->effects.load(std::memory_order_acquire);
+        int channels = mixerChannels(track->memory != NULL ? track->memory->getChannels() : 2, effects != NULL);
+        bool playerHasAudio = false;
+        int waitedMs = 0;
+        while (true) {
+            if (processTrack(track, numberOfSamples, channels)) {
+                playerHasAudio = true;
+                break;
+            }
+            if (!waitForDecoder || !isTrackPlaying(track) || bounceCancelled || waitedMs++ >= BOUNCE_BUFFERING_TIMEOUT_MS) {
+                break;
+            }
+            usleep(1000);
+        }
+
+        bool trackHasAudio = playerHasAudio;
+        if (effects != NULL) {
+            trackHasAudio = effects->process(track->buffer, numberOfSamples, playerHasAudio);
+        }
+
+        float left, right;
+        trackGains(track, channels, &left, &right); // the law of the buffer mixed, so a chain doesn't change the level
+        if (trackHasAudio) {
+            MixerInput &input = mixerInputs[inputsCount++];
+            input.buffer = track->buffer;
+            input.channels = channels;
+            input.leftStart = track->gainLeft;
+            input.rightStart = track->gainRight;
+            input.leftEnd = left;
+            input.rightEnd = right;
+        }
+        track->gainLeft = left;
+        track->gainRight = right;
+
+        if (mainPlayerHasAudio != NULL && i == mainPlayerIndex) {
+            *mainPlayerHasAudio = playerHasAudio;
+            mainPlayerFound = true;
+        }
+    }
+    if (inputsCount > 0) {
+        mixStereo(mixerInputs, inputsCount, buffer, numberOfSamples);
+    }
+    if (mainPlayerHasAudio != NULL && !mainPlayerFound) {
+        *mainPlayerHasAudio = inputsCount > 0; // the main track was removed, follow whatever is playing
     }
-    detachAfterCallbackDone();
+    return inputsCount > 0;
 }
 
-void AudioEngine::notifyRecordFinished() {
-    JNIEnv *env = getEnv();
-    if (env != NULL && g_jniCallbackInstance != NULL && jniMethodOnRecordFinished != NULL) {
-        env->CallVoidMethod(g_jniCallbackInstance, jniMethodOnRecordFinished);
+// Constant power for a track mixed in mono, the balance law for one mixed in stereo; see panGains().
+void AudioEngine::trackGains(const PlayerWrapper *track, int channels, float *left, float *right) const {
+    panGains(track->volume, track->pan, channels, left, right);
+}
+
+void AudioEngine::cancelBounce() {
+    if (!bounceThreadRunning) {
+        return;
+    }
+    bounceCancelled = true;
+    pthread_join(bounceThread, NULL);
+    bounceThreadRunning = false;
+}
+
+void AudioEngine::startAudioSystem() {
+    if (audioSystem == NULL) {
+        LOGI("audio system NULL");
+        audioSystem =
+                new AudioIO(
+                        sampleRate,
+                        bufferSize,
+                        true,
+                        true,
+                        audioProcessing,
+                        this,
+                        INPUT_STREAM_TYPE,
+                        OUTPUT_STREAM_TYPE,
+                        bufferSize * IO_LATENCY_BUFFERS,
+                        bufferSize * IO_LATENCY_MIN_BUFFERS,
+                        bufferSize * IO_LATENCY_MAX_BUFFERS,
+                        numberOfChannels);
+    } else {
+        audioSystem.load()->start();
     }
-    detachAfterCallbackDone();
 }
 
 void AudioEngine::reset() {
     LOGI("reset called!");
+    cancelPrepare();
+    cancelBounce();
     if (audioSystem != NULL) {
-        audioSystem->stop();
+        audioSystem.load()->stop();
     }
+    suspendAudio();
+    applySuspendedCommands();
     initialized = false;
     prepared = false;
-    setPlay(false);
-    stopRecording();
-    playing = false;
-    recording = false;
-    // change or reset players
-    freePlayersMemory(players, this->preparedPlayersCount);
-    players = NULL;
+    if (recording) {
+        recorder->stop();
+        recording = stoppingRecording = false;
+    }
+    if (latencyCalibration.isRunning()) {
+        latencyCalibration.cancel();
+        notifyLatencyMeasured(-1);
+    }
+    pausePlayers();
+    transportPosition = 0;
+    loopStartSample = loopEndSample = 0;
+    loopRegionStart = loopRegionEnd = 0;
+    loop = false;
+    SuperpoweredCPU::setSustainedPerformanceMode(false);
+    // change or reset players, the table itself is kept for the next session
+    for (int i = 0; i < slotCount; i++) {
+        PlayerWrapper *track = slots[i].track.exchange(NULL);
+        if (track != NULL) {
+            parkTrack(track);
+        }
+        // Unlisted first, so a load finishing meanwhile doesn't publish it.
+        pthread_mutex_lock(&mutex);
+        PlayerWrapper *loading = slots[i].loading;
+        slots[i].loading = NULL;
+        pthread_mutex_unlock(&mutex);
+        if (loading != NULL) {
+            retireTrack(loading); // a player still opening is freed once its open thread has called back
+        }
+    }
+    tracksCount = 0;
 
     if (recorder != NULL) {
         delete recorder;
@@ -381,132 +1780,365 @@ void AudioEngine::reset() {
 
     playersCount = 0;
     preparedPlayersCount = 0;
-    playerIndexCounter = 0;
+    resumeAudio();
 }
 
-bool AudioEngine::isReady() {
-    if (!initialized) {
-        notifyError(ERROR_ENGINE_NOT_INITIALIZED);
-        return false;
+// Grows the track table to hold at least count tracks. Existing tracks keep their slot. A bounce
+// walks the table without the mutex, so one under way is cancelled before the table is replaced.
+void AudioEngine::ensureSlotCapacity(int count) {
+    if (count < TRACK_SLOT_CAPACITY) {
+        count = TRACK_SLOT_CAPACITY;
     }
-    if (!prepared) {
-        notifyError(ERROR_ENGINE_NOT_PREPARED);
-        return false;
+    if (count <= slotCount) {
+        return;
     }
-    return true;
+    cancelBounce();
+    TrackSlot *newSlots = new TrackSlot[count];
+    MixerInput *newMixerInputs = new MixerInput[count];
+    pthread_mutex_lock(&mutex);
+    suspendAudio();
+    for (int i = 0; i < count; i++) {
+        newSlots[i].track.store(i < slotCount ? slots[i].track.load() : NULL);
+        newSlots[i].loading = i < slotCount ? slots[i].loading : NULL;
+    }
+    TrackSlot *oldSlots = slots;
+    MixerInput *oldMixerInputs = mixerInputs;
+    slots = newSlots;
+    mixerInputs = newMixerInputs;
+    slotCount = count;
+    resumeAudio();
+    pthread_mutex_unlock(&mutex);
+    delete[] oldSlots;
+    delete[] oldMixerInputs;
 }
 
-// ------------------------------------ JNI ------------------------------------
+// Creates the track for slot index. A loaded one from the player cache or a mapped WAV is ready
+// at once and returned: the caller reports it loaded once the mutex is released. Anything else
+// gets a player that starts loading, and NULL is returned. Called with the mutex held.
+PlayerWrapper *AudioEngine::openTrack(int index, const char *path, int fileOffset, int fileSize) {
+    PlayerSource source;
+    bool cacheable = PlayerCache::describe(path, fileOffset, fileSize, &source);
+    PlayerWrapper *cached = cacheable ? playerCache.take(source) : NULL;
+    if (cached != NULL) {
+        PlayerCache::release(&source);
+        LOGI("player cache hit: %s", path);
+        cached->index = index;
+        cached->volume = 1.f;
+        cached->pan = 0.f;
+        cached->attached = false;
+        cached->gainLeft = cached->gainRight = 1.f;
+        delete cached->effects.exchange(NULL); // parked, so no callback is using it
+        slots[index].loading = cached;
+        return cached;
+    }
+
+    PlayerWrapper *playerWrapper = new PlayerWrapper();
+    playerWrapper->engine = this;
+    playerWrapper->index = index;
+    playerWrapper->source = source;
+    playerWrapper->buffer = (float *)memalign(16, (bufferSize + 16) * sizeof(float) * 2);
+    slots[index].loading = playerWrapper;
+
+    MemoryTrack *memory = new MemoryTrack(playerWrapper, playerEventCallback);
+    if (memory->open(path, fileOffset, fileSize, sampleRate)) {
+        LOGI("mapped %s", path);
+        playerWrapper->memory = memory;
+        return playerWrapper;
+    }
+    delete memory;
 
-static AudioEngine *sEngine = NULL;
+    playerWrapper->decoded = decodedAudio.acquire(playerWrapper->source);
+    if (playerWrapper->decoded != NULL) {
+        playerWrapper->loaderRunning =
+                pthread_create(&playerWrapper->loader, NULL, decodeTrackThreadFunction, playerWrapper) == 0;
+        if (playerWrapper->loaderRunning) {
+            return NULL;
+        }
+        decodedAudio.release(playerWrapper->decoded);
+        playerWrapper->decoded = NULL;
+    }
+    playerWrapper->player =
+            new SuperpoweredAdvancedAudioPlayer(playerWrapper,
+                                                playerEventCallback,
+                                                (unsigned int) sampleRate,
+                                                1); // the loop start point
+    playerWrapper->player->syncMode = SuperpoweredAdvancedAudioPlayerSyncMode_TempoAndBeat;
 
-extern "C"
-JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM* vm, void* reserved) {
-    LOGI("onLoad");
-    JNIEnv *env;
+    playerWrapper->opening = true;
+    playerWrapper->player->open(path, fileOffset, fileSize);
+    return NULL;
+}
 
-    javaVM = vm;
-    if (vm->GetEnv((void**)&env, JNI_VERSION_1_6) != JNI_OK) {
-        return JNI_ERR; // JNI version not supported.
+// Loader thread of a track that plays decoded audio. Reports it loaded like a player would.
+void AudioEngine::loadDecodedTrack(PlayerWrapper *track) {
+    bool success = decodedAudio.load(track->decoded);
+    if (success) {
+        track->memory = new MemoryTrack(track, playerEventCallback);
+        track->memory->openDecoded(track->decoded->samples, track->decoded->frames);
     }
+    onPlayerStateChangedPrepared(track, success ? SuperpoweredAdvancedAudioPlayerEvent_LoadSuccess
+                                                : SuperpoweredAdvancedAudioPlayerEvent_LoadError);
+}
 
-    return  JNI_VERSION_1_6;
+// Creates a track made of clips for slot index. Its sources are opened by a loader thread, which
+// reports the track loaded like a player would. Called with the mutex held.
+void AudioEngine::openClipTrack(int index, const Clip *clips, int count) {
+    PlayerWrapper *playerWrapper = new PlayerWrapper();
+    playerWrapper->engine = this;
+    playerWrapper->index = index;
+    playerWrapper->buffer = (float *)memalign(16, (bufferSize + 16) * sizeof(float) * 2);
+    playerWrapper->clips = new ClipTimeline(clips, count);
+    slots[index].loading = playerWrapper;
+    playerWrapper->loaderRunning =
+            pthread_create(&playerWrapper->loader, NULL, clipTrackThreadFunction, playerWrapper) == 0;
+    if (!playerWrapper->loaderRunning) {
+        slots[index].loading = NULL;
+        freeTrack(playerWrapper);
+        notifyError(ERROR_PLAYER_PREPARE);
+    }
 }
 
+// Loader thread of a track made of clips.
+void AudioEngine::loadClipTrack(PlayerWrapper *track) {
+    bool success = track->clips->load(&decodedAudio, sampleRate);
+    if (success) {
+        track->memory = new MemoryTrack(track, playerEventCallback);
+        track->memory->openClips(track->clips);
+    }
+    onPlayerStateChangedPrepared(track, success ? SuperpoweredAdvancedAudioPlayerEvent_LoadSuccess
+                                                : SuperpoweredAdvancedAudioPlayerEvent_LoadError);
+}
 
-extern "C"
-JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_AudioEngine__II(JNIEnv *javaEnvironment,
-                                                                             jobject self,
-                                                                             jint sampleRate,
-                                                                             jint bufferSize,
-                                                                             jboolean stereo) {
-    g_jniCallbackInstance = javaEnvironment->NewGlobalRef(self);
-    sEngine = new AudioEngine(sampleRate, bufferSize);
+// Keeps a loaded track of the ending session for the next one. Audio is suspended.
+void AudioEngine::parkTrack(PlayerWrapper *track) {
+    pauseTrack(track);
+    exitTrackLoop(track);
+    seekTrack(track, 0, true); // a player buffers the start again while it waits
+    pthread_mutex_lock(&mutex);
+    playerCache.park(track);
+    pthread_mutex_unlock(&mutex);
 }
 
-extern "C"
-JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_releaseNative(JNIEnv *javaEnvironment,
-                                                                           jobject self) {
-    if (NULL != sEngine) {
-        delete sEngine;
-        sEngine = NULL;
+// Hands a loaded track to the audio thread, retiring the one it replaces. Called with the mutex held.
+void AudioEngine::publishTrack(PlayerWrapper *track) {
+    slots[track->index].loading = NULL;
+    PlayerWrapper *playing = slots[track->index].track.load();
+    if (playing != NULL && track->effects.load() == NULL) {
+        // The same thread renders both, one buffer after the other, so the chain is never shared.
+        track->effects.store(playing->effects.exchange(NULL));
+    }
+    PlayerWrapper *previous = slots[track->index].track.exchange(track);
+    if (previous != NULL) {
+        retireTrack(previous);
+    } else {
+        tracksCount++;
     }
 }
 
-extern "C"
-JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_initNative__II(JNIEnv *javaEnvironment,
-                                                                            jobject self,
-                                                                            jint numberOfChannels,
-                                                                            jint playersCount,
-                                                                            jboolean loop,
-                                                                            jint mainPlayerIndex) {
-    sEngine->init(numberOfChannels, playersCount, loop, mainPlayerIndex);
+// The track is already unpublished. It is freed by the notifier thread once every callback
+// that might have picked it up has returned.
+void AudioEngine::retireTrack(PlayerWrapper *track) {
+    RetiredTrack retired;
+    retired.track = track;
+    retired.effects = NULL;
+    retired.processCount = processCount;
+    retire(retired);
 }
 
-extern "C"
-JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_preparePlayer__Ljava_lang_String_2II(JNIEnv *javaEnvironment,
-                                                                                                  jobject self,
-                                                                                                  jstring path,
-                                                                                                  jint fileOffset,
-                                                                                                  jint fileSize) {
-    const char *pathC = javaEnvironment->GetStringUTFChars(path, JNI_FALSE);
-    LOGI("initPlayer: %s | %i | %i", pathC, fileOffset, fileSize);
-    sEngine->preparePlayer(pathC, fileOffset, fileSize);
-    javaEnvironment->ReleaseStringUTFChars(path, pathC);
+// The chain was swapped out of a track, it is freed like a retired track. Called with the mutex held.
+void AudioEngine::retireEffects(EffectChain *effects) {
+    if (effects == NULL) {
+        return;
+    }
+    RetiredTrack retired;
+    retired.track = NULL;
+    retired.effects = effects;
+    retired.processCount = processCount;
+    retire(retired);
 }
 
-extern "C"
-JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_startPlayingNative(JNIEnv *javaEnvironment,
-                                                                                jobject self,
-                                                                                jboolean fromBeginning) {
-    sEngine->startPlaying(fromBeginning);
+// Hands a retirement to the notifier thread. Never frees anything itself: a callback, a bounce
+// or the open thread of a player may still be using it. With too many retirements in flight for
+// the queue it goes on the heap, still for the notifier to free.
+void AudioEngine::retire(const RetiredTrack &retired) {
+    if (!retiredTracks.push(retired)) {
+        RetiredTrackNode *node = new RetiredTrackNode;
+        node->retired = retired;
+        node->next = retiredOverflow.load();
+        while (!retiredOverflow.compare_exchange_weak(node->next, node)) {
+        }
+    }
+    sem_post(&eventsAvailable);
 }
 
-extern "C"
-JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_setPlayNative(JNIEnv *javaEnvironment,
-                                                                           jobject self,
-                                                                           jboolean shouldPlay) {
-    sEngine->setPlay(shouldPlay);
+// Notifier thread only. A retired track is unused once a callback has finished since it was
+// unpublished, or when no callback is running at all, and no bounce is rendering. A player
+// retired while still opening is kept until its open thread has called back.
+void AudioEngine::reclaimTracks(bool force) {
+    RetiredTrack retired;
+    while (retiredTracks.pop(retired)) {
+        if (pendingReclaimCount < RETIRED_TRACKS_CAPACITY) {
+            pendingReclaim[pendingReclaimCount++] = retired;
+        } else {
+            RetiredTrackNode *node = new RetiredTrackNode; // the queue's room is for new retirements
+            node->retired = retired;
+            node->next = pendingOverflow;
+            pendingOverflow = node;
+        }
+    }
+    RetiredTrackNode *overflow = retiredOverflow.exchange(NULL);
+    while (overflow != NULL) {
+        RetiredTrackNode *next = overflow->next;
+        overflow->next = pendingOverflow;
+        pendingOverflow = overflow;
+        overflow = next;
+    }
+    bool idle = !bouncing && !inProcess;
+    int kept = 0;
+    for (int i = 0; i < pendingReclaimCount; i++) {
+        if (!reclaim(pendingReclaim[i], force, idle)) {
+            pendingReclaim[kept++] = pendingReclaim[i];
+        }
+    }
+    pendingReclaimCount = kept;
+    for (RetiredTrackNode **node = &pendingOverflow; *node != NULL;) {
+        if (reclaim((*node)->retired, force, idle)) {
+            RetiredTrackNode *reclaimed = *node;
+            *node = reclaimed->next;
+            delete reclaimed;
+        } else {
+            node = &(*node)->next;
+        }
+    }
 }
 
-extern "C"
-JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_startRecordingNative(JNIEnv *javaEnvironment,
-                                                                                  jobject self,
-                                                                                  jstring tempPath,
-                                                                                  jstring path) {
-    const char *tempPathC = javaEnvironment->GetStringUTFChars(tempPath, JNI_FALSE);
-    const char *destinationPathC = javaEnvironment->GetStringUTFChars(path, JNI_FALSE);
+// Notifier thread only. Frees a retired track or chain if nothing uses it any more.
+bool AudioEngine::reclaim(const RetiredTrack &retired, bool force, bool idle) {
+    PlayerWrapper *track = retired.track;
+    if (force) {
+        while (track != NULL && track->opening) {
+            usleep(1000);
+        }
+    }
+    bool opening = track != NULL && track->opening;
+    bool unused = !bouncing && (idle || processCount != retired.processCount) && !opening;
+    if (!force && !unused) {
+        return false;
+    }
+    if (track == NULL) {
+        delete retired.effects;
+    } else {
+        freeTrack(track);
+    }
+    return true;
+}
 
-    sEngine->startRecording(tempPathC, destinationPathC);
+// The track a control thread sees in slot index: the one loading, else the one playing. Called with the mutex held.
+PlayerWrapper *AudioEngine::slotTrack(int index) const {
+    return slots[index].loading != NULL ? slots[index].loading : slots[index].track.load();
+}
 
-    javaEnvironment->ReleaseStringUTFChars(tempPath, tempPathC);
-    javaEnvironment->ReleaseStringUTFChars(path, destinationPathC);
+// The chain of the track in slot index, as setTrackEffects() placed it. Called with the mutex held.
+EffectChain *AudioEngine::slotEffects(int index) const {
+    if (index < 0 || index >= slotCount) {
+        return NULL;
+    }
+    PlayerWrapper *track = slots[index].track.load();
+    if (track == NULL) {
+        track = slots[index].loading;
+    }
+    return track != NULL ? track->effects.load() : NULL;
 }
 
-extern "C"
-JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_stopRecordingNative(JNIEnv *javaEnvironment,
-                                                                                 jobject self) {
-    sEngine->stopRecording();
+PlayerWrapper *AudioEngine::trackAt(int index) const {
+    return slots[index].track.load(); // sequentially consistent, pairs with the inProcess flag
 }
 
-extern "C"
-JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_resetNative(JNIEnv *javaEnvironment,
-                                                                         jobject self) {
-    sEngine->reset();
+PlayerWrapper *AudioEngine::mainTrack() const {
+    if (mainPlayerIndex >= 0 && mainPlayerIndex < slotCount && trackAt(mainPlayerIndex) != NULL) {
+        return trackAt(mainPlayerIndex);
+    }
+    for (int i = 0; i < slotCount; i++) {
+        if (trackAt(i) != NULL) {
+            return trackAt(i);
+        }
+    }
+    return NULL;
+}
+
+// Puts a newly published track on the transport, on the thread that renders it.
+void AudioEngine::attachTrack(PlayerWrapper *track) {
+    seekTrack(track, transportPosition, !playing);
+    if (playing) {
+        playTrack(track);
+    }
+    armTrackLoop(track);
+    trackGains(track, trackChannels(track), &track->gainLeft, &track->gainRight);
+    track->attached = true;
+}
+
+// Ends the batch: the tracks still loading are dropped and the failure is reported. Called with
+// the mutex held; the prepare threads stop on their own.
+void AudioEngine::abortPrepare(int index, int errorCode) {
+    if (!preparing) {
+        return;
+    }
+    preparing = false;
+    prepareCancelled = true;
+    prepareDeadline = 0;
+    for (int i = 0; i < slotCount; i++) {
+        if (slots[i].loading != NULL) {
+            retireTrack(slots[i].loading);
+            slots[i].loading = NULL;
+        }
+    }
+    notifyPrepareFailed(index, errorCode);
 }
 
-extern "C"
-JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_initNative(JNIEnv *javaEnvironment,
-                                                                        jobject self,
-                                                                        int numberOfChannels,
-                                                                        int playersCount,
-                                                                        jboolean loop,
-                                                                        int mainPlayerIndex) {
-    sEngine->init(numberOfChannels, playersCount, loop, mainPlayerIndex);
+// Notifier thread. Fails the batch on the first track still loading once its deadline passed.
+void AudioEngine::checkPrepareDeadline() {
+    long long deadline = prepareDeadline;
+    if (deadline == 0 || monotonicNanoseconds() < deadline) {
+        return;
+    }
+    pthread_mutex_lock(&mutex);
+    int index = -1;
+    for (int i = 0; i < playersCount && i < slotCount; i++) {
+        if (trackAt(i) == NULL) {
+            index = i;
+            break;
+        }
+    }
+    abortPrepare(index, ERROR_PREPARE_TIMEOUT);
+    pthread_mutex_unlock(&mutex);
 }
 
-extern "C"
-JNIEXPORT jboolean Java_com_delicacyset_superpowered_AudioEngine_isPrepared(JNIEnv *javaEnvironment,
-                                                                            jobject self) {
-    return (jboolean) sEngine->isPrepared();
+void AudioEngine::joinPrepareThreads() {
+    for (int i = 0; i < prepareThreadsCount; i++) {
+        pthread_join(prepareThreads[i], NULL);
+    }
+    prepareThreadsCount = 0;
+    if (preparePaths != NULL) {
+        for (int i = 0; i < prepareCount; i++) {
+            free(preparePaths[i]);
+        }
+    }
+    free(preparePaths);
+    free(prepareOffsets);
+    free(prepareSizes);
+    preparePaths = NULL;
+    prepareOffsets = prepareSizes = NULL;
+    prepareCount = 0;
+}
+
+bool AudioEngine::isReady() {
+    if (!initialized) {
+        notifyError(ERROR_ENGINE_NOT_INITIALIZED);
+        return false;
+    }
+    if (!prepared) {
+        notifyError(ERROR_ENGINE_NOT_PREPARED);
+        return false;
+    }
+    return true;
 }
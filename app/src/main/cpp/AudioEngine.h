@@ -5,63 +5,463 @@
 #ifndef AUDIO_AUDIORECORDER_H
 #define AUDIO_AUDIORECORDER_H
 
-#include <jni.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <atomic>
 
 #include "SuperpoweredAdvancedAudioPlayer.h"
-#include <AndroidIO/SuperpoweredAndroidAudioIO.h>
 #include "SuperpoweredRecorder.h"
+#include "SpscQueue.h"
+#include "MpscQueue.h"
+#include "Mixer.h"
+#include "CallbackStats.h"
+#include "LatencyCalibration.h"
+#include "StreamingRecorder.h"
+#include "CaptureHistory.h"
+#include "PlayerCache.h"
+#include "MemoryTrack.h"
+#include "DecodedAudioCache.h"
+#include "ClipTimeline.h"
+#include "SessionFile.h"
+#include "MasterBus.h"
+#include "EffectChain.h"
+
+#ifdef __ANDROID__
+#include <AndroidIO/SuperpoweredAndroidAudioIO.h>
+typedef SuperpoweredAndroidAudioIO AudioIO;
+#else
+#include "HostAudioIO.h"
+typedef HostAudioIO AudioIO;
+#endif
 
-#define MAX_PLAYERS_COUNT 5
+// Tracks the slot table holds at least; init() grows it for larger sessions.
+#define TRACK_SLOT_CAPACITY 64
 
 #define ERROR_GENERIC 0
 #define ERROR_PLAYER_PREPARE 1
 #define ERROR_ENGINE_NOT_INITIALIZED 2
 #define ERROR_ENGINE_NOT_PREPARED 3
+#define ERROR_BOUNCE 4
+#define ERROR_NO_FREE_TRACK_SLOT 5
+#define ERROR_LATENCY_CALIBRATION 6
+#define ERROR_RECORDER 7
+#define ERROR_PREPARE_TIMEOUT 8
+#define ERROR_PREPARE_CANCELLED 9
+#define ERROR_SESSION 10
+
+#define COMMAND_QUEUE_CAPACITY 256
+#define LOOP_CACHE_POINT_ID 0
+#define EVENT_QUEUE_CAPACITY 256
+#define RETIRED_TRACKS_CAPACITY 128
+// Threads opening the tracks of a prepareTracks() batch.
+#define PREPARE_THREADS 4
+// Length of the fades at the edges of a punched take.
+#define PUNCH_FADE_MS 5
+// Stretches of transport the engine remembers having played, to place the input on the timeline.
+#define TRANSPORT_SEGMENTS 64
+// Buffers of input the IO holds to ride out callback jitter: it starts at IO_LATENCY_BUFFERS
+// and adapts between the bounds.
+#define IO_LATENCY_BUFFERS 2
+#define IO_LATENCY_MIN_BUFFERS 1
+#define IO_LATENCY_MAX_BUFFERS 8
+
+class AudioEngine;
 
 struct PlayerWrapper {
     SuperpoweredAdvancedAudioPlayer *player = NULL;
+    MemoryTrack *memory = NULL; // plays the track instead of player for WAVs it maps and decoded audio
+    DecodedAudio *decoded = NULL; // a reference held while the track plays decoded audio
+    ClipTimeline *clips = NULL;   // what memory plays for a track made of clips
+    pthread_t loader;             // decodes the track before it is published
+    bool loaderRunning = false;
+    std::atomic<bool> opening{false}; // the player's open thread has yet to call back
+    AudioEngine *engine = NULL;
+    float *buffer = NULL;  // the player renders here before the tracks are summed
     int index;
     float volume = 1.f;
+    float pan = 0.f;       // -1 left to 1 right
+    bool attached = false; // positioned on the transport, owned by the thread that renders
+    float gainLeft = 1.f;  // gains the last block ended on, owned by the thread that renders
+    float gainRight = 1.f;
+    PlayerSource source;   // what the player was opened from, for the player cache
+    std::atomic<EffectChain *> effects{NULL}; // inserts run on buffer, they move to a track replacing this one
+    void *analysis = NULL; // opaque data the app keeps with the track, saved with the session
+    unsigned int analysisSize = 0;
+};
+
+/**
+ * One entry of the engine's track table. A track is opened into `loading` and
+ * published to `track` once its player has loaded; the audio thread only ever
+ * reads `track`. Replaced and removed tracks are retired, and freed on the
+ * notifier thread once no callback can still be using them.
+ */
+struct TrackSlot {
+    std::atomic<PlayerWrapper *> track;
+    PlayerWrapper *loading; // guarded by the engine mutex
+};
+
+struct RetiredTrack {
+    PlayerWrapper *track;      // or NULL when only an effect chain was replaced
+    EffectChain *effects;
+    unsigned int processCount; // engine callback count when the track was unpublished
+};
+
+// A retirement the queue had no room for, handed to the notifier on the heap instead.
+struct RetiredTrackNode {
+    RetiredTrack retired;
+    RetiredTrackNode *next;
+};
+
+// Transport samples played from one output frame on, without a wrap or a seek in between.
+struct TransportSegment {
+    unsigned long long outputFrame;
+    long long position;
+    unsigned int frames;
+};
+
+/**
+ * Transport and parameter changes requested from control threads. They are
+ * queued by sendCommand() and applied on the audio thread at the top of
+ * process(), so players are only ever touched at a buffer boundary.
+ */
+enum EngineCommandType {
+    ENGINE_COMMAND_PLAY,
+    ENGINE_COMMAND_PAUSE,
+    ENGINE_COMMAND_SEEK,            // position: transport sample, every player
+    ENGINE_COMMAND_SET_LOOP,        // position, end: loop region in transport samples, empty to disable
+    ENGINE_COMMAND_SET_PUNCH,       // position, end: punch region in transport samples, empty to disable
+    ENGINE_COMMAND_SET_VOLUME,      // index: player, value: volume
+    ENGINE_COMMAND_SET_PAN,         // index: player, value: pan from -1 to 1
+    ENGINE_COMMAND_SET_MASTER_BUS,  // index: enabled
+    ENGINE_COMMAND_START_RECORDING,
+    ENGINE_COMMAND_STOP_RECORDING,
+    ENGINE_COMMAND_MEASURE_LATENCY,
+};
+
+struct EngineCommand {
+    EngineCommandType type;
+    int index;
+    float value;
+    long long position;
+    long long end;
+};
+
+/**
+ * Notifications raised on the audio, player, recorder or bounce threads. They
+ * are queued by postEvent() and handed to the listener on the engine's
+ * notifier thread, so none of those threads ever calls into the listener (and
+ * through it, the JVM).
+ */
+enum EngineEventType {
+    ENGINE_EVENT_PLAYERS_PREPARED,
+    ENGINE_EVENT_ERROR,             // index: error code
+    ENGINE_EVENT_PLAYER_ENDED,      // index: player
+    ENGINE_EVENT_RECORD_FINISHED,
+    ENGINE_EVENT_BOUNCE_PROGRESS,   // value: progress from 0 to 1
+    ENGINE_EVENT_BOUNCE_FINISHED,   // index: success
+    ENGINE_EVENT_LATENCY_MEASURED,  // index: round trip in samples, -1 on failure
+    ENGINE_EVENT_TRACK_PREPARED,    // index: track, value: part of the session prepared, from 0 to 1
+    ENGINE_EVENT_PREPARE_FAILED,    // index: track, -1 if none in particular, value: error code
+};
+
+struct EngineEvent {
+    EngineEventType type;
+    int index;
+    float value;
+};
+
+/**
+ * Receives engine notifications. On Android this is the JNI bridge to the
+ * Java AudioEngine, the host driver implements it directly. Every method is
+ * called on the engine's notifier thread.
+ */
+class AudioEngineListener {
+public:
+    virtual ~AudioEngineListener() {}
+
+    virtual void onNotifierThreadStarted() {}
+    virtual void onNotifierThreadStopped() {}
+
+    virtual void onPlayersPrepared() = 0;
+    virtual void onError(int errorCode) = 0;
+    virtual void onPlayerEnded(int index) = 0;
+    virtual void onRecordFinished() = 0;
+    virtual void onBounceProgress(float progress) = 0;
+    virtual void onBounceFinished(bool success) = 0;
+    virtual void onLatencyMeasured(int samples) = 0;
+    virtual void onTrackPrepared(int index, float progress) = 0;
+    virtual void onPrepareFailed(int index, int errorCode) = 0;
 };
 
 class AudioEngine {
 public:
 
-    AudioEngine(int sampleRate, int bufferSize);
+    AudioEngine(int sampleRate, int bufferSize, AudioEngineListener *listener);
 
     virtual ~AudioEngine();
 
+    // numberOfChannels 1 records mono from a mono input, 2 stereo. Changing it reopens the input:
+    // call with audio stopped.
     void init(int numberOfChannels, int playersCount, bool loop, int mainPlayerIndex);
 
     void preparePlayer(const char *path, int fileOffset, int fileSize);
 
-    void startRecording(const char *tempPath, const char *destinationPath);
+    /**
+     * Opens a whole session at once, track i into slot i, on PREPARE_THREADS
+     * threads; call after init(). Returns without waiting. Each loaded track is
+     * reported to onTrackPrepared(), then the session to onPlayersPrepared().
+     * The first track that fails to load, a deadline passing (timeoutMs, 0 for
+     * none) or cancelPrepare() abandons the tracks still loading and reports
+     * onPrepareFailed() once, with the track concerned.
+     */
+    void prepareTracks(const char *const *paths, const int *fileOffsets, const int *fileSizes, int count, int timeoutMs);
+
+    void cancelPrepare();
+
+    /**
+     * Opens a track into the first free slot and returns the slot index, or -1
+     * if the table is full. The track joins playback, on the transport
+     * position, once it has loaded. Safe while audio is running.
+     */
+    int addTrack(const char *path, int fileOffset, int fileSize);
+
+    /**
+     * Opens a new track for slot index. The running track keeps playing until
+     * the new one has loaded, then both are swapped within one buffer.
+     */
+    int replaceTrack(int index, const char *path, int fileOffset, int fileSize);
+
+    /**
+     * Plays slot index from clips of other files instead of one file, for
+     * comping takes without rendering them: overlapping clips are mixed, so
+     * their fades crossfade. The sources play from memory, so they must be
+     * 16-bit, 24-bit or float WAVs at the engine sample rate, like the takes,
+     * or short enough to be decoded whole (see setDecodedAudioBudget());
+     * otherwise the track fails to load with ERROR_PLAYER_PREPARE. Like replaceTrack(), the running track plays
+     * on until the clips are open, so moving a boundary is gapless. index -1
+     * takes a free slot. Returns the slot, or -1.
+     */
+    int setTrackClips(int index, const Clip *clips, int count);
+
+    void removeTrack(int index);
+
+    /**
+     * Runs the track in slot index through count insert effects, in order,
+     * before it is mixed. The chain is built here, on the calling thread,
+     * and swapped in between two buffers; the previous one is freed once the
+     * audio thread is done with it. It stays with the slot when the track is
+     * replaced. No effects removes the chain. Returns false if the slot is
+     * empty.
+     */
+    bool setTrackEffects(int index, const Effect *effects, int count);
+
+    // Changes one parameter of an effect of the track's chain, see EffectType. Safe while audio is running.
+    void setTrackEffectParameter(int index, int effect, int parameter, float value);
+
+    // Bypasses an effect of the track's chain, or puts it back. A bypassed effect costs nothing.
+    void setTrackEffectEnabled(int index, int effect, bool enabled);
+
+    /**
+     * Replaces the session with the one saved at path: its tracks, clips,
+     * volumes, pans, loop, main track and record latency. Tracks open like
+     * prepareTracks() would, without the batch's deadline, and the session is
+     * reported to onPlayersPrepared(). Returns false, and reports
+     * ERROR_SESSION, if the file is damaged or saved at another sample rate;
+     * the running session is kept then.
+     */
+    bool loadSession(const char *path);
+
+    /**
+     * Saves the tracks as they are, loaded or still loading, to path in one
+     * write. Returns false if it can't be written; an earlier file at path is
+     * kept then.
+     */
+    bool saveSession(const char *path);
+
+    /**
+     * Keeps size bytes of data with the track in slot index, e.g. a waveform
+     * overview, so it is saved with the session instead of computed again.
+     * They stay with the track when it is parked for the next session.
+     */
+    bool setTrackAnalysis(int index, const void *data, unsigned int size);
+
+    /**
+     * Copies up to capacity bytes of the track's data to buffer. Returns its
+     * whole size, 0 if it has none, -1 if the slot is empty.
+     */
+    int getTrackAnalysis(int index, void *buffer, unsigned int capacity);
+
+    /**
+     * Records the input straight into destinationPath while the players play.
+     * tempPath is no longer used and only kept for existing callers. With
+     * withHistory the take starts with up to CAPTURE_HISTORY_SECONDS of the
+     * input heard before recording started; see getRecordHistoryFrames().
+     */
+    void startRecording(const char *tempPath, const char *destinationPath, bool withHistory = false);
     void stopRecording();
 
+    /**
+     * Limits the takes started from now on to the transport between
+     * punchInSample (inclusive) and punchOutSample (exclusive), in samples of
+     * the session timeline. Recording engages and disengages on those samples
+     * inside process(), after the round trip is taken out. The take also holds
+     * PUNCH_FADE_MS of input on either side, faded in and out, to crossfade
+     * with what it replaces: it starts that much before punchInSample, or at
+     * 0. It is finished at the punch out, or when the transport stops or jumps
+     * on the way. History is not prepended to punched takes. An empty region
+     * records freely again.
+     */
+    void setPunchRegion(long long punchInSample, long long punchOutSample);
+
     void startPlaying(bool fromBeginning);
 
     void setPlay(bool shouldPlay);
 
-    bool process(short int *audioIO, unsigned int numberOfSamples);
+    void setPlayerVolume(int index, float volume);
+
+    /**
+     * Balances the track between the left (-1) and right (1) channel; a mono
+     * track is panned at constant power, 3 dB down in the centre. Volume and
+     * pan changes are ramped over one buffer.
+     */
+    void setPlayerPan(int index, float pan);
+
+    /**
+     * Loops the transport between startSample (inclusive) and endSample (exclusive).
+     * Every player wraps on the same sample inside process(). An empty region
+     * turns looping off. With init(..., loop = true, ...) the region defaults to
+     * the whole main player once the session is prepared, unless one was set.
+     */
+    void setLoopRegion(long long startSample, long long endSample);
+
+    /**
+     * Runs the mix through a limiter and a soft clipper before it leaves
+     * the engine, so loud tracks summed together don't hard-clip;
+     * see MasterBus. Applies to playback and bounces. It delays the output by
+     * MASTER_BUS_LATENCY frames, which takes and bounces are compensated for.
+     * Off by default.
+     */
+    void setMasterBus(bool enabled);
+
+    /**
+     * Files up to DECODED_AUDIO_MAX_SECONDS long are decoded whole when they
+     * are prepared and play from RAM, shared by every track of the same file,
+     * while the decoded audio fits in this many bytes; the rest stream. 0
+     * streams every file. Applies to tracks opened from now on.
+     */
+    void setDecodedAudioBudget(long long bytes);
+
+    /**
+     * Sample format of the takes started from now on, one of
+     * RECORDER_FORMAT_*: 16-bit by default, or 24-bit or 32-bit float, which
+     * keep the input as it came from the device. Takes of every format play
+     * and comp from memory without decoding them, see setTrackClips().
+     */
+    void setRecordingFormat(int format);
+
+    bool process(float *audioIO, unsigned int numberOfSamples);
+
+    /**
+     * Callback timing and IO dropout counters. Any thread, never blocks the
+     * audio thread.
+     */
+    void getStats(AudioEngineStats *stats);
+
+    /**
+     * Plays a few clicks and listens for them on the input to measure the
+     * round-trip latency; needs the speaker within reach of the mic, or a
+     * loopback cable. The players are paused meanwhile. The result is reported
+     * to onLatencyMeasured() and used from the next take on.
+     */
+    void measureLatency();
+
+    /**
+     * Round trip, in samples, by which takes are shifted to line up with the
+     * players: the first samples of each take are dropped and as many are
+     * recorded after stopRecording(). Lets an app restore a value measured
+     * earlier instead of calibrating every session.
+     *
+     * The value holds for the IO latency at the time it is set or measured;
+     * as the IO latency changes, takes follow it.
+     */
+    void setRecordLatency(int samples);
+    int getRecordLatency() const;
+
+    /**
+     * Samples of input the audio IO currently holds back to ride out callback
+     * jitter. It grows by a buffer after a dropout and shrinks when the device
+     * turns out steadier, see IO_LATENCY_BUFFERS.
+     */
+    int getIoLatency() const;
+
+    /**
+     * Frames of history the last take started with. The take lines up with the
+     * players from that frame on. Known once the first frame was recorded.
+     */
+    int getRecordHistoryFrames() const;
+
+    /**
+     * Renders the prepared session to a 16-bit WAV file on a background thread,
+     * as fast as the players can decode. Progress and completion are reported
+     * through the listener. Live playback is paused while bouncing.
+     */
+    bool bounce(const char *destinationPath);
+
+    void renderOffline();
+
+    void runNotifier();
 
     void onPlayerStateChangedPrepared(PlayerWrapper *playerWrapper, SuperpoweredAdvancedAudioPlayerEvent state);
 
+    void loadDecodedTrack(PlayerWrapper *track);
+    void loadClipTrack(PlayerWrapper *track);
+
+    void runPrepareWorker();
+
+    /**
+     * Ends the session. Loaded players are parked rather than freed: the next
+     * session opening the same unchanged file gets its player back, loaded.
+     */
     void reset();
 
     bool isPrepared() const;
 
-    void notifyRecordFinished();
+    bool isBouncing() const;
+
+    void notifyRecordFinished(bool success);
 
 
 private:
 
     pthread_mutex_t mutex;
-    SuperpoweredAndroidAudioIO *audioSystem = NULL;
-    PlayerWrapper **players = NULL;
-    SuperpoweredRecorder *recorder = NULL;
+    pthread_mutex_t commandMutex; // serializes command producers, never taken by the audio thread
+    pthread_mutex_t commandDrainMutex; // serializes control threads draining the commands, neither
+    SpscQueue<EngineCommand, COMMAND_QUEUE_CAPACITY> commands;
+    std::atomic<int> audioSuspended;        // depth of suspendAudio() calls not resumed yet
+    std::atomic<bool> inProcess;
+    CallbackStats callbackStats;
+    MpscQueue<EngineEvent, EVENT_QUEUE_CAPACITY> events;
+    sem_t eventsAvailable;
+    pthread_t notifierThread;
+    std::atomic<bool> notifierRunning;
+    AudioEngineListener *listener;
+    std::atomic<AudioIO *> audioSystem{NULL};
+    TrackSlot *slots = NULL;
+    int slotCount = 0;
+    MixerInput *mixerInputs = NULL; // one per slot, used by the thread that renders
+    std::atomic<int> tracksCount;            // published tracks
+    std::atomic<unsigned int> processCount;  // finished callbacks, lets the notifier tell when a retired track is unused
+    MpscQueue<RetiredTrack, RETIRED_TRACKS_CAPACITY> retiredTracks;
+    RetiredTrack pendingReclaim[RETIRED_TRACKS_CAPACITY]; // owned by the notifier thread
+    int pendingReclaimCount = 0;
+    std::atomic<RetiredTrackNode *> retiredOverflow{NULL}; // pushed by any control thread, newest first
+    RetiredTrackNode *pendingOverflow = NULL;                // owned by the notifier thread
+    DecodedAudioCache decodedAudio;
+    PlayerCache playerCache;      // guarded by the mutex
+    StreamingRecorder *recorder = NULL;
+    MasterBus masterBus;          // owned by the thread that renders
     float *stereoBufferPlayback = NULL;
-    float *stereoBufferRecording = NULL;
+    float *stereoBufferBounce = NULL;
     int sampleRate, bufferSize;
 
     bool initialized = false;
@@ -70,10 +470,61 @@ private:
     bool playing = false;
     int playersCount = 0;
     int preparedPlayersCount = 0;
-    int playerIndexCounter = 0;
     int numberOfChannels = 2;
+    int recordingFormat = RECORDER_FORMAT_PCM16; // for the next take
     int mainPlayerIndex = 0;
-    bool loop;
+    bool loop = false;
+    long long loopRegionStart = 0; // as last set by setLoopRegion(), for saving
+    long long loopRegionEnd = 0;
+
+    // Batch preparation, see prepareTracks().
+    bool preparing = false;                  // guarded by the mutex
+    std::atomic<bool> prepareCancelled;
+    std::atomic<long long> prepareDeadline;  // CLOCK_MONOTONIC nanoseconds, 0 for none
+    std::atomic<int> prepareNext;
+    int prepareCount = 0;
+    char **preparePaths = NULL;
+    int *prepareOffsets = NULL;
+    int *prepareSizes = NULL;
+    pthread_t prepareThreads[PREPARE_THREADS];
+    int prepareThreadsCount = 0;
+
+    // Transport clock, in samples from the session start. Owned by the audio thread.
+    long long transportPosition = 0;
+    long long loopStartSample = 0;
+    long long loopEndSample = 0;
+
+    pthread_t bounceThread;
+    bool bounceThreadRunning = false;
+    std::atomic<bool> bouncing;
+    std::atomic<bool> bounceCancelled;
+    char *bouncePath = NULL;
+
+    LatencyCalibration latencyCalibration;  // audio thread only
+    std::atomic<int> recordLatency;
+    std::atomic<int> recordLatencyIo;       // the IO latency recordLatency was measured or set with
+    std::atomic<int> ioLatency;             // of the IO, as far as the input has followed it yet
+    int ioLatencySeen;                      // audio thread only, the IO's latency at the last callback
+    unsigned long long ioLatencyDue = 0;    // output frame from which the input reflects ioLatencySeen
+    std::atomic<int> recordHistoryFrames;
+    CaptureHistory captureHistory;          // written by the audio thread whenever the IO runs
+    // Take alignment, audio thread only.
+    bool recordStarted = false;             // the players have been heard since the take started
+    int recordSkipFrames = 0;
+    int recordTailFrames = 0;
+    bool stoppingRecording = false;
+    bool recordWithHistory = false;
+    // Punch recording, audio thread only.
+    long long punchInSample = 0;
+    long long punchOutSample = 0;
+    long long recordPunchIn = 0;            // the region of the current take
+    long long recordPunchOut = 0;
+    bool punchedIn = false;
+    long long punchNextPosition = 0;
+    unsigned long long outputFrames = 0;    // frames of every callback so far
+    TransportSegment transportSegments[TRANSPORT_SEGMENTS];
+    int transportSegmentsCount = 0;
+    int transportSegmentsLast = -1;
 
     const char *tempRecorderPath;
     const char *destinationRecorderPath;
@@ -81,8 +532,65 @@ private:
     void notifyPlayersPrepared();
     void notifyError(int errorCode);
     void notifyPlayerEnded(int index);
+    void notifyBounceProgress(float progress);
+    void notifyBounceFinished(bool success);
+    void notifyLatencyMeasured(int samples);
+    void notifyTrackPrepared(int index, float progress);
+    void notifyPrepareFailed(int index, int errorCode);
+
+    void postEvent(EngineEventType type, int index = 0, float value = 0);
+    void deliverEvent(const EngineEvent &event);
+
+    void startAudioSystem();
+
+    void ensureSlotCapacity(int count);
+    PlayerWrapper *openTrack(int index, const char *path, int fileOffset, int fileSize);
+    void openClipTrack(int index, const Clip *clips, int count);
+    void publishTrack(PlayerWrapper *track);
+    void parkTrack(PlayerWrapper *track);
+    void retireTrack(PlayerWrapper *track);
+    void retireEffects(EffectChain *effects);
+    void retire(const RetiredTrack &retired);
+    bool reclaim(const RetiredTrack &retired, bool force, bool idle);
+    EffectChain *slotEffects(int index) const;
+    void reclaimTracks(bool force);
+    PlayerWrapper *slotTrack(int index) const;
+    PlayerWrapper *trackAt(int index) const;
+    PlayerWrapper *mainTrack() const;
+    void attachTrack(PlayerWrapper *track);
+    void trackGains(const PlayerWrapper *track, int channels, float *left, float *right) const;
+
+    bool render(float *audioIO, unsigned int numberOfSamples);
+    void recordInput(float *audioIO, unsigned int numberOfSamples, bool silence);
+    int roundTrip() const;
+    void followIoLatency();
+    void recordPunch(float *audioIO, unsigned int numberOfSamples);
+    void recordSilence(unsigned int frames);
+    void finishPunch();
+    void logTransport(unsigned long long outputFrame, long long position, unsigned int frames);
+    bool transportAt(unsigned long long outputFrame, long long *position, unsigned int *frames) const;
+
+    void sendCommand(EngineCommandType type, int index = 0, float value = 0, long long position = 0, long long end = 0);
+    void applyCommands();
+    void applySuspendedCommands();
+    void applyCommand(const EngineCommand &command);
+    void pausePlayers();
+    void seekPlayers(long long position);
+    void seekTrack(PlayerWrapper *track, long long sample, bool andStop);
+    long long trackDuration(const PlayerWrapper *track) const;
+    void armTrackLoop(PlayerWrapper *track);
+    void wrapLoop();
+    void suspendAudio();
+    void resumeAudio();
+
+    bool mixPlayers(float *buffer, unsigned int numberOfSamples, bool waitForDecoder, bool *mainPlayerHasAudio);
+    void cancelBounce();
 
     bool isReady();
+
+    void abortPrepare(int index, int errorCode);
+    void checkPrepareDeadline();
+    void joinPrepareThreads();
 };
 
 
@@ -0,0 +1,603 @@
+//
+// Created by Dmitry R. on 9/26/17.
+//
+
+#include <jni.h>
+#include "AudioEngine.h"
+#include "Log.h"
+
+
+JavaVM *javaVM;
+jobject g_jniCallbackInstance = NULL;
+jclass g_jniCallbackClazz = NULL;
+// methods
+jmethodID jniMethodOnPlayersPrepared;
+jmethodID jniMethodOnError;   // params: int - error code
+jmethodID jniMethodOnPlayerEnded; // params: int - index of player
+jmethodID jniMethodOnRecordFinished;
+jmethodID jniMethodOnBounceProgress; // params: float - progress from 0 to 1
+jmethodID jniMethodOnBounceFinished; // params: boolean - success
+jmethodID jniMethodOnLatencyMeasured; // params: int - round trip in samples, -1 on failure
+jmethodID jniMethodOnTrackPrepared; // params: int - index of track, float - part of the session prepared
+jmethodID jniMethodOnPrepareFailed; // params: int - index of track or -1, int - error code
+
+bool needDetachJvm = false;
+
+
+JNIEnv* getEnv() {
+    JNIEnv *env;
+    int status = javaVM->GetEnv((void**)&env, JNI_VERSION_1_6);
+    LOGI("getEnv: status: %d", status);
+    if(status != JNI_OK) {
+        needDetachJvm = true;
+        status = javaVM->AttachCurrentThread(&env, NULL);
+        if(status != JNI_OK) {
+            return NULL;
+        }
+    } else {
+        needDetachJvm = false;
+    }
+    return env;
+}
+
+void detachAfterCallbackDone() {
+    if (needDetachJvm) {
+        needDetachJvm = false;
+        javaVM->DetachCurrentThread();
+    }
+}
+
+void cacheObjects() {
+    JNIEnv *env = getEnv();
+    if (env != NULL) {
+        jclass jniCallbackClazz = env->FindClass("com/delicacyset/superpowered/AudioEngine");
+        // check error
+        g_jniCallbackClazz = reinterpret_cast<jclass>(env->NewGlobalRef(jniCallbackClazz));
+
+
+        jniMethodOnPlayersPrepared = env->GetMethodID(g_jniCallbackClazz,
+                                                      "onPlayersPrepared", "()V");
+        jniMethodOnError = env->GetMethodID(g_jniCallbackClazz,
+                                            "onError", "(I)V");
+        jniMethodOnPlayerEnded = env->GetMethodID(g_jniCallbackClazz,
+                                                  "onPlayerEnded", "(I)V");
+        jniMethodOnRecordFinished = env->GetMethodID(g_jniCallbackClazz,
+                                                     "onRecordFinished", "()V");
+        jniMethodOnBounceProgress = env->GetMethodID(g_jniCallbackClazz,
+                                                     "onBounceProgress", "(F)V");
+        jniMethodOnBounceFinished = env->GetMethodID(g_jniCallbackClazz,
+                                                     "onBounceFinished", "(Z)V");
+        jniMethodOnLatencyMeasured = env->GetMethodID(g_jniCallbackClazz,
+                                                      "onLatencyMeasured", "(I)V");
+        jniMethodOnTrackPrepared = env->GetMethodID(g_jniCallbackClazz,
+                                                    "onTrackPrepared", "(IF)V");
+        jniMethodOnPrepareFailed = env->GetMethodID(g_jniCallbackClazz,
+                                                    "onPrepareFailed", "(II)V");
+    }
+}
+
+void releaseObjects(JNIEnv *env) {
+    if (g_jniCallbackInstance != NULL) {
+        env->DeleteGlobalRef(g_jniCallbackInstance);
+        g_jniCallbackInstance = NULL;
+    }
+    if (g_jniCallbackClazz != NULL) {
+        env->DeleteGlobalRef(g_jniCallbackClazz);
+        g_jniCallbackClazz = NULL;
+    }
+}
+
+// Forwards engine notifications to the Java AudioEngine instance. The engine calls it only from its
+// notifier thread, which stays attached to the JVM for its whole life.
+class JniAudioEngineListener : public AudioEngineListener {
+public:
+    void onNotifierThreadStarted() override {
+        JNIEnv *env;
+        javaVM->AttachCurrentThread(&env, NULL);
+    }
+
+    void onNotifierThreadStopped() override {
+        javaVM->DetachCurrentThread();
+    }
+
+    void onPlayersPrepared() override {
+        JNIEnv *env = getEnv();
+        if (env != NULL && g_jniCallbackInstance != NULL && jniMethodOnPlayersPrepared != NULL) {
+            env->CallVoidMethod(g_jniCallbackInstance, jniMethodOnPlayersPrepared);
+        }
+        detachAfterCallbackDone();
+    }
+
+    void onError(int errorCode) override {
+        JNIEnv *env = getEnv();
+        if (env != NULL && g_jniCallbackInstance != NULL && jniMethodOnError != NULL) {
+            env->CallVoidMethod(g_jniCallbackInstance, jniMethodOnError, errorCode);
+        }
+        detachAfterCallbackDone();
+    }
+
+    void onPlayerEnded(int index) override {
+        JNIEnv *env = getEnv();
+        if (env != NULL && g_jniCallbackInstance != NULL && jniMethodOnPlayerEnded != NULL) {
+            env->CallVoidMethod(g_jniCallbackInstance, jniMethodOnPlayerEnded, index);
+        }
+        detachAfterCallbackDone();
+    }
+
+    void onRecordFinished() override {
+        JNIEnv *env = getEnv();
+        if (env != NULL && g_jniCallbackInstance != NULL && jniMethodOnRecordFinished != NULL) {
+            env->CallVoidMethod(g_jniCallbackInstance, jniMethodOnRecordFinished);
+        }
+        detachAfterCallbackDone();
+    }
+
+    void onBounceProgress(float progress) override {
+        JNIEnv *env = getEnv();
+        if (env != NULL && g_jniCallbackInstance != NULL && jniMethodOnBounceProgress != NULL) {
+            env->CallVoidMethod(g_jniCallbackInstance, jniMethodOnBounceProgress, progress);
+        }
+        detachAfterCallbackDone();
+    }
+
+    void onBounceFinished(bool success) override {
+        JNIEnv *env = getEnv();
+        if (env != NULL && g_jniCallbackInstance != NULL && jniMethodOnBounceFinished != NULL) {
+            env->CallVoidMethod(g_jniCallbackInstance, jniMethodOnBounceFinished, (jboolean) success);
+        }
+        detachAfterCallbackDone();
+    }
+
+    void onLatencyMeasured(int samples) override {
+        JNIEnv *env = getEnv();
+        if (env != NULL && g_jniCallbackInstance != NULL && jniMethodOnLatencyMeasured != NULL) {
+            env->CallVoidMethod(g_jniCallbackInstance, jniMethodOnLatencyMeasured, (jint) samples);
+        }
+        detachAfterCallbackDone();
+    }
+
+    void onTrackPrepared(int index, float progress) override {
+        JNIEnv *env = getEnv();
+        if (env != NULL && g_jniCallbackInstance != NULL && jniMethodOnTrackPrepared != NULL) {
+            env->CallVoidMethod(g_jniCallbackInstance, jniMethodOnTrackPrepared, (jint) index, (jfloat) progress);
+        }
+        detachAfterCallbackDone();
+    }
+
+    void onPrepareFailed(int index, int errorCode) override {
+        JNIEnv *env = getEnv();
+        if (env != NULL && g_jniCallbackInstance != NULL && jniMethodOnPrepareFailed != NULL) {
+            env->CallVoidMethod(g_jniCallbackInstance, jniMethodOnPrepareFailed, (jint) index, (jint) errorCode);
+        }
+        detachAfterCallbackDone();
+    }
+};
+
+// ------------------------------------ JNI ------------------------------------
+
+static JniAudioEngineListener sListener;
+static AudioEngine *sEngine = NULL;
+
+extern "C"
+JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM* vm, void* reserved) {
+    LOGI("onLoad");
+    JNIEnv *env;
+
+    javaVM = vm;
+    if (vm->GetEnv((void**)&env, JNI_VERSION_1_6) != JNI_OK) {
+        return JNI_ERR; // JNI version not supported.
+    }
+
+    return  JNI_VERSION_1_6;
+}
+
+
+extern "C"
+JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_AudioEngine__II(JNIEnv *javaEnvironment,
+                                                                             jobject self,
+                                                                             jint sampleRate,
+                                                                             jint bufferSize,
+                                                                             jboolean stereo) {
+    g_jniCallbackInstance = javaEnvironment->NewGlobalRef(self);
+    cacheObjects();
+    sEngine = new AudioEngine(sampleRate, bufferSize, &sListener);
+}
+
+extern "C"
+JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_releaseNative(JNIEnv *javaEnvironment,
+                                                                           jobject self) {
+    if (NULL != sEngine) {
+        delete sEngine;
+        sEngine = NULL;
+    }
+    releaseObjects(javaEnvironment);
+}
+
+extern "C"
+JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_initNative__II(JNIEnv *javaEnvironment,
+                                                                            jobject self,
+                                                                            jint numberOfChannels,
+                                                                            jint playersCount,
+                                                                            jboolean loop,
+                                                                            jint mainPlayerIndex) {
+    sEngine->init(numberOfChannels, playersCount, loop, mainPlayerIndex);
+}
+
+extern "C"
+JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_preparePlayer__Ljava_lang_String_2II(JNIEnv *javaEnvironment,
+                                                                                                  jobject self,
+                                                                                                  jstring path,
+                                                                                                  jint fileOffset,
+                                                                                                  jint fileSize) {
+    const char *pathC = javaEnvironment->GetStringUTFChars(path, JNI_FALSE);
+    LOGI("initPlayer: %s | %i | %i", pathC, fileOffset, fileSize);
+    sEngine->preparePlayer(pathC, fileOffset, fileSize);
+    javaEnvironment->ReleaseStringUTFChars(path, pathC);
+}
+
+extern "C"
+JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_prepareTracksNative(JNIEnv *javaEnvironment,
+                                                                                 jobject self,
+                                                                                 jobjectArray paths,
+                                                                                 jintArray fileOffsets,
+                                                                                 jintArray fileSizes,
+                                                                                 jint timeoutMs) {
+    jsize count = javaEnvironment->GetArrayLength(paths);
+    const char **pathsC = new const char *[count > 0 ? count : 1];
+    jstring *pathStrings = new jstring[count > 0 ? count : 1];
+    for (jsize i = 0; i < count; i++) {
+        pathStrings[i] = (jstring) javaEnvironment->GetObjectArrayElement(paths, i);
+        pathsC[i] = javaEnvironment->GetStringUTFChars(pathStrings[i], JNI_FALSE);
+    }
+    jint *offsets = javaEnvironment->GetIntArrayElements(fileOffsets, NULL);
+    jint *sizes = javaEnvironment->GetIntArrayElements(fileSizes, NULL);
+    sEngine->prepareTracks(pathsC, offsets, sizes, count, timeoutMs); // copies what it needs
+    javaEnvironment->ReleaseIntArrayElements(fileOffsets, offsets, JNI_ABORT);
+    javaEnvironment->ReleaseIntArrayElements(fileSizes, sizes, JNI_ABORT);
+    for (jsize i = 0; i < count; i++) {
+        javaEnvironment->ReleaseStringUTFChars(pathStrings[i], pathsC[i]);
+        javaEnvironment->DeleteLocalRef(pathStrings[i]);
+    }
+    delete[] pathStrings;
+    delete[] pathsC;
+}
+
+extern "C"
+JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_cancelPrepareNative(JNIEnv *javaEnvironment,
+                                                                                 jobject self) {
+    sEngine->cancelPrepare();
+}
+
+extern "C"
+JNIEXPORT jint Java_com_delicacyset_superpowered_AudioEngine_addTrackNative(JNIEnv *javaEnvironment,
+                                                                            jobject self,
+                                                                            jstring path,
+                                                                            jint fileOffset,
+                                                                            jint fileSize) {
+    const char *pathC = javaEnvironment->GetStringUTFChars(path, JNI_FALSE);
+    jint index = sEngine->addTrack(pathC, fileOffset, fileSize);
+    javaEnvironment->ReleaseStringUTFChars(path, pathC);
+    return index;
+}
+
+extern "C"
+JNIEXPORT jint Java_com_delicacyset_superpowered_AudioEngine_replaceTrackNative(JNIEnv *javaEnvironment,
+                                                                                jobject self,
+                                                                                jint index,
+                                                                                jstring path,
+                                                                                jint fileOffset,
+                                                                                jint fileSize) {
+    const char *pathC = javaEnvironment->GetStringUTFChars(path, JNI_FALSE);
+    jint result = sEngine->replaceTrack(index, pathC, fileOffset, fileSize);
+    javaEnvironment->ReleaseStringUTFChars(path, pathC);
+    return result;
+}
+
+extern "C"
+JNIEXPORT jint Java_com_delicacyset_superpowered_AudioEngine_setTrackClipsNative(JNIEnv *javaEnvironment,
+                                                                                 jobject self,
+                                                                                 jint index,
+                                                                                 jobjectArray paths,
+                                                                                 jlongArray positions,
+                                                                                 jintArray fades) {
+    jsize count = javaEnvironment->GetArrayLength(paths);
+    Clip *clips = new Clip[count > 0 ? count : 1];
+    jstring *pathStrings = new jstring[count > 0 ? count : 1];
+    jlong *positionsC = new jlong[count * 3 + 1];
+    jint *fadesC = new jint[count + 1];
+    javaEnvironment->GetLongArrayRegion(positions, 0, count * 3, positionsC);
+    javaEnvironment->GetIntArrayRegion(fades, 0, count, fadesC);
+    for (jsize i = 0; i < count; i++) {
+        pathStrings[i] = (jstring) javaEnvironment->GetObjectArrayElement(paths, i);
+        clips[i].path = javaEnvironment->GetStringUTFChars(pathStrings[i], JNI_FALSE);
+        clips[i].sourceOffset = positionsC[i * 3];
+        clips[i].timelineStart = positionsC[i * 3 + 1];
+        clips[i].length = positionsC[i * 3 + 2];
+        clips[i].fade = fadesC[i];
+    }
+    jint result = sEngine->setTrackClips(index, clips, count); // copies what it needs
+    for (jsize i = 0; i < count; i++) {
+        javaEnvironment->ReleaseStringUTFChars(pathStrings[i], clips[i].path);
+        javaEnvironment->DeleteLocalRef(pathStrings[i]);
+    }
+    delete[] fadesC;
+    delete[] positionsC;
+    delete[] pathStrings;
+    delete[] clips;
+    return result;
+}
+
+extern "C"
+JNIEXPORT jboolean Java_com_delicacyset_superpowered_AudioEngine_loadSessionNative(JNIEnv *javaEnvironment,
+                                                                                jobject self,
+                                                                                jstring path) {
+    const char *pathC = javaEnvironment->GetStringUTFChars(path, JNI_FALSE);
+    bool loaded = sEngine->loadSession(pathC);
+    javaEnvironment->ReleaseStringUTFChars(path, pathC);
+    return (jboolean) loaded;
+}
+
+extern "C"
+JNIEXPORT jboolean Java_com_delicacyset_superpowered_AudioEngine_saveSessionNative(JNIEnv *javaEnvironment,
+                                                                                jobject self,
+                                                                                jstring path) {
+    const char *pathC = javaEnvironment->GetStringUTFChars(path, JNI_FALSE);
+    bool saved = sEngine->saveSession(pathC);
+    javaEnvironment->ReleaseStringUTFChars(path, pathC);
+    return (jboolean) saved;
+}
+
+extern "C"
+JNIEXPORT jboolean Java_com_delicacyset_superpowered_AudioEngine_setTrackAnalysisNative(JNIEnv *javaEnvironment,
+                                                                                     jobject self,
+                                                                                     jint index,
+                                                                                     jbyteArray data) {
+    jsize size = javaEnvironment->GetArrayLength(data);
+    jbyte *dataC = new jbyte[size + 1];
+    javaEnvironment->GetByteArrayRegion(data, 0, size, dataC);
+    bool set = sEngine->setTrackAnalysis(index, dataC, (unsigned int)size);
+    delete[] dataC;
+    return (jboolean) set;
+}
+
+extern "C"
+JNIEXPORT jbyteArray Java_com_delicacyset_superpowered_AudioEngine_getTrackAnalysisNative(JNIEnv *javaEnvironment,
+                                                                                       jobject self,
+                                                                                       jint index) {
+    int size = sEngine->getTrackAnalysis(index, NULL, 0);
+    if (size < 0) {
+        return NULL;
+    }
+    jbyte *dataC = new jbyte[size + 1];
+    int copied = sEngine->getTrackAnalysis(index, dataC, (unsigned int)size); // may have changed meanwhile
+    if (copied < 0 || copied > size) {
+        copied = copied < 0 ? 0 : size;
+    }
+    jbyteArray data = javaEnvironment->NewByteArray(copied);
+    javaEnvironment->SetByteArrayRegion(data, 0, copied, dataC);
+    delete[] dataC;
+    return data;
+}
+
+extern "C"
+JNIEXPORT jboolean Java_com_delicacyset_superpowered_AudioEngine_setTrackEffectsNative(JNIEnv *javaEnvironment,
+                                                                                    jobject self,
+                                                                                    jint index,
+                                                                                    jintArray types,
+                                                                                    jbooleanArray enabled,
+                                                                                    jfloatArray parameters) {
+    jsize count = javaEnvironment->GetArrayLength(types);
+    Effect *effects = new Effect[count > 0 ? count : 1];
+    jint *typesC = new jint[count + 1];
+    jboolean *enabledC = new jboolean[count + 1];
+    javaEnvironment->GetIntArrayRegion(types, 0, count, typesC);
+    javaEnvironment->GetBooleanArrayRegion(enabled, 0, count, enabledC);
+    for (jsize i = 0; i < count; i++) {
+        effects[i].type = (EffectType) typesC[i];
+        effects[i].enabled = enabledC[i] != JNI_FALSE;
+        javaEnvironment->GetFloatArrayRegion(parameters, i * EFFECT_PARAMETERS, EFFECT_PARAMETERS, effects[i].parameters);
+    }
+    bool set = sEngine->setTrackEffects(index, effects, count);
+    delete[] enabledC;
+    delete[] typesC;
+    delete[] effects;
+    return (jboolean) set;
+}
+
+extern "C"
+JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_setTrackEffectParameterNative(JNIEnv *javaEnvironment,
+                                                                                       jobject self,
+                                                                                       jint index,
+                                                                                       jint effect,
+                                                                                       jint parameter,
+                                                                                       jfloat value) {
+    sEngine->setTrackEffectParameter(index, effect, parameter, value);
+}
+
+extern "C"
+JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_setTrackEffectEnabledNative(JNIEnv *javaEnvironment,
+                                                                                     jobject self,
+                                                                                     jint index,
+                                                                                     jint effect,
+                                                                                     jboolean enabled) {
+    sEngine->setTrackEffectEnabled(index, effect, enabled);
+}
+
+extern "C"
+JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_removeTrackNative(JNIEnv *javaEnvironment,
+                                                                               jobject self,
+                                                                               jint index) {
+    sEngine->removeTrack(index);
+}
+
+extern "C"
+JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_startPlayingNative(JNIEnv *javaEnvironment,
+                                                                                jobject self,
+                                                                                jboolean fromBeginning) {
+    sEngine->startPlaying(fromBeginning);
+}
+
+extern "C"
+JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_setPlayNative(JNIEnv *javaEnvironment,
+                                                                           jobject self,
+                                                                           jboolean shouldPlay) {
+    sEngine->setPlay(shouldPlay);
+}
+
+extern "C"
+JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_setPlayerVolumeNative(JNIEnv *javaEnvironment,
+                                                                                   jobject self,
+                                                                                   jint index,
+                                                                                   jfloat volume) {
+    sEngine->setPlayerVolume(index, volume);
+}
+
+extern "C"
+JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_setPlayerPanNative(JNIEnv *javaEnvironment,
+                                                                                jobject self,
+                                                                                jint index,
+                                                                                jfloat pan) {
+    sEngine->setPlayerPan(index, pan);
+}
+
+extern "C"
+JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_setLoopRegionNative(JNIEnv *javaEnvironment,
+                                                                                 jobject self,
+                                                                                 jlong startSample,
+                                                                                 jlong endSample) {
+    sEngine->setLoopRegion(startSample, endSample);
+}
+
+extern "C"
+JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_setMasterBusNative(JNIEnv *javaEnvironment,
+                                                                                jobject self,
+                                                                                jboolean enabled) {
+    sEngine->setMasterBus(enabled);
+}
+
+extern "C"
+JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_setPunchRegionNative(JNIEnv *javaEnvironment,
+                                                                                  jobject self,
+                                                                                  jlong punchInSample,
+                                                                                  jlong punchOutSample) {
+    sEngine->setPunchRegion(punchInSample, punchOutSample);
+}
+
+extern "C"
+JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_setDecodedAudioBudgetNative(JNIEnv *javaEnvironment,
+                                                                                         jobject self,
+                                                                                         jlong bytes) {
+    sEngine->setDecodedAudioBudget(bytes);
+}
+
+extern "C"
+JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_setRecordingFormatNative(JNIEnv *javaEnvironment,
+                                                                                      jobject self,
+                                                                                      jint format) {
+    sEngine->setRecordingFormat(format);
+}
+
+extern "C"
+JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_startRecordingNative(JNIEnv *javaEnvironment,
+                                                                                  jobject self,
+                                                                                  jstring tempPath,
+                                                                                  jstring path,
+                                                                                  jboolean withHistory) {
+    const char *tempPathC = javaEnvironment->GetStringUTFChars(tempPath, JNI_FALSE);
+    const char *destinationPathC = javaEnvironment->GetStringUTFChars(path, JNI_FALSE);
+
+    sEngine->startRecording(tempPathC, destinationPathC, withHistory);
+
+    javaEnvironment->ReleaseStringUTFChars(tempPath, tempPathC);
+    javaEnvironment->ReleaseStringUTFChars(path, destinationPathC);
+}
+
+extern "C"
+JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_stopRecordingNative(JNIEnv *javaEnvironment,
+                                                                                 jobject self) {
+    sEngine->stopRecording();
+}
+
+extern "C"
+JNIEXPORT jboolean Java_com_delicacyset_superpowered_AudioEngine_bounceNative(JNIEnv *javaEnvironment,
+                                                                           jobject self,
+                                                                           jstring path) {
+    const char *pathC = javaEnvironment->GetStringUTFChars(path, JNI_FALSE);
+    bool started = sEngine->bounce(pathC);
+    javaEnvironment->ReleaseStringUTFChars(path, pathC);
+    return (jboolean) started;
+}
+
+extern "C"
+JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_resetNative(JNIEnv *javaEnvironment,
+                                                                         jobject self) {
+    sEngine->reset();
+}
+
+extern "C"
+JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_initNative(JNIEnv *javaEnvironment,
+                                                                        jobject self,
+                                                                        int numberOfChannels,
+                                                                        int playersCount,
+                                                                        jboolean loop,
+                                                                        int mainPlayerIndex) {
+    sEngine->init(numberOfChannels, playersCount, loop, mainPlayerIndex);
+}
+
+extern "C"
+JNIEXPORT jboolean Java_com_delicacyset_superpowered_AudioEngine_isPrepared(JNIEnv *javaEnvironment,
+                                                                            jobject self) {
+    return (jboolean) sEngine->isPrepared();
+}
+
+extern "C"
+JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_measureLatencyNative(JNIEnv *javaEnvironment,
+                                                                                  jobject self) {
+    sEngine->measureLatency();
+}
+
+extern "C"
+JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_setRecordLatencyNative(JNIEnv *javaEnvironment,
+                                                                                    jobject self,
+                                                                                    jint samples) {
+    sEngine->setRecordLatency(samples);
+}
+
+extern "C"
+JNIEXPORT jint Java_com_delicacyset_superpowered_AudioEngine_getRecordLatencyNative(JNIEnv *javaEnvironment,
+                                                                                    jobject self) {
+    return sEngine->getRecordLatency();
+}
+
+extern "C"
+JNIEXPORT jint Java_com_delicacyset_superpowered_AudioEngine_getIoLatencyNative(JNIEnv *javaEnvironment,
+                                                                                jobject self) {
+    return sEngine->getIoLatency();
+}
+
+extern "C"
+JNIEXPORT jint Java_com_delicacyset_superpowered_AudioEngine_getRecordHistoryFramesNative(JNIEnv *javaEnvironment,
+                                                                                          jobject self) {
+    return sEngine->getRecordHistoryFrames();
+}
+
+extern "C"
+JNIEXPORT void Java_com_delicacyset_superpowered_AudioEngine_getStatsNative(JNIEnv *javaEnvironment,
+                                                                            jobject self,
+                                                                            jlongArray counters,
+                                                                            jdoubleArray times,
+                                                                            jlongArray histogram) {
+    AudioEngineStats stats;
+    sEngine->getStats(&stats);
+    jlong countersC[7] = {(jlong)stats.callbacks, (jlong)stats.overBudget, (jlong)stats.nearBudget,
+                          stats.inputUnderruns, stats.outputUnderruns, stats.silenceSubstitutions,
+                          stats.inputOverruns};
+    jdouble timesC[4] = {stats.budgetMicros, stats.meanMicros, stats.maxMicros, stats.lastMicros};
+    jlong histogramC[CALLBACK_HISTOGRAM_BUCKETS];
+    for (int i = 0; i < CALLBACK_HISTOGRAM_BUCKETS; i++) {
+        histogramC[i] = (jlong)stats.histogram[i];
+    }
+    javaEnvironment->SetLongArrayRegion(counters, 0, 7, countersC);
+    javaEnvironment->SetDoubleArrayRegion(times, 0, 4, timesC);
+    javaEnvironment->SetLongArrayRegion(histogram, 0, CALLBACK_HISTOGRAM_BUCKETS, histogramC);
+}
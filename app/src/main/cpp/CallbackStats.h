@@ -0,0 +1,107 @@
+#ifndef AUDIO_CALLBACKSTATS_H
+#define AUDIO_CALLBACKSTATS_H
+
+#include <atomic>
+
+#define CALLBACK_HISTOGRAM_BUCKETS 20
+// Callbacks taking this share of their buffer's duration or more are counted as near the deadline.
+#define CALLBACK_NEAR_BUDGET_RATIO 0.9
+
+/**
+ * Audio callback timing and IO dropout counters, as returned by
+ * AudioEngine::getStats(). Bucket i of the histogram counts callbacks that
+ * took [2^i, 2^(i+1)) microseconds; the first bucket also holds anything
+ * faster and the last one anything slower. Counters run from engine creation.
+ */
+struct AudioEngineStats {
+    unsigned long long callbacks;
+    unsigned long long overBudget;  // took longer than the buffer lasts
+    unsigned long long nearBudget;  // took CALLBACK_NEAR_BUDGET_RATIO of the buffer or more
+    unsigned long long histogram[CALLBACK_HISTOGRAM_BUCKETS];
+    double budgetMicros;            // duration of the last callback's buffer
+    double meanMicros;
+    double maxMicros;
+    double lastMicros;
+    unsigned int inputUnderruns;    // output callbacks without enough recorded input
+    unsigned int outputUnderruns;   // output callbacks without enough generated audio
+    unsigned int silenceSubstitutions;
+    unsigned int inputOverruns;     // recorded buffers lost because the output fell behind
+};
+
+/**
+ * Timing of the audio callback. record() is called by the audio thread only
+ * and never blocks; snapshot() may be called from any thread and retries
+ * (a sequence lock) until it has read a consistent set of counters.
+ */
+class CallbackStats {
+public:
+    CallbackStats() : sequence(0), callbacks(0), overBudget(0), nearBudget(0), totalMicros(0), budgetMicros(0),
+                      maxMicros(0), lastMicros(0) {
+        for (int i = 0; i < CALLBACK_HISTOGRAM_BUCKETS; i++) {
+            histogram[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void record(double micros, double budget) {
+        unsigned int start = sequence.load(std::memory_order_relaxed);
+        sequence.store(start + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        int bucket = 0;
+        for (double limit = 2; micros >= limit && bucket < CALLBACK_HISTOGRAM_BUCKETS - 1; limit *= 2) {
+            bucket++;
+        }
+        increment(histogram[bucket]);
+        increment(callbacks);
+        if (micros > budget) increment(overBudget);
+        if (micros >= budget * CALLBACK_NEAR_BUDGET_RATIO) increment(nearBudget);
+        totalMicros.store(totalMicros.load(std::memory_order_relaxed) + micros, std::memory_order_relaxed);
+        if (micros > maxMicros.load(std::memory_order_relaxed)) maxMicros.store(micros, std::memory_order_relaxed);
+        lastMicros.store(micros, std::memory_order_relaxed);
+        budgetMicros.store(budget, std::memory_order_relaxed);
+
+        sequence.store(start + 2, std::memory_order_release);
+    }
+
+    // Fills the timing fields of stats, leaves the IO counters alone.
+    void snapshot(AudioEngineStats *stats) const {
+        while (true) {
+            unsigned int start = sequence.load(std::memory_order_acquire);
+            if ((start & 1) == 0) {
+                stats->callbacks = callbacks.load(std::memory_order_relaxed);
+                stats->overBudget = overBudget.load(std::memory_order_relaxed);
+                stats->nearBudget = nearBudget.load(std::memory_order_relaxed);
+                for (int i = 0; i < CALLBACK_HISTOGRAM_BUCKETS; i++) {
+                    stats->histogram[i] = histogram[i].load(std::memory_order_relaxed);
+                }
+                double total = totalMicros.load(std::memory_order_relaxed);
+                stats->meanMicros = stats->callbacks > 0 ? total / stats->callbacks : 0;
+                stats->budgetMicros = budgetMicros.load(std::memory_order_relaxed);
+                stats->maxMicros = maxMicros.load(std::memory_order_relaxed);
+                stats->lastMicros = lastMicros.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (sequence.load(std::memory_order_relaxed) == start) {
+                    return;
+                }
+            }
+        }
+    }
+
+private:
+    std::atomic<unsigned int> sequence; // odd while the audio thread is writing
+    std::atomic<unsigned long long> callbacks;
+    std::atomic<unsigned long long> overBudget;
+    std::atomic<unsigned long long> nearBudget;
+    std::atomic<unsigned long long> histogram[CALLBACK_HISTOGRAM_BUCKETS];
+    std::atomic<double> totalMicros;
+    std::atomic<double> budgetMicros;
+    std::atomic<double> maxMicros;
+    std::atomic<double> lastMicros;
+
+    // Single writer, so no read-modify-write is needed.
+    static void increment(std::atomic<unsigned long long> &counter) {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+};
+
+#endif //AUDIO_CALLBACKSTATS_H
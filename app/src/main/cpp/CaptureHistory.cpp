@@ -0,0 +1,89 @@
+#include "CaptureHistory.h"
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+CaptureHistory::CaptureHistory(int sampleRate, int seconds) : position(0), writing(0) {
+    capacity = (unsigned int)(sampleRate * seconds);
+    ringFrames = capacity + (unsigned int)(sampleRate * CAPTURE_HISTORY_SLACK_SECONDS);
+    ring = (float *)memalign(16, (size_t)ringFrames * sizeof(float) * 2);
+    if (ring == NULL) {
+        capacity = ringFrames = 0;
+    }
+}
+
+CaptureHistory::~CaptureHistory() {
+    free(ring);
+}
+
+unsigned int CaptureHistory::getCapacity() const {
+    return capacity;
+}
+
+void CaptureHistory::setChannels(int numberOfChannels) {
+    channels = numberOfChannels == 1 ? 1 : 2; // the ring has room for stereo
+    available = 0;
+}
+
+void CaptureHistory::write(const float *input, unsigned int numberOfSamples) {
+    if (ringFrames == 0) {
+        return;
+    }
+    if (numberOfSamples > ringFrames) {
+        input += (numberOfSamples - ringFrames) * channels;
+        numberOfSamples = ringFrames;
+    }
+    unsigned long long start = position.load(std::memory_order_relaxed);
+    // Readers check this after copying: whatever lies a ring behind it may have been overwritten.
+    writing.store(start + numberOfSamples, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    unsigned int index = (unsigned int)(start % ringFrames);
+    unsigned int first = ringFrames - index < numberOfSamples ? ringFrames - index : numberOfSamples;
+    memcpy(ring + index * channels, input, first * sizeof(float) * channels);
+    memcpy(ring, input + first * channels, (numberOfSamples - first) * sizeof(float) * channels);
+    position.store(start + numberOfSamples, std::memory_order_release);
+
+    available = ringFrames - available < numberOfSamples ? ringFrames : available + numberOfSamples;
+}
+
+unsigned long long CaptureHistory::getPosition() const {
+    return position.load(std::memory_order_relaxed);
+}
+
+unsigned int CaptureHistory::getAvailable() const {
+    return available;
+}
+
+unsigned int CaptureHistory::read(unsigned long long from, unsigned int numberOfSamples, float *output) const {
+    long long end = (long long)(from + numberOfSamples);
+    long long written = (long long)position.load(std::memory_order_acquire);
+    long long oldest = (long long)writing.load(std::memory_order_relaxed) - ringFrames;
+    long long validStart = (long long)from > oldest ? (long long)from : oldest;
+    long long validEnd = end < written ? end : written;
+    if (validStart < validEnd) {
+        copy((unsigned long long)validStart, (unsigned int)(validEnd - validStart),
+             output + (validStart - (long long)from) * channels);
+    }
+
+    // A frame copied while the audio thread overwrote it is torn: drop it too.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    oldest = (long long)writing.load(std::memory_order_relaxed) - ringFrames;
+    if (validStart < oldest) {
+        validStart = oldest;
+    }
+    if (validStart >= validEnd) {
+        memset(output, 0, numberOfSamples * sizeof(float) * channels);
+        return 0;
+    }
+    memset(output, 0, (size_t)(validStart - (long long)from) * sizeof(float) * channels);
+    memset(output + (validEnd - (long long)from) * channels, 0, (size_t)(end - validEnd) * sizeof(float) * channels);
+    return (unsigned int)(validEnd - validStart);
+}
+
+void CaptureHistory::copy(unsigned long long from, unsigned int numberOfSamples, float *output) const {
+    unsigned int index = (unsigned int)(from % ringFrames);
+    unsigned int first = ringFrames - index < numberOfSamples ? ringFrames - index : numberOfSamples;
+    memcpy(output, ring + index * channels, first * sizeof(float) * channels);
+    memcpy(output + first * channels, ring, (numberOfSamples - first) * sizeof(float) * channels);
+}
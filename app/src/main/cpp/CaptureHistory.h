@@ -0,0 +1,63 @@
+//
+// The last few seconds of input, kept while the audio IO runs.
+//
+
+#ifndef AUDIO_CAPTUREHISTORY_H
+#define AUDIO_CAPTUREHISTORY_H
+
+#include <atomic>
+#include <stddef.h>
+
+// Input a take can start with, from before recording was started.
+#define CAPTURE_HISTORY_SECONDS 10
+// The ring holds this much more than it hands out, so the recorder can copy the oldest frames
+// while the audio thread keeps writing.
+#define CAPTURE_HISTORY_SLACK_SECONDS 2
+
+/**
+ * A ring of float input, stereo or mono, that the audio thread overwrites on every
+ * callback, so a take can begin with what was sung before record was pressed.
+ * It is allocated once: writing is two memcpys and a couple of atomic stores,
+ * cheap enough to leave on all the time.
+ *
+ * Frames are addressed by their position in the input since the engine was
+ * created. Any thread may read them back while the audio thread writes.
+ */
+class CaptureHistory {
+public:
+    CaptureHistory(int sampleRate, int seconds);
+    ~CaptureHistory();
+
+    // Frames a take can start with at most.
+    unsigned int getCapacity() const;
+
+    // With the audio thread stopped. Holds input of numberOfChannels, 1 or 2, from now on; what it held is dropped.
+    void setChannels(int numberOfChannels);
+
+    // Audio thread. Appends interleaved input.
+    void write(const float *input, unsigned int numberOfSamples);
+
+    // Audio thread. Position of the next frame to be written, and how many before it are held.
+    unsigned long long getPosition() const;
+    unsigned int getAvailable() const;
+
+    /**
+     * Copies numberOfSamples frames from position from. Frames the ring
+     * no longer holds, overwritten while the reader fell behind, come out as
+     * silence. Returns how many frames were read back intact.
+     */
+    unsigned int read(unsigned long long from, unsigned int numberOfSamples, float *output) const;
+
+private:
+    float *ring = NULL;
+    unsigned int ringFrames = 0;
+    unsigned int capacity = 0;
+    int channels = 2;
+    unsigned int available = 0;                 // audio thread only
+    std::atomic<unsigned long long> position;   // frames written
+    std::atomic<unsigned long long> writing;    // frames written once the write under way is done
+
+    void copy(unsigned long long from, unsigned int numberOfSamples, float *output) const;
+};
+
+#endif //AUDIO_CAPTUREHISTORY_H
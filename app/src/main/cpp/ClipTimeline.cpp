@@ -0,0 +1,147 @@
+#include "ClipTimeline.h"
+#include "DecodedAudioCache.h"
+#include "MemoryTrack.h"
+#include "Log.h"
+#include <stdlib.h>
+#include <string.h>
+
+ClipTimeline::ClipTimeline(const Clip *clips, int count) {
+    sources = new Source[count > 0 ? count : 1];
+    entries = new Entry[count > 0 ? count : 1];
+    for (int i = 0; i < count; i++) {
+        const Clip &clip = clips[i];
+        if (clip.path == NULL || clip.length < 0) {
+            continue;
+        }
+        int source = 0;
+        while (source < sourcesCount && strcmp(sources[source].path, clip.path) != 0) {
+            source++;
+        }
+        if (source == sourcesCount) {
+            sources[source].path = strdup(clip.path);
+            sources[source].memory = NULL;
+            sources[source].decoded = NULL;
+            sourcesCount++;
+        }
+        Entry &entry = entries[entriesCount++];
+        entry.source = source;
+        entry.sourceOffset = clip.sourceOffset;
+        entry.timelineStart = clip.timelineStart;
+        entry.length = clip.length;
+        entry.fade = clip.fade < 0 ? 0 : clip.fade;
+        if (clip.length > 0 && entry.fade > clip.length / 2) {
+            entry.fade = clip.length / 2;
+        }
+    }
+}
+
+ClipTimeline::~ClipTimeline() {
+    for (int i = 0; i < sourcesCount; i++) {
+        delete sources[i].memory;
+        if (sources[i].decoded != NULL) {
+            decodedAudio->release(sources[i].decoded);
+        }
+        free(sources[i].path);
+    }
+    delete[] sources;
+    delete[] entries;
+}
+
+bool ClipTimeline::load(DecodedAudioCache *decodedAudio, int sampleRate) {
+    this->decodedAudio = decodedAudio;
+    for (int i = 0; i < sourcesCount; i++) {
+        Source &source = sources[i];
+        source.memory = new MemoryTrack(NULL, NULL);
+        if (source.memory->open(source.path, 0, 0, sampleRate)) {
+            continue;
+        }
+        PlayerSource described;
+        if (PlayerCache::describe(source.path, 0, 0, &described)) {
+            source.decoded = decodedAudio->acquire(described);
+            PlayerCache::release(&described);
+        }
+        if (source.decoded == NULL || !decodedAudio->load(source.decoded)) {
+            LOGI("clip source %s can't play from memory", source.path);
+            return false;
+        }
+        source.memory->openDecoded(source.decoded->samples, source.decoded->frames);
+    }
+    for (int i = 0; i < entriesCount; i++) {
+        Entry &entry = entries[i];
+        if (entry.length == 0) {
+            entry.length = sources[entry.source].memory->durationSamples - entry.sourceOffset;
+            if (entry.fade > entry.length / 2) {
+                entry.fade = entry.length > 0 ? entry.length / 2 : 0;
+            }
+        }
+    }
+    return true;
+}
+
+long long ClipTimeline::getDuration() const {
+    long long duration = 0;
+    for (int i = 0; i < entriesCount; i++) {
+        long long end = entries[i].timelineStart + entries[i].length;
+        if (end > duration) {
+            duration = end;
+        }
+    }
+    return duration;
+}
+
+int ClipTimeline::getClipsCount() const {
+    return entriesCount;
+}
+
+void ClipTimeline::getClip(int index, Clip *clip) const {
+    const Entry &entry = entries[index];
+    clip->path = sources[entry.source].path;
+    clip->sourceOffset = entry.sourceOffset;
+    clip->timelineStart = entry.timelineStart;
+    clip->length = entry.length;
+    clip->fade = (int)entry.fade;
+}
+
+void ClipTimeline::render(float *output, long long from, unsigned int numberOfSamples) {
+    memset(output, 0, numberOfSamples * sizeof(float) * 2);
+    for (int i = 0; i < entriesCount; i++) {
+        mixEntry(entries[i], output, from, numberOfSamples);
+    }
+}
+
+// Adds the part of the clip that plays between from and from + numberOfSamples, faded.
+void ClipTimeline::mixEntry(const Entry &entry, float *output, long long from, unsigned int numberOfSamples) {
+    long long start = entry.timelineStart > from ? entry.timelineStart : from;
+    long long end = entry.timelineStart + entry.length;
+    if (end > from + numberOfSamples) {
+        end = from + numberOfSamples;
+    }
+    const MemoryTrack *memory = sources[entry.source].memory;
+    while (start < end) {
+        unsigned int frames = end - start < CLIP_RENDER_CHUNK ? (unsigned int)(end - start) : CLIP_RENDER_CHUNK;
+        long long clipSample = start - entry.timelineStart;
+        memory->read(scratch, entry.sourceOffset + clipSample, frames);
+        float *destination = output + (start - from) * 2;
+        bool faded = clipSample < entry.fade || clipSample + frames > entry.length - entry.fade;
+        if (!faded) {
+            for (unsigned int n = 0; n < frames * 2; n++) {
+                destination[n] += scratch[n];
+            }
+        } else {
+            for (unsigned int n = 0; n < frames; n++) {
+                long long sample = clipSample + n;
+                float gain = 1.f;
+                if (sample < entry.fade) {
+                    gain = (sample + 0.5f) / entry.fade;
+                }
+                if (entry.length - sample <= entry.fade) {
+                    float fadeOut = (entry.length - sample - 0.5f) / entry.fade;
+                    gain = fadeOut < gain ? fadeOut : gain;
+                }
+                destination[n * 2] += scratch[n * 2] * gain;
+                destination[n * 2 + 1] += scratch[n * 2 + 1] * gain;
+            }
+        }
+        start += frames;
+    }
+}
@@ -0,0 +1,86 @@
+//
+// A track made of clips of other files, for comping takes without rendering them.
+//
+
+#ifndef AUDIO_CLIPTIMELINE_H
+#define AUDIO_CLIPTIMELINE_H
+
+#include <stddef.h>
+
+// Frames of a clip read at once while mixing.
+#define CLIP_RENDER_CHUNK 256
+
+class DecodedAudioCache;
+struct DecodedAudio;
+class MemoryTrack;
+
+/**
+ * Part of a file placed on the session timeline. All positions are in samples
+ * at the engine sample rate.
+ */
+struct Clip {
+    const char *path;
+    long long sourceOffset;  // first sample of the file played
+    long long timelineStart; // where that sample plays on the timeline
+    long long length;        // 0 to play the file to its end
+    int fade;                // samples faded in at the start and out at the end
+};
+
+/**
+ * The clips of one track. Each source file is opened once, however many clips
+ * use it, and played from memory: a 16-bit, 24-bit or float WAV at the engine rate is mapped,
+ * anything else is decoded whole through the decoded audio cache, which shares
+ * it with every other track of the same file. Overlapping clips are mixed, so
+ * their fades crossfade.
+ *
+ * A MemoryTrack plays the timeline like it would a file; see
+ * MemoryTrack::openClips().
+ */
+class ClipTimeline {
+public:
+    // Copies the clips; nothing is opened yet.
+    ClipTimeline(const Clip *clips, int count);
+    ~ClipTimeline();
+
+    /**
+     * Maps or decodes every source file. Returns false if one can't be played
+     * from memory: not a WAV, and too long for, or left out of, the decoded
+     * audio budget. Call from a thread that may block.
+     */
+    bool load(DecodedAudioCache *decodedAudio, int sampleRate);
+
+    // End of the last clip on the timeline. Clips played to the end of their file count once loaded.
+    long long getDuration() const;
+
+    int getClipsCount() const;
+    // The clip as played; its path is valid while the timeline is.
+    void getClip(int index, Clip *clip) const;
+
+    // Audio thread. Writes the mix of the clips from timeline sample from, silence between them.
+    void render(float *output, long long from, unsigned int numberOfSamples);
+
+private:
+    struct Source {
+        char *path;
+        MemoryTrack *memory;
+        DecodedAudio *decoded;
+    };
+    struct Entry {
+        int source;
+        long long sourceOffset;
+        long long timelineStart;
+        long long length;
+        long long fade;
+    };
+
+    DecodedAudioCache *decodedAudio = NULL;
+    Source *sources = NULL;
+    int sourcesCount = 0;
+    Entry *entries = NULL;
+    int entriesCount = 0;
+    float scratch[CLIP_RENDER_CHUNK * 2];
+
+    void mixEntry(const Entry &entry, float *output, long long from, unsigned int numberOfSamples);
+};
+
+#endif //AUDIO_CLIPTIMELINE_H
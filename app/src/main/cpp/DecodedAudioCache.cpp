@@ -0,0 +1,168 @@
+#include "DecodedAudioCache.h"
+#include "Log.h"
+#include <SuperpoweredDecoder.h>
+#include <SuperpoweredSimple.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Frames asked from the decoder per call, at least one frame of any codec it reads.
+#define DECODE_CHUNK_FRAMES 4096
+// Room for a decoder whose duration was an estimate (MP3 without a header says so).
+#define DECODE_SLACK_FRAMES 8192
+
+enum DecodedAudioState {
+    DECODED_AUDIO_PENDING,
+    DECODED_AUDIO_DECODING,
+    DECODED_AUDIO_READY,
+    DECODED_AUDIO_FAILED,
+};
+
+DecodedAudioCache::DecodedAudioCache(int sampleRate) : sampleRate(sampleRate), budget(DECODED_AUDIO_BUDGET_BYTES) {
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&stateChanged, NULL);
+}
+
+DecodedAudioCache::~DecodedAudioCache() {
+    // Every track is freed by now; nothing should be left.
+    while (entries != NULL) {
+        DecodedAudio *audio = entries;
+        entries = audio->next;
+        delete audio->decoder;
+        free(audio->samples);
+        PlayerCache::release(&audio->source);
+        delete audio;
+    }
+    pthread_cond_destroy(&stateChanged);
+    pthread_mutex_destroy(&mutex);
+}
+
+void DecodedAudioCache::setBudget(long long bytes) {
+    pthread_mutex_lock(&mutex);
+    budget = bytes > 0 ? bytes : 0;
+    pthread_mutex_unlock(&mutex);
+}
+
+DecodedAudio *DecodedAudioCache::acquire(const PlayerSource &source) {
+    if (source.path == NULL) {
+        return NULL;
+    }
+    pthread_mutex_lock(&mutex);
+    for (DecodedAudio *audio = entries; audio != NULL; audio = audio->next) {
+        if (audio->state != DECODED_AUDIO_FAILED && PlayerCache::sameVersion(audio->source, source)) {
+            audio->references++;
+            pthread_mutex_unlock(&mutex);
+            return audio;
+        }
+    }
+    if (budget == 0) {
+        pthread_mutex_unlock(&mutex);
+        return NULL;
+    }
+
+    SuperpoweredDecoder *decoder = new SuperpoweredDecoder();
+    const char *error = decoder->open(source.path, false, source.fileOffset, source.fileSize);
+    long long capacity = error == NULL ? decoder->durationSamples + DECODE_SLACK_FRAMES : 0;
+    size_t bytes = (size_t)(capacity + 16) * sizeof(float) * 2;
+    if (error != NULL || decoder->samplerate != (unsigned int)sampleRate ||
+        decoder->durationSamples > (long long)DECODED_AUDIO_MAX_SECONDS * sampleRate ||
+        used + (long long)bytes > budget) {
+        pthread_mutex_unlock(&mutex);
+        delete decoder;
+        return NULL;
+    }
+    float *samples = (float *)memalign(16, bytes);
+    if (samples == NULL) {
+        pthread_mutex_unlock(&mutex);
+        delete decoder;
+        return NULL;
+    }
+
+    DecodedAudio *audio = new DecodedAudio();
+    audio->cache = this;
+    audio->source = source;
+    audio->source.path = strdup(source.path);
+    audio->decoder = decoder;
+    audio->samples = samples;
+    audio->capacity = capacity;
+    audio->frames = 0;
+    audio->bytes = bytes;
+    audio->references = 1;
+    audio->state = DECODED_AUDIO_PENDING;
+    audio->next = entries;
+    entries = audio;
+    used += (long long)bytes;
+    pthread_mutex_unlock(&mutex);
+    return audio;
+}
+
+bool DecodedAudioCache::load(DecodedAudio *audio) {
+    pthread_mutex_lock(&mutex);
+    if (audio->state == DECODED_AUDIO_PENDING) {
+        audio->state = DECODED_AUDIO_DECODING;
+        pthread_mutex_unlock(&mutex);
+        bool success = decode(audio);
+        pthread_mutex_lock(&mutex);
+        audio->state = success ? DECODED_AUDIO_READY : DECODED_AUDIO_FAILED;
+        pthread_cond_broadcast(&stateChanged);
+    }
+    while (audio->state == DECODED_AUDIO_DECODING) {
+        pthread_cond_wait(&stateChanged, &mutex); // another track of the same file decodes it
+    }
+    bool ready = audio->state == DECODED_AUDIO_READY;
+    pthread_mutex_unlock(&mutex);
+    return ready;
+}
+
+void DecodedAudioCache::release(DecodedAudio *audio) {
+    pthread_mutex_lock(&mutex);
+    if (--audio->references > 0) {
+        pthread_mutex_unlock(&mutex);
+        return;
+    }
+    for (DecodedAudio **link = &entries; *link != NULL; link = &(*link)->next) {
+        if (*link == audio) {
+            *link = audio->next;
+            break;
+        }
+    }
+    used -= (long long)audio->bytes;
+    pthread_mutex_unlock(&mutex);
+
+    delete audio->decoder;
+    free(audio->samples);
+    PlayerCache::release(&audio->source);
+    delete audio;
+}
+
+// Runs on the thread that loads the first track of the file, outside the mutex.
+bool DecodedAudioCache::decode(DecodedAudio *audio) {
+    SuperpoweredDecoder *decoder = audio->decoder;
+    short int *pcm = (short int *)malloc(DECODE_CHUNK_FRAMES * sizeof(short int) * 2 + 16384);
+    bool success = pcm != NULL;
+    while (success && audio->frames < audio->capacity) {
+        unsigned int frames = DECODE_CHUNK_FRAMES;
+        unsigned char status = decoder->decode(pcm, &frames);
+        if (status != SUPERPOWEREDDECODER_OK && status != SUPERPOWEREDDECODER_EOF) {
+            success = false;
+            break;
+        }
+        if (frames > audio->capacity - audio->frames) {
+            frames = (unsigned int)(audio->capacity - audio->frames);
+        }
+        SuperpoweredShortIntToFloat(pcm, audio->samples + audio->frames * 2, frames);
+        audio->frames += frames;
+        if (status == SUPERPOWEREDDECODER_EOF) {
+            break; // may come with the last samples
+        }
+    }
+    free(pcm);
+    audio->decoder = NULL;
+    delete decoder;
+    if (!success || audio->frames == 0) {
+        LOGI("decoding %s failed", audio->source.path);
+        return false;
+    }
+    LOGI("decoded %s: %lld samples", audio->source.path, audio->frames);
+    return true;
+}
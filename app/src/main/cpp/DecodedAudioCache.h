@@ -0,0 +1,79 @@
+//
+// Fully decoded track audio, shared between tracks.
+//
+
+#ifndef AUDIO_DECODEDAUDIOCACHE_H
+#define AUDIO_DECODEDAUDIOCACHE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include "PlayerCache.h"
+
+// Decoded audio kept in RAM at most, by default. 32 MB holds about 95 s of stereo float at 44.1 kHz.
+#define DECODED_AUDIO_BUDGET_BYTES (32LL * 1024 * 1024)
+// Longer files are streamed whatever the budget.
+#define DECODED_AUDIO_MAX_SECONDS 30
+
+class DecodedAudioCache;
+class SuperpoweredDecoder;
+
+/**
+ * One file decoded to interleaved stereo float at the engine sample rate.
+ * Every track playing the file holds a reference; the samples are freed with
+ * the last one.
+ */
+struct DecodedAudio {
+    DecodedAudioCache *cache;
+    PlayerSource source;
+    SuperpoweredDecoder *decoder; // until decoded
+    float *samples;               // 16-byte aligned
+    long long capacity;           // frames reserved
+    long long frames;             // frames decoded
+    size_t bytes;
+    int references;
+    int state;
+    DecodedAudio *next;
+};
+
+/**
+ * Decodes short files whole, once, so their tracks play from RAM instead of
+ * streaming through a decoder on every pass. Files longer than
+ * DECODED_AUDIO_MAX_SECONDS, at another sample rate, or that don't fit in
+ * what is left of the memory budget are left to stream.
+ */
+class DecodedAudioCache {
+public:
+    DecodedAudioCache(int sampleRate);
+    ~DecodedAudioCache();
+
+    // Bytes of decoded audio to keep at most; 0 streams every file. Applies to files acquired from now on.
+    void setBudget(long long bytes);
+
+    /**
+     * Returns a reference to the decoded audio of source, shared with any
+     * track already playing it, or NULL if the file should stream. The
+     * samples may not be decoded yet: see load(). Never blocks on decoding.
+     */
+    DecodedAudio *acquire(const PlayerSource &source);
+
+    /**
+     * Decodes the audio unless that is already done or under way on another
+     * thread, in which case it waits. Returns false if decoding failed. Call
+     * from a thread that may block.
+     */
+    bool load(DecodedAudio *audio);
+
+    void release(DecodedAudio *audio);
+
+private:
+    pthread_mutex_t mutex;
+    pthread_cond_t stateChanged;
+    int sampleRate;
+    long long budget;
+    long long used = 0;
+    DecodedAudio *entries = NULL;
+
+    bool decode(DecodedAudio *audio);
+};
+
+#endif //AUDIO_DECODEDAUDIOCACHE_H
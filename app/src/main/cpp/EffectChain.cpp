@@ -0,0 +1,135 @@
+//
+// Insert effects of one track, run on its player output before the summing bus.
+//
+
+#include "EffectChain.h"
+#include <SuperpoweredFilter.h>
+#include <SuperpoweredCompressor.h>
+#include <SuperpoweredNBandEQ.h>
+#include <SuperpoweredReverb.h>
+#include <SuperpoweredSimple.h>
+#include <string.h>
+
+EffectChain::EffectChain(const Effect *effects, int count, unsigned int sampleRate) {
+    static float frequencies[] = EFFECT_EQ_FREQUENCIES;
+    for (int i = 0; i < count && this->count < EFFECT_CHAIN_CAPACITY; i++) {
+        Node &node = nodes[this->count];
+        node.type = effects[i].type;
+        switch (node.type) {
+            case EFFECT_LOWPASS:
+                node.fx = new SuperpoweredFilter(SuperpoweredFilter_Resonant_Lowpass, sampleRate);
+                break;
+            case EFFECT_HIGHPASS:
+                node.fx = new SuperpoweredFilter(SuperpoweredFilter_Resonant_Highpass, sampleRate);
+                break;
+            case EFFECT_PARAMETRIC:
+                node.fx = new SuperpoweredFilter(SuperpoweredFilter_Parametric, sampleRate);
+                break;
+            case EFFECT_COMPRESSOR:
+                node.fx = new SuperpoweredCompressor(sampleRate);
+                break;
+            case EFFECT_EQ:
+                node.fx = new SuperpoweredNBandEQ(sampleRate, frequencies);
+                break;
+            case EFFECT_REVERB:
+                node.fx = new SuperpoweredReverb(sampleRate);
+                break;
+            default:
+                continue;
+        }
+        node.ringing = false;
+        memcpy(node.parameters, effects[i].parameters, sizeof(node.parameters));
+        apply(node);
+        node.fx->enable(effects[i].enabled);
+        this->count++;
+    }
+}
+
+EffectChain::~EffectChain() {
+    for (int i = 0; i < count; i++) {
+        delete nodes[i].fx;
+    }
+}
+
+int EffectChain::getCount() const {
+    return count;
+}
+
+void EffectChain::setParameter(int effect, int parameter, float value) {
+    if (effect < 0 || effect >= count || parameter < 0 || parameter >= EFFECT_PARAMETERS) {
+        return;
+    }
+    nodes[effect].parameters[parameter] = value;
+    apply(nodes[effect]);
+}
+
+void EffectChain::setEnabled(int effect, bool enabled) {
+    if (effect >= 0 && effect < count) {
+        nodes[effect].fx->enable(enabled);
+    }
+}
+
+// Hands the node's parameters to its effect.
+void EffectChain::apply(Node &node) {
+    const float *parameters = node.parameters;
+    switch (node.type) {
+        case EFFECT_LOWPASS:
+        case EFFECT_HIGHPASS:
+            ((SuperpoweredFilter *)node.fx)->setResonantParameters(parameters[0], parameters[1]);
+            break;
+        case EFFECT_PARAMETRIC:
+            ((SuperpoweredFilter *)node.fx)->setParametricParameters(parameters[0], parameters[1], parameters[2]);
+            break;
+        case EFFECT_COMPRESSOR: {
+            SuperpoweredCompressor *compressor = (SuperpoweredCompressor *)node.fx;
+            compressor->thresholdDb = parameters[0];
+            compressor->ratio = parameters[1];
+            compressor->attackSec = parameters[2];
+            compressor->releaseSec = parameters[3];
+            compressor->outputGainDb = parameters[4];
+            compressor->wet = parameters[5];
+            break;
+        }
+        case EFFECT_EQ:
+            for (int band = 0; band < EFFECT_PARAMETERS; band++) {
+                ((SuperpoweredNBandEQ *)node.fx)->setBand((unsigned int)band, parameters[band]);
+            }
+            break;
+        case EFFECT_REVERB: {
+            SuperpoweredReverb *reverb = (SuperpoweredReverb *)node.fx;
+            reverb->setMix(parameters[0]);
+            reverb->setRoomSize(parameters[1]);
+            reverb->setDamp(parameters[2]);
+            reverb->setWidth(parameters[3]);
+            break;
+        }
+    }
+}
+
+bool EffectChain::process(float *buffer, unsigned int numberOfSamples, bool hasAudio) {
+    bool cleared = false;
+    for (int i = 0; i < count; i++) {
+        Node &node = nodes[i];
+        if (!node.fx->enabled) {
+            continue;
+        }
+        if (!hasAudio) {
+            if (!node.ringing) {
+                continue; // silence in, silence out
+            }
+            if (!cleared) {
+                memset(buffer, 0, numberOfSamples * sizeof(float) * 2);
+                cleared = true;
+            }
+        }
+        bool output = node.fx->process(buffer, buffer, numberOfSamples);
+        if (hasAudio) {
+            node.ringing = true;
+        } else {
+            // Some effects report output for as long as they are on, so the level decides as well.
+            node.ringing = output && SuperpoweredPeak(buffer, numberOfSamples * 2) > EFFECT_TAIL_FLOOR;
+            hasAudio = node.ringing;
+        }
+    }
+    return hasAudio;
+}
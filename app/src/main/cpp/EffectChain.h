@@ -0,0 +1,77 @@
+//
+// Insert effects of one track, run on its player output before the summing bus.
+//
+
+#ifndef AUDIO_EFFECTCHAIN_H
+#define AUDIO_EFFECTCHAIN_H
+
+class SuperpoweredFX;
+
+// Effects a chain holds at most.
+#define EFFECT_CHAIN_CAPACITY 8
+#define EFFECT_PARAMETERS 10
+// Output below this peak, with a silent input, is the end of a tail.
+#define EFFECT_TAIL_FLOOR 0.00001f
+
+/**
+ * The effects and what their parameters mean, in order. Values are clamped
+ * by the SDK to its ranges.
+ */
+enum EffectType {
+    EFFECT_LOWPASS,    // frequency in Hz, resonance from 0.1 to 1
+    EFFECT_HIGHPASS,   // frequency in Hz, resonance from 0.1 to 1
+    EFFECT_PARAMETRIC, // frequency in Hz, width in octaves, gain in dB
+    EFFECT_COMPRESSOR, // threshold in dB, ratio of 1.5, 2, 3, 4, 5 or 10, attack in s, release in s, output gain in dB, wet from 0 to 1
+    EFFECT_EQ,         // gain in dB of each of the EFFECT_EQ_FREQUENCIES bands
+    EFFECT_REVERB,     // mix from 0 to 1, room size from 0 to 1, damp from 0 to 1, width from 0 to 1
+};
+
+// Centre frequencies of the EFFECT_EQ bands, 0-terminated.
+#define EFFECT_EQ_FREQUENCIES {31.25f, 62.5f, 125.f, 250.f, 500.f, 1000.f, 2000.f, 4000.f, 8000.f, 16000.f, 0.f}
+
+struct Effect {
+    EffectType type;
+    bool enabled;
+    float parameters[EFFECT_PARAMETERS];
+};
+
+/**
+ * A chain of insert effects, built whole on a control thread and handed to
+ * the audio thread, which only ever calls process(). Nothing is allocated
+ * after construction. Parameters and bypass may be changed from a control
+ * thread while the chain plays: the SDK effects read them once per block.
+ */
+class EffectChain {
+public:
+    EffectChain(const Effect *effects, int count, unsigned int sampleRate);
+    ~EffectChain();
+
+    int getCount() const;
+
+    void setParameter(int effect, int parameter, float value);
+    void setEnabled(int effect, bool enabled);
+
+    /**
+     * Runs the effects in order on the interleaved stereo buffer, in place.
+     * A bypassed effect costs a flag check. On a silent block, hasAudio
+     * false, only the effects still ringing out are run, on silence, until
+     * they report nothing more to play. Returns whether the buffer holds
+     * audio afterwards.
+     */
+    bool process(float *buffer, unsigned int numberOfSamples, bool hasAudio);
+
+private:
+    struct Node {
+        EffectType type;
+        SuperpoweredFX *fx;
+        bool ringing; // has been fed audio and may still have a tail
+        float parameters[EFFECT_PARAMETERS];
+    };
+
+    Node nodes[EFFECT_CHAIN_CAPACITY];
+    int count = 0;
+
+    static void apply(Node &node);
+};
+
+#endif //AUDIO_EFFECTCHAIN_H
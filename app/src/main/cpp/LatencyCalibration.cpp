@@ -0,0 +1,113 @@
+#include "LatencyCalibration.h"
+#include <math.h>
+#include <string.h>
+
+#define LATENCY_NOISE_MS 250        // listen to the room before the first click
+#define LATENCY_LISTEN_MS 1000      // longest round trip looked for
+#define LATENCY_SETTLE_MS 250       // lets the click and its echoes die down before the next one
+#define LATENCY_MIN_THRESHOLD 0.06f // of full scale
+#define LATENCY_PULSE_FRAMES 16
+#define LATENCY_PULSE_AMPLITUDE 0.73f
+
+LatencyCalibration::LatencyCalibration(int sampleRate) : sampleRate(sampleRate) {}
+
+void LatencyCalibration::start() {
+    state = STATE_NOISE;
+    clock = stateStart = 0;
+    noisePeak = 0;
+    pulses = hitsCount = 0;
+    result = -1;
+}
+
+void LatencyCalibration::cancel() {
+    state = STATE_IDLE;
+    result = -1;
+}
+
+bool LatencyCalibration::isRunning() const {
+    return state != STATE_IDLE;
+}
+
+int LatencyCalibration::getResult() const {
+    return result;
+}
+
+bool LatencyCalibration::process(float *audioIO, unsigned int numberOfSamples, int inputChannels) {
+    if (state == STATE_IDLE) {
+        return false;
+    }
+    long long msToSamples = sampleRate / 1000;
+
+    // The input of this callback was captured before its output is played, so read it first.
+    for (unsigned int n = 0; n < numberOfSamples; n++) {
+        float level = fabsf(audioIO[n * inputChannels]);
+        float right = fabsf(audioIO[n * inputChannels + inputChannels - 1]);
+        if (right > level) level = right;
+        if (state == STATE_NOISE) {
+            if (level > noisePeak) noisePeak = level;
+        } else if (state == STATE_LISTEN && level > threshold) {
+            hits[hitsCount++] = (int)(clock + n - pulseClock);
+            state = STATE_SETTLE;
+            stateStart = clock + n;
+        }
+    }
+    memset(audioIO, 0, numberOfSamples * sizeof(float) * 2);
+
+    switch (state) {
+        case STATE_NOISE:
+            if (clock + numberOfSamples - stateStart >= LATENCY_NOISE_MS * msToSamples) {
+                threshold = noisePeak * 4;
+                if (threshold < LATENCY_MIN_THRESHOLD) threshold = LATENCY_MIN_THRESHOLD;
+                state = STATE_PULSE;
+            }
+            break;
+        case STATE_LISTEN:
+            if (clock + numberOfSamples - pulseClock >= LATENCY_LISTEN_MS * msToSamples) {
+                state = STATE_SETTLE; // missed
+                stateStart = clock + numberOfSamples;
+            }
+            break;
+        case STATE_SETTLE:
+            if (clock + numberOfSamples - stateStart >= LATENCY_SETTLE_MS * msToSamples) {
+                if (pulses == LATENCY_PULSES) {
+                    finish();
+                    clock += numberOfSamples;
+                    return true;
+                }
+                state = STATE_PULSE;
+            }
+            break;
+        default:
+            break;
+    }
+
+    if (state == STATE_PULSE) {
+        // A short square burst: a sharp onset that survives the device's filtering.
+        for (unsigned int n = 0; n < LATENCY_PULSE_FRAMES && n < numberOfSamples; n++) {
+            float sample = (n & 2) ? -LATENCY_PULSE_AMPLITUDE : LATENCY_PULSE_AMPLITUDE;
+            audioIO[n * 2] = audioIO[n * 2 + 1] = sample;
+        }
+        pulseClock = clock;
+        pulses++;
+        state = STATE_LISTEN;
+    }
+    clock += numberOfSamples;
+    return false;
+}
+
+void LatencyCalibration::finish() {
+    state = STATE_IDLE;
+    result = -1;
+    if (hitsCount * 2 <= LATENCY_PULSES) {
+        return;
+    }
+    // Median of the clicks that came back.
+    for (int i = 1; i < hitsCount; i++) {
+        for (int j = i; j > 0 && hits[j - 1] > hits[j]; j--) {
+            int swap = hits[j];
+            hits[j] = hits[j - 1];
+            hits[j - 1] = swap;
+        }
+    }
+    result = hits[hitsCount / 2];
+}
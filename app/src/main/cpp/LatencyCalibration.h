@@ -0,0 +1,58 @@
+#ifndef AUDIO_LATENCYCALIBRATION_H
+#define AUDIO_LATENCYCALIBRATION_H
+
+#define LATENCY_PULSES 5
+
+/**
+ * Measures the round trip from the samples the engine writes to the output to
+ * the samples it reads back from the input: the same delay by which a take
+ * recorded against the players ends up late.
+ *
+ * After a short listen to the noise floor it plays a few clicks, one at a
+ * time, and times when each comes back above the noise. The result is the
+ * median of the clicks that were heard, in samples. Everything runs on the
+ * audio thread, inside process(); there is no allocation.
+ */
+class LatencyCalibration {
+public:
+    LatencyCalibration(int sampleRate);
+
+    void start();
+    void cancel();
+    bool isRunning() const;
+
+    /**
+     * Reads the input in audioIO, of inputChannels, and replaces it with the
+     * stereo calibration signal. Returns true on the callback that finishes
+     * the measurement.
+     */
+    bool process(float *audioIO, unsigned int numberOfSamples, int inputChannels);
+
+    // Round trip in samples, or -1 if too few clicks were heard.
+    int getResult() const;
+
+private:
+    enum State {
+        STATE_IDLE,
+        STATE_NOISE,
+        STATE_PULSE,
+        STATE_LISTEN,
+        STATE_SETTLE,
+    };
+
+    int sampleRate;
+    State state = STATE_IDLE;
+    long long clock = 0;        // samples since start()
+    long long stateStart = 0;
+    long long pulseClock = 0;
+    float noisePeak = 0;
+    float threshold = 0;
+    int pulses = 0;
+    int hits[LATENCY_PULSES];
+    int hitsCount = 0;
+    int result = -1;
+
+    void finish();
+};
+
+#endif //AUDIO_LATENCYCALIBRATION_H
@@ -0,0 +1,23 @@
+//
+// Created by Dmitry R. on 9/26/17.
+//
+
+#ifndef AUDIO_LOG_H
+#define AUDIO_LOG_H
+
+#ifdef __ANDROID__
+
+#include <android/log.h>
+
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, "AudioEngine", __VA_ARGS__)
+
+#else
+
+#include <stdio.h>
+
+// Host builds have no logcat, engine messages go to stderr instead.
+#define LOGI(...) do { fprintf(stderr, "AudioEngine: " __VA_ARGS__); fputc('\n', stderr); } while (0)
+
+#endif
+
+#endif //AUDIO_LOG_H
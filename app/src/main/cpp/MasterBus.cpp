@@ -0,0 +1,81 @@
+//
+// Output stage between the summing bus and the conversion to 16 bits.
+//
+
+#include "MasterBus.h"
+#include <SuperpoweredLimiter.h>
+#include <SuperpoweredClipper.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+MasterBus::MasterBus(unsigned int sampleRate) : sampleRate(sampleRate) {
+    silence = (float *)memalign(16, MASTER_BUS_SETTLE_BLOCK * sizeof(float) * 2);
+    scratch = (float *)memalign(16, MASTER_BUS_SETTLE_BLOCK * sizeof(float) * 2);
+    memset(silence, 0, MASTER_BUS_SETTLE_BLOCK * sizeof(float) * 2);
+    limiter = new SuperpoweredLimiter(sampleRate);
+    clipper = new SuperpoweredClipper();
+    clipper->thresholdDb = MASTER_BUS_CLIPPER_THRESHOLD_DB;
+    clipper->maximumDb = MASTER_BUS_CLIPPER_MAXIMUM_DB;
+    clear();
+}
+
+MasterBus::~MasterBus() {
+    delete limiter;
+    delete clipper;
+    free(silence);
+    free(scratch);
+}
+
+void MasterBus::setEnabled(bool enabled) {
+    if (enabled != this->enabled) {
+        this->enabled = enabled;
+        clear(); // nothing stale comes out when it is turned back on
+    }
+}
+
+bool MasterBus::isEnabled() const {
+    return enabled;
+}
+
+int MasterBus::getLatency() const {
+    return enabled ? MASTER_BUS_LATENCY : 0;
+}
+
+void MasterBus::process(float *buffer, unsigned int numberOfSamples) {
+    if (!enabled || numberOfSamples == 0) {
+        return;
+    }
+    if (numberOfSamples >= MASTER_BUS_LATENCY) {
+        limiter->process(buffer, buffer, numberOfSamples);
+        holding = true;
+    }
+    clipper->process(buffer, buffer, (numberOfSamples + 3) & ~3u); // stateless, the padding is harmless
+}
+
+bool MasterBus::drain(float *buffer, unsigned int numberOfSamples) {
+    if (!enabled || !holding || numberOfSamples < MASTER_BUS_LATENCY) {
+        return false;
+    }
+    memset(buffer, 0, numberOfSamples * sizeof(float) * 2);
+    process(buffer, numberOfSamples);
+    holding = false;
+    return true;
+}
+
+void MasterBus::clear() {
+    limiter->reset();
+    limiter->ceilingDb = limiter->thresholdDb = 0.f; // any other pair also scales the mix below them
+    limiter->releaseSec = MASTER_BUS_RELEASE_SEC;
+    limiter->enable(true);
+    for (unsigned int frames = sampleRate * MASTER_BUS_SETTLE_MS / 1000; frames > 0;) {
+        unsigned int block = frames < MASTER_BUS_SETTLE_BLOCK ? frames : MASTER_BUS_SETTLE_BLOCK;
+        if (block < MASTER_BUS_LATENCY) {
+            block = MASTER_BUS_LATENCY;
+        }
+        limiter->process(silence, scratch, block);
+        frames -= block < frames ? block : frames;
+    }
+    limiter->enable(enabled);
+    holding = false;
+}
@@ -0,0 +1,73 @@
+//
+// Output stage between the summing bus and the device or bounce file.
+//
+
+#ifndef AUDIO_MASTERBUS_H
+#define AUDIO_MASTERBUS_H
+
+class SuperpoweredLimiter;
+class SuperpoweredClipper;
+
+#define MASTER_BUS_RELEASE_SEC 0.1f
+// The clipper leaves the mix alone below this level and bends what is above it, up to
+// MASTER_BUS_CLIPPER_MAXIMUM_DB, into what is left below full scale.
+#define MASTER_BUS_CLIPPER_THRESHOLD_DB -1.f
+#define MASTER_BUS_CLIPPER_MAXIMUM_DB 6.f
+// Frames the limiter looks ahead, by which it delays the mix. It needs blocks at least this long.
+#define MASTER_BUS_LATENCY 32
+// A limiter fresh from a reset outputs garbage, then settles on unity gain for about this long.
+#define MASTER_BUS_SETTLE_MS 750
+#define MASTER_BUS_SETTLE_BLOCK 512
+
+/**
+ * Keeps a loud mix from hard-clipping: a limiter holds peaks to full scale,
+ * then a soft clipper rounds off the top dB and whatever still overshoots.
+ * A mix that doesn't reach full scale passes through the limiter within
+ * 0.05 dB, delayed by MASTER_BUS_LATENCY frames. Disabled, the bus does
+ * nothing and adds no delay.
+ *
+ * Owned by the thread that renders: the audio thread, or the bounce thread
+ * while live playback is stopped.
+ */
+class MasterBus {
+public:
+    MasterBus(unsigned int sampleRate);
+    ~MasterBus();
+
+    void setEnabled(bool enabled);
+    bool isEnabled() const;
+
+    // Frames the bus delays the mix by as it is set now.
+    int getLatency() const;
+
+    /**
+     * Processes the interleaved stereo buffer in place. The buffer must hold
+     * numberOfSamples rounded up to a multiple of 4 frames. Blocks shorter
+     * than MASTER_BUS_LATENCY are only clipped.
+     */
+    void process(float *buffer, unsigned int numberOfSamples);
+
+    /**
+     * Call instead of process() once the mix has stopped: writes the end of
+     * the mix the limiter still holds, then silence. Returns false, and
+     * leaves the buffer alone, if there is nothing left to play out.
+     */
+    bool drain(float *buffer, unsigned int numberOfSamples);
+
+    /**
+     * Resets the limiter and feeds it silence until it has settled, e.g.
+     * before a bounce. Takes well under a millisecond.
+     */
+    void clear();
+
+private:
+    SuperpoweredLimiter *limiter;
+    SuperpoweredClipper *clipper;
+    unsigned int sampleRate;
+    float *silence;
+    float *scratch;
+    bool enabled = false;
+    bool holding = false; // the limiter holds the end of a mix that has yet to be played out
+};
+
+#endif //AUDIO_MASTERBUS_H
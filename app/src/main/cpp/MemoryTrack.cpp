@@ -0,0 +1,232 @@
+#include "MemoryTrack.h"
+#include "ClipTimeline.h"
+#include "Log.h"
+#include <SuperpoweredSimple.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0
+#endif
+
+#define WAVE_FORMAT_PCM 1
+#define WAVE_FORMAT_IEEE_FLOAT 3
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+
+static unsigned int readLittleEndian(const unsigned char *source, int bytes) {
+    unsigned int value = 0;
+    for (int i = bytes - 1; i >= 0; i--) {
+        value = (value << 8) | source[i];
+    }
+    return value;
+}
+
+MemoryTrack::MemoryTrack(void *clientData, SuperpoweredAdvancedAudioPlayerCallback callback) : clientData(clientData),
+                                                                                                   callback(callback) {}
+
+MemoryTrack::~MemoryTrack() {
+    if (mapping != NULL) {
+        munmap(mapping, mappingSize);
+    }
+}
+
+bool MemoryTrack::open(const char *path, int fileOffset, int fileSize, int sampleRate) {
+    int file = ::open(path, O_RDONLY);
+    if (file < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(file, &info) != 0 || fileOffset < 0 || (fileOffset & 1) || fileOffset >= info.st_size) {
+        close(file);
+        return false;
+    }
+    long long regionSize = fileSize > 0 ? fileSize : info.st_size - fileOffset;
+    if (fileOffset + regionSize > info.st_size) {
+        regionSize = info.st_size - fileOffset;
+    }
+    // mmap wants a page aligned offset: map from the page the region starts in.
+    long long pageSize = sysconf(_SC_PAGESIZE);
+    long long mapStart = fileOffset / pageSize * pageSize;
+    mappingSize = (size_t)(fileOffset - mapStart + regionSize);
+    mapping = mmap(NULL, mappingSize, PROT_READ, MAP_PRIVATE | MAP_POPULATE, file, (off_t)mapStart);
+    close(file);
+    if (mapping == MAP_FAILED) {
+        mapping = NULL;
+        return false;
+    }
+    // Keep the pages resident, so the audio thread doesn't fault them in from disk.
+    madvise(mapping, mappingSize, MADV_WILLNEED);
+
+    const unsigned char *region = (const unsigned char *)mapping + (fileOffset - mapStart);
+    if (regionSize < 12 || memcmp(region, "RIFF", 4) != 0 || memcmp(region + 8, "WAVE", 4) != 0) {
+        return false;
+    }
+    bool formatFound = false;
+    long long chunk = 12;
+    while (chunk + 8 <= regionSize) {
+        const unsigned char *header = region + chunk;
+        long long chunkSize = readLittleEndian(header + 4, 4);
+        long long body = chunk + 8;
+        if (memcmp(header, "fmt ", 4) == 0 && chunkSize >= 16 && body + 16 <= regionSize) {
+            unsigned int format = readLittleEndian(region + body, 2);
+            if (format == WAVE_FORMAT_EXTENSIBLE && chunkSize >= 26 && body + 26 <= regionSize) {
+                format = readLittleEndian(region + body + 24, 2); // the sub format GUID starts with the format tag
+            }
+            numberOfChannels = (int)readLittleEndian(region + body + 2, 2);
+            unsigned int rate = readLittleEndian(region + body + 4, 4);
+            unsigned int bitsPerSample = readLittleEndian(region + body + 14, 2);
+            bool pcm = format == WAVE_FORMAT_PCM && (bitsPerSample == 16 || bitsPerSample == 24);
+            bool isFloat = format == WAVE_FORMAT_IEEE_FLOAT && bitsPerSample == 32;
+            if ((!pcm && !isFloat) || (numberOfChannels != 1 && numberOfChannels != 2) || rate != (unsigned int)sampleRate) {
+                return false;
+            }
+            sampleFormat = isFloat ? SAMPLE_FLOAT : bitsPerSample == 24 ? SAMPLE_PCM24 : SAMPLE_PCM16;
+            bytesPerSample = (int)bitsPerSample / 8;
+            formatFound = true;
+        } else if (memcmp(header, "data", 4) == 0) {
+            if (!formatFound) {
+                return false;
+            }
+            // A take cut short before its header was finalized has a size of 0: use what is there.
+            if (chunkSize == 0 || body + chunkSize > regionSize) {
+                chunkSize = regionSize - body;
+            }
+            samples = region + body;
+            durationSamples = chunkSize / (numberOfChannels * (long long)bytesPerSample);
+            return durationSamples > 0;
+        }
+        chunk = body + chunkSize + (chunkSize & 1);
+    }
+    LOGI("no PCM data in %s", path);
+    return false;
+}
+
+void MemoryTrack::openDecoded(const float *decodedSamples, long long numberOfSamples) {
+    decoded = decodedSamples;
+    numberOfChannels = 2;
+    durationSamples = numberOfSamples;
+}
+
+void MemoryTrack::openClips(ClipTimeline *timeline) {
+    clips = timeline;
+    numberOfChannels = 2;
+    durationSamples = timeline->getDuration();
+}
+
+void MemoryTrack::play() {
+    playing = true;
+}
+
+void MemoryTrack::pause() {
+    playing = false;
+}
+
+void MemoryTrack::setPosition(long long sample, bool andStop) {
+    if (sample < 0) sample = 0;
+    if (sample > durationSamples) sample = durationSamples;
+    position = sample;
+    if (andStop) {
+        playing = false;
+    }
+}
+
+void MemoryTrack::loopBetween(long long startSample, long long endSample) {
+    if (startSample < 0 || endSample <= startSample || endSample > durationSamples) {
+        exitLoop();
+        return;
+    }
+    loopStart = startSample;
+    loopEnd = endSample;
+    looping = true;
+}
+
+void MemoryTrack::exitLoop() {
+    looping = false;
+}
+
+int MemoryTrack::getChannels() const {
+    return numberOfChannels;
+}
+
+bool MemoryTrack::process(float *buffer, unsigned int numberOfSamples, int channels) {
+    if (!playing) {
+        return false;
+    }
+    unsigned int done = 0;
+    while (done < numberOfSamples) {
+        if (looping && position == loopEnd) {
+            position = loopStart; // no fade, the loop is seamless
+        }
+        bool wraps = looping && position < loopEnd;
+        long long end = wraps ? loopEnd : durationSamples;
+        unsigned int frames = numberOfSamples - done;
+        if (end - position < frames) {
+            frames = end > position ? (unsigned int)(end - position) : 0;
+        }
+        if (clips != NULL) {
+            clips->render(buffer + done * 2, position, frames);
+        } else {
+            convert(buffer + done * channels, position, frames, channels);
+        }
+        position += frames;
+        done += frames;
+        if (done == numberOfSamples) {
+            break;
+        }
+        if (wraps) {
+            continue;
+        }
+        memset(buffer + done * channels, 0, (numberOfSamples - done) * sizeof(float) * channels);
+        playing = false; // like a player asked to pause at its end
+        bool pauseAtEnd = true;
+        if (callback != NULL) {
+            callback(clientData, SuperpoweredAdvancedAudioPlayerEvent_EOF, &pauseAtEnd);
+        }
+        break;
+    }
+    return true;
+}
+
+void MemoryTrack::read(float *output, long long from, unsigned int numberOfSamples) const {
+    long long end = from + numberOfSamples;
+    long long start = from > 0 ? from : 0;
+    long long stop = end < durationSamples ? end : durationSamples;
+    if (start >= stop) {
+        memset(output, 0, numberOfSamples * sizeof(float) * 2);
+        return;
+    }
+    memset(output, 0, (size_t)(start - from) * sizeof(float) * 2);
+    convert(output + (start - from) * 2, start, (unsigned int)(stop - start), 2);
+    memset(output + (stop - from) * 2, 0, (size_t)(end - stop) * sizeof(float) * 2);
+}
+
+// 16-bit at the same scale as SuperpoweredShortIntToFloat, so a track sounds the same whichever
+// way it plays. A mono track played in stereo is converted into the start of output, then spread
+// from the end back, in place.
+void MemoryTrack::convert(float *output, long long from, unsigned int numberOfSamples, int outputChannels) const {
+    if (decoded != NULL) {
+        memcpy(output, decoded + from * 2, numberOfSamples * sizeof(float) * 2);
+        return;
+    }
+    const unsigned char *input = samples + from * numberOfChannels * bytesPerSample;
+    unsigned int count = numberOfSamples * numberOfChannels;
+    if (sampleFormat == SAMPLE_PCM16) {
+        const float scale = 1.f / 32767.f;
+        const short int *shorts = (const short int *)input;
+        for (unsigned int n = 0; n < count; n++) {
+            output[n] = shorts[n] * scale;
+        }
+    } else if (sampleFormat == SAMPLE_PCM24) {
+        Superpowered24bitToFloat((void *)input, output, numberOfSamples, (unsigned int)numberOfChannels);
+    } else {
+        memcpy(output, input, count * sizeof(float)); // the data chunk need not be aligned
+    }
+    if (numberOfChannels < outputChannels) {
+        for (unsigned int n = numberOfSamples; n-- > 0;) {
+            output[n * 2] = output[n * 2 + 1] = output[n];
+        }
+    }
+}
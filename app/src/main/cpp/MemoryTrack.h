@@ -0,0 +1,89 @@
+//
+// Tracks played straight from memory: a mapped WAV file, fully decoded audio or clips of those.
+//
+
+#ifndef AUDIO_MEMORYTRACK_H
+#define AUDIO_MEMORYTRACK_H
+
+#include <stddef.h>
+#include "SuperpoweredAdvancedAudioPlayer.h"
+
+// Sample formats of a mapped WAV.
+#define SAMPLE_PCM16 0
+#define SAMPLE_PCM24 1
+#define SAMPLE_FLOAT 2
+
+class ClipTimeline;
+
+/**
+ * Plays a track from samples already in memory, without a decoder: either a
+ * 16-bit or 24-bit PCM or 32-bit float WAV at the engine sample rate, such as
+ * a take in any RECORDER_FORMAT_*, mapped once so that process()
+ * converts straight from the mapped pages, or stereo float audio decoded
+ * whole beforehand, or a timeline of clips cut from either. There is no decoder thread, no internal buffer and no
+ * time-stretching, and seeks are sample accurate and take effect immediately,
+ * without a fade.
+ *
+ * Exposes the part of the SuperpoweredAdvancedAudioPlayer interface the engine
+ * uses, in samples instead of milliseconds. EOF is reported through the same
+ * player callback, from inside process(). Everything but open() may be called
+ * on the audio thread.
+ */
+class MemoryTrack {
+public:
+    bool playing = false;
+    bool looping = false;
+    long long durationSamples = 0;
+
+    MemoryTrack(void *clientData, SuperpoweredAdvancedAudioPlayerCallback callback);
+    ~MemoryTrack();
+
+    /**
+     * Maps the file, or fileSize bytes of it from fileOffset when fileSize is
+     * not 0, and checks its header. Returns false unless it is a mono or
+     * stereo 16-bit or 24-bit PCM or 32-bit float WAV at sampleRate; the
+     * caller then uses a player.
+     */
+    bool open(const char *path, int fileOffset, int fileSize, int sampleRate);
+
+    // Plays interleaved stereo float samples owned by the caller, which must outlive the track.
+    void openDecoded(const float *decodedSamples, long long numberOfSamples);
+
+    // Plays the clips of a loaded timeline owned by the caller, which must outlive the track.
+    void openClips(ClipTimeline *timeline);
+
+    void play();
+    void pause();
+    void setPosition(long long sample, bool andStop);
+    void loopBetween(long long startSample, long long endSample);
+    void exitLoop();
+
+    // 1 for a mono WAV, else 2: decoded audio and clips are stereo.
+    int getChannels() const;
+
+    // Writes numberOfSamples frames of channels, stereo or those of the track, to buffer. Returns
+    // false, leaving buffer alone, when paused.
+    bool process(float *buffer, unsigned int numberOfSamples, int channels = 2);
+
+    // Writes numberOfSamples stereo frames from sample from on, silence outside the track. Any thread.
+    void read(float *output, long long from, unsigned int numberOfSamples) const;
+
+private:
+    void *clientData;
+    SuperpoweredAdvancedAudioPlayerCallback callback;
+    void *mapping = NULL;
+    size_t mappingSize = 0;
+    const unsigned char *samples = NULL;
+    int sampleFormat = SAMPLE_PCM16;
+    int bytesPerSample = 2;
+    const float *decoded = NULL;
+    ClipTimeline *clips = NULL;
+    int numberOfChannels = 2;
+    long long position = 0;
+    long long loopStart = 0;
+    long long loopEnd = 0;
+
+    void convert(float *output, long long from, unsigned int numberOfSamples, int outputChannels) const;
+};
+
+#endif //AUDIO_MEMORYTRACK_H
@@ -0,0 +1,108 @@
+//
+// Summing bus for the engine's tracks.
+//
+
+#include "Mixer.h"
+#include <math.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MIXER_NEON
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#define MIXER_SSE
+#endif
+
+// Frames after the last full group of four, and every frame on targets without SIMD.
+static void mixStereoScalar(const MixerInput *inputs, int count, float *output, unsigned int from, unsigned int to) {
+    for (unsigned int frame = from; frame < to; frame++) {
+        float left = 0, right = 0;
+        for (int i = 0; i < count; i++) {
+            const float *in = inputs[i].buffer + frame * inputs[i].channels;
+            left += in[0] * (inputs[i].base[0] + inputs[i].step[0] * frame);
+            right += in[inputs[i].channels - 1] * (inputs[i].base[1] + inputs[i].step[1] * frame);
+        }
+        output[frame * 2] = left;
+        output[frame * 2 + 1] = right;
+    }
+}
+
+void mixStereo(MixerInput *inputs, int count, float *output, unsigned int numberOfSamples) {
+    if (numberOfSamples == 0) {
+        return;
+    }
+    // The gain of frame f is base + step * f, for both frames held in one vector.
+    for (int i = 0; i < count; i++) {
+        MixerInput &input = inputs[i];
+        float leftStep = (input.leftEnd - input.leftStart) / numberOfSamples;
+        float rightStep = (input.rightEnd - input.rightStart) / numberOfSamples;
+        input.base[0] = input.leftStart;
+        input.base[1] = input.rightStart;
+        input.base[2] = input.leftStart + leftStep;
+        input.base[3] = input.rightStart + rightStep;
+        input.step[0] = input.step[2] = leftStep;
+        input.step[1] = input.step[3] = rightStep;
+    }
+
+    unsigned int frame = 0;
+#if defined(MIXER_NEON)
+    for (; frame + 4 <= numberOfSamples; frame += 4) {
+        float32x4_t acc0 = vdupq_n_f32(0), acc1 = vdupq_n_f32(0);
+        float32x4_t position0 = vdupq_n_f32((float)frame), position1 = vdupq_n_f32((float)(frame + 2));
+        for (int i = 0; i < count; i++) {
+            float32x4_t in0, in1;
+            if (inputs[i].channels == 1) { // each sample to both sides
+                float32x4_t mono = vld1q_f32(inputs[i].buffer + frame);
+                float32x4x2_t both = vzipq_f32(mono, mono);
+                in0 = both.val[0];
+                in1 = both.val[1];
+            } else {
+                in0 = vld1q_f32(inputs[i].buffer + frame * 2);
+                in1 = vld1q_f32(inputs[i].buffer + frame * 2 + 4);
+            }
+            float32x4_t base = vld1q_f32(inputs[i].base), step = vld1q_f32(inputs[i].step);
+            acc0 = vmlaq_f32(acc0, in0, vmlaq_f32(base, step, position0));
+            acc1 = vmlaq_f32(acc1, in1, vmlaq_f32(base, step, position1));
+        }
+        vst1q_f32(output + frame * 2, acc0);
+        vst1q_f32(output + frame * 2 + 4, acc1);
+    }
+#elif defined(MIXER_SSE)
+    for (; frame + 4 <= numberOfSamples; frame += 4) {
+        __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+        __m128 position0 = _mm_set1_ps((float)frame), position1 = _mm_set1_ps((float)(frame + 2));
+        for (int i = 0; i < count; i++) {
+            __m128 in0, in1;
+            if (inputs[i].channels == 1) { // each sample to both sides
+                __m128 mono = _mm_load_ps(inputs[i].buffer + frame);
+                in0 = _mm_unpacklo_ps(mono, mono);
+                in1 = _mm_unpackhi_ps(mono, mono);
+            } else {
+                in0 = _mm_load_ps(inputs[i].buffer + frame * 2);
+                in1 = _mm_load_ps(inputs[i].buffer + frame * 2 + 4);
+            }
+            __m128 base = _mm_load_ps(inputs[i].base), step = _mm_load_ps(inputs[i].step);
+            acc0 = _mm_add_ps(acc0, _mm_mul_ps(in0, _mm_add_ps(base, _mm_mul_ps(step, position0))));
+            acc1 = _mm_add_ps(acc1, _mm_mul_ps(in1, _mm_add_ps(base, _mm_mul_ps(step, position1))));
+        }
+        _mm_storeu_ps(output + frame * 2, acc0);
+        _mm_storeu_ps(output + frame * 2 + 4, acc1);
+    }
+#endif
+    mixStereoScalar(inputs, count, output, frame, numberOfSamples);
+}
+
+int mixerChannels(int trackChannels, bool hasEffects) {
+    return trackChannels == 1 && !hasEffects ? 1 : 2;
+}
+
+void panGains(float volume, float pan, int channels, float *left, float *right) {
+    if (channels == 1) {
+        double angle = (pan + 1.0) * M_PI / 4;
+        *left = (float)(volume * cos(angle));
+        *right = (float)(volume * sin(angle));
+        return;
+    }
+    *left = volume * (pan > 0 ? 1.f - pan : 1.f);
+    *right = volume * (pan < 0 ? 1.f + pan : 1.f);
+}
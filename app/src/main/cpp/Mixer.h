@@ -0,0 +1,42 @@
+//
+// Summing bus for the engine's tracks.
+//
+
+#ifndef AUDIO_MIXER_H
+#define AUDIO_MIXER_H
+
+/**
+ * One track's contribution to a mix: its interleaved stereo buffer, or a mono
+ * one played into both sides, and the left/right gains to ramp between over
+ * the block. base and step are scratch space for mixStereo().
+ */
+struct MixerInput {
+    const float *buffer;
+    int channels;
+    float leftStart, rightStart;
+    float leftEnd, rightEnd;
+    float base[4] __attribute__((aligned(16)));
+    float step[4] __attribute__((aligned(16)));
+};
+
+/**
+ * Overwrites output with the sum of every input, each scaled by a linear ramp
+ * from its start gains to its end gains across numberOfSamples frames. Output
+ * is read and written once, whatever the number of inputs. Uses NEON or SSE
+ * when available. Input buffers must be 16-byte aligned, output need not be.
+ */
+void mixStereo(MixerInput *inputs, int count, float *output, unsigned int numberOfSamples);
+
+// Channels a track of trackChannels is mixed in: a mono track stays mono, unless its effects want stereo.
+int mixerChannels(int trackChannels, bool hasEffects);
+
+/**
+ * Left and right gains of a track mixed in channels at volume and pan, from
+ * -1 left to 1 right. A mono buffer is panned at constant power: -3 dB on
+ * both sides in the centre, volume on one side at the extremes. A stereo one
+ * keeps the balance law: volume on both channels in the centre. Neither law
+ * goes above volume.
+ */
+void panGains(float volume, float pan, int channels, float *left, float *right);
+
+#endif //AUDIO_MIXER_H
@@ -0,0 +1,72 @@
+#ifndef AUDIO_MPSCQUEUE_H
+#define AUDIO_MPSCQUEUE_H
+
+#include <atomic>
+
+/**
+ * Bounded multi-producer/single-consumer ring (Vyukov's sequence-per-cell
+ * design). Producers claim a cell with a CAS and never block or allocate, so
+ * the audio thread, player threads and control threads can all push into the
+ * same queue.
+ *
+ * Capacity must be a power of two.
+ */
+template <typename T, unsigned int Capacity>
+class MpscQueue {
+public:
+    MpscQueue() : enqueuePosition(0), dequeuePosition(0) {
+        static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+        for (unsigned int i = 0; i < Capacity; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // Any thread. Returns false if the queue is full.
+    bool push(const T &item) {
+        unsigned int position = enqueuePosition.load(std::memory_order_relaxed);
+        Cell *cell;
+        while (true) {
+            cell = &cells[position & (Capacity - 1)];
+            unsigned int sequence = cell->sequence.load(std::memory_order_acquire);
+            int difference = (int)(sequence - position);
+            if (difference == 0) {
+                if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = enqueuePosition.load(std::memory_order_relaxed);
+            }
+        }
+        cell->item = item;
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer thread only. Returns false if the queue is empty.
+    bool pop(T &item) {
+        unsigned int position = dequeuePosition.load(std::memory_order_relaxed);
+        Cell *cell = &cells[position & (Capacity - 1)];
+        unsigned int sequence = cell->sequence.load(std::memory_order_acquire);
+        if ((int)(sequence - (position + 1)) < 0) {
+            return false;
+        }
+        item = cell->item;
+        cell->sequence.store(position + Capacity, std::memory_order_release);
+        dequeuePosition.store(position + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+private:
+    struct Cell {
+        std::atomic<unsigned int> sequence;
+        T item;
+    };
+
+    Cell cells[Capacity];
+    std::atomic<unsigned int> enqueuePosition;
+    std::atomic<unsigned int> dequeuePosition;
+};
+
+#endif //AUDIO_MPSCQUEUE_H
@@ -0,0 +1,93 @@
+#include "PlayerCache.h"
+#include "AudioEngine.h"
+#include "Log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static bool sameFile(const PlayerSource &a, const PlayerSource &b) {
+    return a.fileOffset == b.fileOffset && a.fileSize == b.fileSize && strcmp(a.path, b.path) == 0;
+}
+
+bool PlayerCache::sameVersion(const PlayerSource &a, const PlayerSource &b) {
+    return a.path != NULL && b.path != NULL && sameFile(a, b) &&
+           a.modified == b.modified && a.diskSize == b.diskSize && a.inode == b.inode;
+}
+
+PlayerCache::PlayerCache(freeTrackFunction freeTrack) : freeTrack(freeTrack) {}
+
+PlayerCache::~PlayerCache() {
+    clear();
+}
+
+bool PlayerCache::describe(const char *path, int fileOffset, int fileSize, PlayerSource *source) {
+    struct stat info;
+    if (path == NULL || stat(path, &info) != 0) {
+        return false;
+    }
+    source->path = strdup(path);
+    source->fileOffset = fileOffset;
+    source->fileSize = fileSize;
+    source->modified = (long long)info.st_mtime;
+    source->diskSize = (long long)info.st_size;
+    source->inode = (unsigned long long)info.st_ino;
+    return source->path != NULL;
+}
+
+void PlayerCache::release(PlayerSource *source) {
+    free(source->path);
+    source->path = NULL;
+}
+
+void PlayerCache::park(PlayerWrapper *track) {
+    if (track->source.path == NULL) {
+        freeTrack(track);
+        return;
+    }
+    if (count == PLAYER_CACHE_CAPACITY) {
+        int oldest = 0;
+        for (int i = 1; i < count; i++) {
+            if (parkedAt[i] < parkedAt[oldest]) oldest = i;
+        }
+        freeTrack(tracks[oldest]);
+        removeAt(oldest);
+    }
+    tracks[count] = track;
+    parkedAt[count] = clock++;
+    count++;
+}
+
+PlayerWrapper *PlayerCache::take(const PlayerSource &source) {
+    if (source.path == NULL) {
+        return NULL;
+    }
+    PlayerWrapper *found = NULL;
+    for (int i = count - 1; i >= 0; i--) {
+        const PlayerSource &parked = tracks[i]->source;
+        if (!sameFile(parked, source)) {
+            continue;
+        }
+        if (!sameVersion(parked, source)) {
+            LOGI("player cache: %s changed on disk", source.path);
+            freeTrack(tracks[i]);
+            removeAt(i);
+        } else if (found == NULL) {
+            found = tracks[i];
+            removeAt(i);
+        }
+    }
+    return found;
+}
+
+void PlayerCache::clear() {
+    for (int i = 0; i < count; i++) {
+        freeTrack(tracks[i]);
+    }
+    count = 0;
+}
+
+void PlayerCache::removeAt(int i) {
+    count--;
+    tracks[i] = tracks[count];
+    parkedAt[i] = parkedAt[count];
+}
@@ -0,0 +1,69 @@
+//
+// Opened players kept across sessions.
+//
+
+#ifndef AUDIO_PLAYERCACHE_H
+#define AUDIO_PLAYERCACHE_H
+
+#include <stddef.h>
+
+// Parked players kept at most; the least recently parked one is freed first.
+#define PLAYER_CACHE_CAPACITY 8
+
+struct PlayerWrapper;
+
+/**
+ * What a player was opened from. The file's modification time, size and inode
+ * are part of it, so a file rewritten in place (a new take recorded over the
+ * old one) never matches the player of the previous version.
+ */
+struct PlayerSource {
+    char *path = NULL; // NULL when the file could not be stat'ed: such players are never cached
+    int fileOffset = 0;
+    int fileSize = 0;
+    long long modified = 0;
+    long long diskSize = 0;
+    unsigned long long inode = 0;
+};
+
+/**
+ * Players the engine has closed a session with, still open and buffered.
+ * reset() parks its loaded tracks here and the next session's addTrack()
+ * takes them back instead of opening and buffering the same file again.
+ * Not thread safe: the engine calls it with its mutex held.
+ */
+class PlayerCache {
+public:
+    typedef void (*freeTrackFunction) (PlayerWrapper *track);
+
+    PlayerCache(freeTrackFunction freeTrack);
+    ~PlayerCache();
+
+    // Fills source for path from the file as it is on disk now. Returns false if it can't be stat'ed.
+    static bool describe(const char *path, int fileOffset, int fileSize, PlayerSource *source);
+    static void release(PlayerSource *source);
+    // Same file region, unchanged on disk in between.
+    static bool sameVersion(const PlayerSource &a, const PlayerSource &b);
+
+    // Keeps a loaded, paused track. Tracks without a source are freed right away.
+    void park(PlayerWrapper *track);
+
+    /**
+     * Removes and returns a parked track opened from exactly source, or NULL.
+     * Parked tracks of an older version of the same file are freed.
+     */
+    PlayerWrapper *take(const PlayerSource &source);
+
+    void clear();
+
+private:
+    freeTrackFunction freeTrack;
+    PlayerWrapper *tracks[PLAYER_CACHE_CAPACITY];
+    unsigned long long parkedAt[PLAYER_CACHE_CAPACITY];
+    int count = 0;
+    unsigned long long clock = 0;
+
+    void removeAt(int i);
+};
+
+#endif //AUDIO_PLAYERCACHE_H
@@ -0,0 +1,229 @@
+#include "SessionFile.h"
+#include "Log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0
+#endif
+
+static_assert(sizeof(SessionHeader) == 88, "the session header is part of the file format");
+static_assert(sizeof(SessionTrackRecord) == 40, "track records are part of the file format");
+static_assert(sizeof(SessionClipRecord) == 32, "clip records are part of the file format");
+
+static uint32_t checksum(const unsigned char *data, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t align8(uint32_t offset) {
+    return (offset + 7) & ~7u;
+}
+
+// True if count items of size bytes from offset lie inside a file of fileSize bytes, 8-byte aligned.
+static bool isArea(uint32_t offset, uint64_t count, uint64_t size, uint32_t fileSize) {
+    return offset % 8 == 0 && offset >= sizeof(SessionHeader) && offset <= fileSize &&
+           count * size <= fileSize - offset;
+}
+
+SessionFile::~SessionFile() {
+    if (mapping != NULL) {
+        munmap(mapping, mappingSize);
+    }
+}
+
+bool SessionFile::open(const char *path) {
+    int file = ::open(path, O_RDONLY);
+    if (file < 0) {
+        LOGI("session %s: %s", path, strerror(errno));
+        return false;
+    }
+    struct stat info;
+    if (fstat(file, &info) != 0 || info.st_size < (off_t)sizeof(SessionHeader) || info.st_size > 0x7fffffff) {
+        close(file);
+        return false;
+    }
+    mappingSize = (size_t)info.st_size;
+    mapping = mmap(NULL, mappingSize, PROT_READ, MAP_PRIVATE | MAP_POPULATE, file, 0);
+    close(file);
+    if (mapping == MAP_FAILED) {
+        mapping = NULL;
+        return false;
+    }
+
+    const SessionHeader *candidate = (const SessionHeader *)mapping;
+    uint32_t fileSize = (uint32_t)mappingSize;
+    const char *strings = (const char *)mapping + candidate->stringsOffset;
+    bool valid = memcmp(candidate->magic, SESSION_FILE_MAGIC, 4) == 0 &&
+                 candidate->version == SESSION_FILE_VERSION &&
+                 candidate->fileSize == fileSize &&
+                 isArea(candidate->tracksOffset, candidate->tracksCount, sizeof(SessionTrackRecord), fileSize) &&
+                 isArea(candidate->clipsOffset, candidate->clipsCount, sizeof(SessionClipRecord), fileSize) &&
+                 isArea(candidate->stringsOffset, candidate->stringsSize, 1, fileSize) &&
+                 isArea(candidate->dataOffset, candidate->dataSize, 1, fileSize) &&
+                 (candidate->stringsSize == 0 || strings[candidate->stringsSize - 1] == 0) &&
+                 checksum((const unsigned char *)mapping + sizeof(SessionHeader), mappingSize - sizeof(SessionHeader)) ==
+                 candidate->checksum;
+    if (!valid) {
+        LOGI("session %s is damaged or not a session file", path);
+        return false;
+    }
+    header = candidate;
+    return true;
+}
+
+const SessionHeader *SessionFile::getHeader() const {
+    return header;
+}
+
+const SessionTrackRecord *SessionFile::getTrack(int index) const {
+    if (header == NULL || index < 0 || (uint32_t)index >= header->tracksCount) {
+        return NULL;
+    }
+    return (const SessionTrackRecord *)((const char *)mapping + header->tracksOffset) + index;
+}
+
+const SessionClipRecord *SessionFile::getClip(const SessionTrackRecord *track, int index) const {
+    uint64_t clip = (uint64_t)track->firstClip + (uint64_t)index;
+    if (index < 0 || (uint32_t)index >= track->clipsCount || clip >= header->clipsCount) {
+        return NULL;
+    }
+    return (const SessionClipRecord *)((const char *)mapping + header->clipsOffset) + clip;
+}
+
+const char *SessionFile::getString(uint32_t offset) const {
+    if (offset == SESSION_NO_STRING || offset >= header->stringsSize) {
+        return NULL;
+    }
+    return (const char *)mapping + header->stringsOffset + offset;
+}
+
+const void *SessionFile::getData(uint32_t offset, uint32_t size) const {
+    if (size == 0 || offset > header->dataSize || size > header->dataSize - offset) {
+        return NULL;
+    }
+    return (const char *)mapping + header->dataOffset + offset;
+}
+
+// Appends a path to the string table, returns its offset.
+static uint32_t addString(char *strings, uint32_t *stringsSize, const char *path) {
+    if (path == NULL) {
+        return SESSION_NO_STRING;
+    }
+    uint32_t offset = *stringsSize;
+    size_t length = strlen(path) + 1;
+    if (strings != NULL) {
+        memcpy(strings + offset, path, length);
+    }
+    *stringsSize += (uint32_t)length;
+    return offset;
+}
+
+bool SessionFile::write(const char *path, const Session &session) {
+    // Measure first, then fill one buffer and write it at once.
+    uint32_t clipsCount = 0, stringsSize = 0, dataSize = 0;
+    for (int i = 0; i < session.tracksCount; i++) {
+        const SessionTrack &track = session.tracks[i];
+        addString(NULL, &stringsSize, track.path);
+        for (int c = 0; c < track.clipsCount; c++) {
+            addString(NULL, &stringsSize, track.clips[c].path);
+        }
+        clipsCount += (uint32_t)track.clipsCount;
+        dataSize = align8(dataSize + (track.analysis != NULL ? track.analysisSize : 0));
+    }
+    uint32_t tracksOffset = sizeof(SessionHeader);
+    uint32_t clipsOffset = align8(tracksOffset + session.tracksCount * (uint32_t)sizeof(SessionTrackRecord));
+    uint32_t stringsOffset = align8(clipsOffset + clipsCount * (uint32_t)sizeof(SessionClipRecord));
+    uint32_t dataOffset = align8(stringsOffset + stringsSize);
+    uint32_t fileSize = dataOffset + dataSize;
+
+    unsigned char *buffer = (unsigned char *)calloc(fileSize, 1);
+    if (buffer == NULL) {
+        return false;
+    }
+    SessionHeader *header = (SessionHeader *)buffer;
+    SessionTrackRecord *tracks = (SessionTrackRecord *)(buffer + tracksOffset);
+    SessionClipRecord *clips = (SessionClipRecord *)(buffer + clipsOffset);
+    char *strings = (char *)buffer + stringsOffset;
+    unsigned char *data = buffer + dataOffset;
+
+    uint32_t clip = 0;
+    stringsSize = dataSize = 0;
+    for (int i = 0; i < session.tracksCount; i++) {
+        const SessionTrack &track = session.tracks[i];
+        SessionTrackRecord &record = tracks[i];
+        record.path = addString(strings, &stringsSize, track.path);
+        record.fileOffset = track.fileOffset;
+        record.fileSize = track.fileSize;
+        record.firstClip = clip;
+        record.clipsCount = (uint32_t)track.clipsCount;
+        record.volume = track.volume;
+        record.pan = track.pan;
+        record.offset = track.offset;
+        for (int c = 0; c < track.clipsCount; c++, clip++) {
+            clips[clip].path = addString(strings, &stringsSize, track.clips[c].path);
+            clips[clip].fade = track.clips[c].fade;
+            clips[clip].sourceOffset = track.clips[c].sourceOffset;
+            clips[clip].timelineStart = track.clips[c].timelineStart;
+            clips[clip].length = track.clips[c].length;
+        }
+        record.analysisOffset = dataSize;
+        record.analysisSize = track.analysis != NULL ? track.analysisSize : 0;
+        if (record.analysisSize > 0) {
+            memcpy(data + dataSize, track.analysis, record.analysisSize);
+        }
+        dataSize = align8(dataSize + record.analysisSize);
+    }
+
+    memcpy(header->magic, SESSION_FILE_MAGIC, 4);
+    header->version = SESSION_FILE_VERSION;
+    header->fileSize = fileSize;
+    header->sampleRate = (uint32_t)session.sampleRate;
+    header->flags = session.loop ? SESSION_FLAG_LOOP : 0;
+    header->numberOfChannels = session.numberOfChannels;
+    header->mainTrack = session.mainTrack;
+    header->recordLatency = session.recordLatency;
+    header->tracksCount = (uint32_t)session.tracksCount;
+    header->loopStart = session.loopStart;
+    header->loopEnd = session.loopEnd;
+    header->tracksOffset = tracksOffset;
+    header->clipsCount = clipsCount;
+    header->clipsOffset = clipsOffset;
+    header->stringsOffset = stringsOffset;
+    header->stringsSize = stringsSize;
+    header->dataOffset = dataOffset;
+    header->dataSize = dataSize;
+    header->checksum = checksum(buffer + sizeof(SessionHeader), fileSize - sizeof(SessionHeader));
+
+    char temporaryPath[1024];
+    snprintf(temporaryPath, sizeof(temporaryPath), "%s.tmp", path);
+    int file = ::open(temporaryPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool written = file >= 0;
+    for (uint32_t done = 0; written && done < fileSize;) {
+        ssize_t result = ::write(file, buffer + done, fileSize - done);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        written = result > 0;
+        done += written ? (uint32_t)result : 0;
+    }
+    if (file >= 0 && close(file) != 0) {
+        written = false;
+    }
+    free(buffer);
+    if (!written || rename(temporaryPath, path) != 0) {
+        LOGI("can't save session %s: %s", path, strerror(errno));
+        unlink(temporaryPath);
+        return false;
+    }
+    return true;
+}
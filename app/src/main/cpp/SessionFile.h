@@ -0,0 +1,134 @@
+//
+// Sessions saved to a single binary file the engine maps and loads in one call.
+//
+
+#ifndef AUDIO_SESSIONFILE_H
+#define AUDIO_SESSIONFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ClipTimeline.h"
+
+#define SESSION_FILE_MAGIC "ASES"
+#define SESSION_FILE_VERSION 1
+#define SESSION_FLAG_LOOP 1
+// String offset of a track without a file: a track of clips, or an empty slot.
+#define SESSION_NO_STRING 0xFFFFFFFFu
+
+/*
+ * The layout, little endian, every table 8-byte aligned:
+ *
+ *   SessionHeader
+ *   SessionTrackRecord[tracksCount]
+ *   SessionClipRecord[clipsCount]    clips of every track, each track's in a row
+ *   strings                          NUL-terminated paths
+ *   data                             opaque analysis blobs cached by the app
+ *
+ * Records only hold numbers and offsets into the string and data areas, so
+ * the mapped file is used as it is. open() checks the header, that each area
+ * lies inside the file and a checksum of everything after the header; offsets
+ * inside records are checked as they are read.
+ */
+struct SessionHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t fileSize;
+    uint32_t checksum;        // FNV-1a of the bytes after the header
+    uint32_t sampleRate;
+    uint32_t flags;
+    int32_t numberOfChannels; // of the takes
+    int32_t mainTrack;
+    int32_t recordLatency;
+    uint32_t tracksCount;
+    int64_t loopStart;        // an empty region leaves the loop to SESSION_FLAG_LOOP
+    int64_t loopEnd;
+    uint32_t tracksOffset;
+    uint32_t clipsCount;
+    uint32_t clipsOffset;
+    uint32_t stringsOffset;
+    uint32_t stringsSize;
+    uint32_t dataOffset;
+    uint32_t dataSize;
+    uint32_t reserved;
+};
+
+struct SessionTrackRecord {
+    uint32_t path;            // SESSION_NO_STRING for a track of clips
+    int32_t fileOffset;
+    int32_t fileSize;
+    uint32_t firstClip;
+    uint32_t clipsCount;
+    float volume;
+    float pan;
+    int32_t offset;           // samples the file plays late on the timeline, early if negative
+    uint32_t analysisOffset;
+    uint32_t analysisSize;
+};
+
+struct SessionClipRecord {
+    uint32_t path;
+    int32_t fade;
+    int64_t sourceOffset;
+    int64_t timelineStart;
+    int64_t length;
+};
+
+// One track to save. A track of clips has no path; a track with neither is an empty slot.
+struct SessionTrack {
+    const char *path;
+    int fileOffset;
+    int fileSize;
+    const Clip *clips;
+    int clipsCount;
+    float volume;
+    float pan;
+    int offset;
+    const void *analysis;
+    unsigned int analysisSize;
+};
+
+struct Session {
+    int sampleRate;
+    int numberOfChannels;
+    int mainTrack;
+    bool loop;
+    long long loopStart;
+    long long loopEnd;
+    int recordLatency;
+    const SessionTrack *tracks;
+    int tracksCount;
+};
+
+/**
+ * A session file mapped read-only. Records point into the mapping, so they
+ * are valid until the SessionFile is destroyed.
+ */
+class SessionFile {
+public:
+    ~SessionFile();
+
+    // Maps the file and validates it. Returns false if it is not a session file or is damaged.
+    bool open(const char *path);
+
+    const SessionHeader *getHeader() const;
+    const SessionTrackRecord *getTrack(int index) const;
+
+    // The track's clip, or NULL if the record points outside the clip table.
+    const SessionClipRecord *getClip(const SessionTrackRecord *track, int index) const;
+
+    // NULL if offset is SESSION_NO_STRING or outside the string table.
+    const char *getString(uint32_t offset) const;
+
+    // NULL if the range is empty or outside the data area.
+    const void *getData(uint32_t offset, uint32_t size) const;
+
+    // Writes the session next to path and renames it over path, so a failed save leaves the old file.
+    static bool write(const char *path, const Session &session);
+
+private:
+    void *mapping = NULL;
+    size_t mappingSize = 0;
+    const SessionHeader *header = NULL;
+};
+
+#endif //AUDIO_SESSIONFILE_H
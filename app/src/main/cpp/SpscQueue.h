@@ -0,0 +1,52 @@
+#ifndef AUDIO_SPSCQUEUE_H
+#define AUDIO_SPSCQUEUE_H
+
+#include <atomic>
+
+/**
+ * Bounded single-producer/single-consumer ring. push() and pop() never block
+ * or allocate, so either side may be the audio thread.
+ *
+ * Capacity must be a power of two; one slot is kept free to tell full from empty.
+ */
+template <typename T, unsigned int Capacity>
+class SpscQueue {
+public:
+    SpscQueue() : head(0), tail(0) {
+        static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+    }
+
+    // Producer side. Returns false if the queue is full.
+    bool push(const T &item) {
+        unsigned int currentTail = tail.load(std::memory_order_relaxed);
+        unsigned int nextTail = (currentTail + 1) & (Capacity - 1);
+        if (nextTail == head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        items[currentTail] = item;
+        tail.store(nextTail, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Returns false if the queue is empty.
+    bool pop(T &item) {
+        unsigned int currentHead = head.load(std::memory_order_relaxed);
+        if (currentHead == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = items[currentHead];
+        head.store((currentHead + 1) & (Capacity - 1), std::memory_order_release);
+        return true;
+    }
+
+    bool isEmpty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+private:
+    T items[Capacity];
+    std::atomic<unsigned int> head; // next slot to read, owned by the consumer
+    std::atomic<unsigned int> tail; // next slot to write, owned by the producer
+};
+
+#endif //AUDIO_SPSCQUEUE_H
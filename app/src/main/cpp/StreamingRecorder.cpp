@@ -0,0 +1,298 @@
+#include "StreamingRecorder.h"
+#include "CaptureHistory.h"
+#include "Log.h"
+#include <SuperpoweredSimple.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void putLittleEndian(unsigned char *destination, unsigned int value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        destination[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+void *StreamingRecorder::writerThreadFunction(void *param) {
+    ((StreamingRecorder *)param)->runWriter();
+    return NULL;
+}
+
+StreamingRecorder::StreamingRecorder(int sampleRate, int numberOfChannels, int format,
+                                     recorderFinishedCallback callback,
+                                     void *clientData) : sampleRate(sampleRate),
+                                                         numberOfChannels(numberOfChannels == 1 ? 1 : 2),
+                                                         format(format == RECORDER_FORMAT_PCM24 ||
+                                                                format == RECORDER_FORMAT_FLOAT ? format
+                                                                                                : RECORDER_FORMAT_PCM16),
+                                                         callback(callback),
+                                                         clientData(clientData),
+                                                         writePosition(0),
+                                                         readPosition(0),
+                                                         stopRequested(false),
+                                                         droppedFrames(0),
+                                                         historyPending(false) {
+    sampleBytes = this->format == RECORDER_FORMAT_PCM16 ? 2 : this->format == RECORDER_FORMAT_PCM24 ? 3 : 4;
+    sem_init(&dataAvailable, 0, 0);
+}
+
+StreamingRecorder::~StreamingRecorder() {
+    if (writerRunning) {
+        stop();
+        pthread_join(writerThread, NULL);
+    }
+    free(ring);
+    free(block);
+    free(staging);
+    sem_destroy(&dataAvailable);
+}
+
+bool StreamingRecorder::start(const char *destinationPath) {
+    blockFrames = RECORDER_WRITE_BLOCK_BYTES / (numberOfChannels * (int)sizeof(short int));
+    ringFrames = blockFrames * 2;
+    while (ringFrames < (unsigned int)(sampleRate * RECORDER_RING_SECONDS)) {
+        ringFrames *= 2;
+    }
+    ring = (float *)memalign(RECORDER_DATA_OFFSET, (size_t)ringFrames * numberOfChannels * sizeof(float));
+    block = (char *)memalign(RECORDER_DATA_OFFSET, (size_t)blockFrames * numberOfChannels * sizeof(float)); // float is the widest
+    staging = (float *)memalign(RECORDER_DATA_OFFSET, (size_t)blockFrames * numberOfChannels * sizeof(float));
+
+    // Same naming as SuperpoweredRecorder: the path comes without the extension.
+    char path[1024];
+    snprintf(path, sizeof(path), "%s.wav", destinationPath);
+    file = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (ring == NULL || block == NULL || staging == NULL || file < 0 || !writeHeader()) {
+        LOGI("recorder can't create %s: %s", path, strerror(errno));
+        if (file >= 0) {
+            close(file);
+            file = -1;
+        }
+        return false;
+    }
+    writerRunning = pthread_create(&writerThread, NULL, writerThreadFunction, this) == 0;
+    return writerRunning;
+}
+
+void StreamingRecorder::process(const float *input, unsigned int numberOfSamples) {
+    unsigned int write = writePosition.load(std::memory_order_relaxed);
+    unsigned int read = readPosition.load(std::memory_order_acquire);
+    unsigned int space = ringFrames - (write - read);
+    unsigned int frames = numberOfSamples < space ? numberOfSamples : space;
+    if (frames < numberOfSamples) {
+        droppedFrames.fetch_add(numberOfSamples - frames, std::memory_order_relaxed);
+    }
+
+    unsigned int index = write & (ringFrames - 1);
+    unsigned int first = ringFrames - index < frames ? ringFrames - index : frames;
+    memcpy(ring + index * numberOfChannels, input, first * sizeof(float) * numberOfChannels);
+    memcpy(ring, input + first * numberOfChannels, (frames - first) * sizeof(float) * numberOfChannels);
+    writePosition.store(write + frames, std::memory_order_release);
+
+    // Wake the writer once per completed block, not every callback.
+    if (write / blockFrames != (write + frames) / blockFrames) {
+        sem_post(&dataAvailable);
+    }
+}
+
+void StreamingRecorder::prependHistory(const CaptureHistory *history, unsigned long long from,
+                                       unsigned int numberOfSamples) {
+    this->history = history;
+    historyFrom = from;
+    historyFrames = numberOfSamples;
+    historyPending.store(true, std::memory_order_release);
+    sem_post(&dataAvailable);
+}
+
+void StreamingRecorder::stop() {
+    if (!stopRequested.exchange(true, std::memory_order_release)) {
+        sem_post(&dataAvailable);
+    }
+}
+
+unsigned int StreamingRecorder::getDroppedFrames() const {
+    return droppedFrames.load(std::memory_order_relaxed);
+}
+
+void StreamingRecorder::runWriter() {
+    while (true) {
+        if (sem_wait(&dataAvailable) != 0) {
+            continue; // EINTR
+        }
+        bool stopping = stopRequested.load(std::memory_order_acquire);
+        unsigned int write = writePosition.load(std::memory_order_acquire);
+        if (historyPending.load(std::memory_order_acquire)) {
+            writeHistory(); // set before the first frame was queued, so it goes first
+            historyPending.store(false, std::memory_order_relaxed);
+        }
+        if (stagedFrames > 0) {
+            writeStaged(write - readPosition.load(std::memory_order_relaxed), stopping);
+        }
+        while (stagedFrames == 0 && write - readPosition.load(std::memory_order_relaxed) >= blockFrames) {
+            writeFrames(blockFrames);
+        }
+        if (stopping) {
+            unsigned int remaining;
+            while ((remaining = write - readPosition.load(std::memory_order_relaxed)) > 0) {
+                writeFrames(remaining < blockFrames ? remaining : blockFrames);
+            }
+            break;
+        }
+    }
+
+    if (!writeHeader()) {
+        failed = true;
+    }
+    if (close(file) != 0) {
+        failed = true;
+    }
+    file = -1;
+    if (getDroppedFrames() > 0) {
+        LOGI("recorder dropped %u frames, the disk could not keep up", getDroppedFrames());
+    }
+    if (callback != NULL) {
+        callback(clientData, !failed);
+    }
+}
+
+// Writer thread. Appends up to a block of frames from the read position in one write. After a
+// history the blocks no longer line up with the ring: one that wraps is put together first.
+void StreamingRecorder::writeFrames(unsigned int frames) {
+    unsigned int read = readPosition.load(std::memory_order_relaxed);
+    unsigned int index = read & (ringFrames - 1);
+    if (ringFrames - index >= frames) {
+        writeSamples(ring + index * numberOfChannels, frames);
+    } else {
+        copyFromRing(staging, read, frames);
+        writeSamples(staging, frames);
+    }
+    readPosition.store(read + frames, std::memory_order_release);
+}
+
+// Writer thread. Copies frames of the ring from position from, across its end.
+void StreamingRecorder::copyFromRing(float *output, unsigned int from, unsigned int frames) const {
+    unsigned int index = from & (ringFrames - 1);
+    unsigned int first = ringFrames - index < frames ? ringFrames - index : frames;
+    memcpy(output, ring + index * numberOfChannels, first * sizeof(float) * numberOfChannels);
+    memcpy(output + first * numberOfChannels, ring, (frames - first) * sizeof(float) * numberOfChannels);
+}
+
+// Writer thread. Completes the block the history ended in with the first frames of the ring, so
+// that every block after it still starts on a block boundary of the file. Waits for the ring to
+// hold enough, unless the take is stopping.
+void StreamingRecorder::writeStaged(unsigned int available, bool stopping) {
+    unsigned int missing = blockFrames - stagedFrames;
+    if (available < missing && !stopping) {
+        return;
+    }
+    unsigned int frames = available < missing ? available : missing;
+    unsigned int read = readPosition.load(std::memory_order_relaxed);
+    copyFromRing(staging + stagedFrames * numberOfChannels, read, frames);
+    writeSamples(staging, stagedFrames + frames);
+    stagedFrames = 0;
+    readPosition.store(read + frames, std::memory_order_release);
+}
+
+// Writer thread. Converts frames of the take's channels to its format and appends them. The
+// frames are the writer's until it moves the read position on, so they are clipped in place.
+void StreamingRecorder::writeSamples(float *input, unsigned int frames) {
+    if (format == RECORDER_FORMAT_FLOAT) {
+        writeBytes((const char *)input, frames * numberOfChannels * sizeof(float));
+        return;
+    }
+    for (unsigned int done = 0; done < frames;) {
+        unsigned int chunk = frames - done < blockFrames ? frames - done : blockFrames;
+        float *samples = input + done * numberOfChannels;
+        if (format == RECORDER_FORMAT_PCM24) {
+            // Full scale would wrap around to the negative peak.
+            for (unsigned int n = 0; n < chunk * numberOfChannels; n++) {
+                if (samples[n] > 8388607.f / 8388608.f) {
+                    samples[n] = 8388607.f / 8388608.f;
+                } else if (samples[n] < -1.f) {
+                    samples[n] = -1.f;
+                }
+            }
+            SuperpoweredFloatTo24bit(samples, block, chunk, (unsigned int)numberOfChannels);
+        } else {
+            SuperpoweredFloatToShortInt(samples, (short int *)block, chunk, (unsigned int)numberOfChannels);
+        }
+        writeBytes(block, chunk * numberOfChannels * sampleBytes);
+        done += chunk;
+    }
+}
+
+// Writer thread. Copies the history out block by block while the audio thread keeps
+// overwriting its oldest frames, which is why it has some slack. Only whole blocks are written:
+// the rest is staged, to go out with the first frames of the ring as one block.
+void StreamingRecorder::writeHistory() {
+    unsigned int lost = 0;
+    for (unsigned int done = 0; done < historyFrames;) {
+        unsigned int frames = historyFrames - done < blockFrames ? historyFrames - done : blockFrames;
+        lost += frames - history->read(historyFrom + done, frames, staging);
+        if (frames == blockFrames) {
+            writeSamples(staging, frames);
+        } else {
+            stagedFrames = frames;
+        }
+        done += frames;
+    }
+    if (lost > 0) {
+        LOGI("recorder lost %u frames of history, written as silence", lost);
+    }
+}
+
+void StreamingRecorder::writeBytes(const char *data, size_t bytes) {
+    while (!failed && bytes > 0) {
+        ssize_t written = ::write(file, data, bytes);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            LOGI("recorder write failed: %s", strerror(errno));
+            failed = true; // keep draining the ring so the audio thread never stalls
+            break;
+        }
+        data += written;
+        bytes -= written;
+        dataBytes += written;
+    }
+}
+
+// Canonical PCM or float header, padded with a JUNK chunk up to RECORDER_DATA_OFFSET. Written with
+// zero sizes on start and again with the final ones on close. Float has the fmt extension size
+// and the fact chunk that formats other than PCM carry.
+bool StreamingRecorder::writeHeader() {
+    unsigned char header[RECORDER_DATA_OFFSET];
+    memset(header, 0, sizeof(header));
+    bool isFloat = format == RECORDER_FORMAT_FLOAT;
+    unsigned int blockAlign = (unsigned int)(numberOfChannels * sampleBytes);
+    unsigned int dataSize = (unsigned int)dataBytes;
+
+    memcpy(header, "RIFF", 4);
+    putLittleEndian(header + 4, RECORDER_DATA_OFFSET - 8 + dataSize, 4);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    putLittleEndian(header + 16, isFloat ? 18 : 16, 4);
+    putLittleEndian(header + 20, isFloat ? 3 : 1, 2); // IEEE float or PCM
+    putLittleEndian(header + 22, (unsigned int)numberOfChannels, 2);
+    putLittleEndian(header + 24, (unsigned int)sampleRate, 4);
+    putLittleEndian(header + 28, (unsigned int)sampleRate * blockAlign, 4);
+    putLittleEndian(header + 32, blockAlign, 2);
+    putLittleEndian(header + 34, (unsigned int)sampleBytes * 8, 2);
+    unsigned char *chunk = header + 36;
+    if (isFloat) {
+        chunk += 2; // no extension
+        memcpy(chunk, "fact", 4);
+        putLittleEndian(chunk + 4, 4, 4);
+        putLittleEndian(chunk + 8, dataSize / blockAlign, 4);
+        chunk += 12;
+    }
+    memcpy(chunk, "JUNK", 4);
+    putLittleEndian(chunk + 4, (unsigned int)(header + RECORDER_DATA_OFFSET - 8 - (chunk + 8)), 4);
+    memcpy(header + RECORDER_DATA_OFFSET - 8, "data", 4);
+    putLittleEndian(header + RECORDER_DATA_OFFSET - 4, dataSize, 4);
+
+    return pwrite(file, header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+           lseek(file, RECORDER_DATA_OFFSET + (off_t)dataBytes, SEEK_SET) >= 0;
+}
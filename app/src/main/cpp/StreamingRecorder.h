@@ -0,0 +1,116 @@
+#ifndef AUDIO_STREAMINGRECORDER_H
+#define AUDIO_STREAMINGRECORDER_H
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <atomic>
+#include <stddef.h>
+
+class CaptureHistory;
+
+// Audio the ring holds before the audio thread has to drop frames.
+#define RECORDER_RING_SECONDS 8
+// The writer thread appends whole blocks of this many bytes of 16-bit audio while recording;
+// 24-bit and float blocks hold as many frames.
+#define RECORDER_WRITE_BLOCK_BYTES 65536
+// The header is padded with a JUNK chunk so that audio data starts on this boundary.
+#define RECORDER_DATA_OFFSET 4096
+
+// Sample formats of a take.
+#define RECORDER_FORMAT_PCM16 0
+#define RECORDER_FORMAT_PCM24 1
+#define RECORDER_FORMAT_FLOAT 2
+
+typedef void (*recorderFinishedCallback) (void *clientData, bool success);
+
+/**
+ * Records 16-bit, 24-bit or 32-bit float audio straight into the destination
+ * WAV file.
+ *
+ * The audio thread copies each callback into a lock-free ring of float. A
+ * writer thread converts the ring to the take's format and appends it to the
+ * file in large block-aligned writes, and on stop it
+ * writes what is left and patches the header sizes. There is no temporary file
+ * and no copy at the end, so the time from stop() to the finished callback
+ * does not grow with the length of the take.
+ */
+class StreamingRecorder {
+public:
+    // format is one of RECORDER_FORMAT_*.
+    StreamingRecorder(int sampleRate, int numberOfChannels, int format, recorderFinishedCallback callback,
+                      void *clientData);
+
+    // Stops and waits for the writer thread if the take is still being written.
+    ~StreamingRecorder();
+
+    /**
+     * Creates destinationPath + ".wav" and starts the writer thread. Call from a
+     * control thread. Returns false if the file cannot be created.
+     */
+    bool start(const char *destinationPath);
+
+    /**
+     * Audio thread. Queues interleaved input of the take's channels, from an
+     * input opened with as many. Never blocks: if the writer falls behind by more than
+     * the ring, frames are dropped and counted.
+     */
+    void process(const float *input, unsigned int numberOfSamples);
+
+    /**
+     * Audio thread, before the first process(). Starts the take with
+     * numberOfSamples frames of history from position from; the writer thread
+     * copies them out of the history, which must hold the take's channels and
+     * outlive the recorder.
+     */
+    void prependHistory(const CaptureHistory *history, unsigned long long from, unsigned int numberOfSamples);
+
+    /**
+     * Audio thread. Ends the take; the writer thread finishes the file and
+     * calls the finished callback.
+     */
+    void stop();
+
+    unsigned int getDroppedFrames() const;
+
+private:
+    int sampleRate;
+    int numberOfChannels;
+    int format;
+    int sampleBytes;
+    recorderFinishedCallback callback;
+    void *clientData;
+
+    int file = -1;
+    float *ring = NULL;
+    unsigned int ringFrames = 0;            // power of two
+    unsigned int blockFrames = 0;
+    char *block = NULL;                     // the writer thread converts blocks here
+    float *staging = NULL;                  // and puts together blocks that don't lie in the ring in one piece
+    unsigned int stagedFrames = 0;          // the end of the history, waiting for the ring to fill its block
+    std::atomic<unsigned int> writePosition; // frames queued so far, owned by the audio thread
+    std::atomic<unsigned int> readPosition;  // frames written so far, owned by the writer thread
+    std::atomic<bool> stopRequested;
+    std::atomic<unsigned int> droppedFrames;
+    const CaptureHistory *history = NULL;
+    unsigned long long historyFrom = 0;
+    unsigned int historyFrames = 0;
+    std::atomic<bool> historyPending;
+    unsigned long long dataBytes = 0;
+    bool failed = false;
+
+    sem_t dataAvailable;
+    pthread_t writerThread;
+    bool writerRunning = false;
+
+    static void *writerThreadFunction(void *param);
+    void runWriter();
+    void writeFrames(unsigned int frames);
+    void copyFromRing(float *output, unsigned int from, unsigned int frames) const;
+    void writeStaged(unsigned int available, bool stopping);
+    void writeSamples(float *input, unsigned int frames);
+    void writeHistory();
+    void writeBytes(const char *data, size_t bytes);
+    bool writeHeader();
+};
+
+#endif //AUDIO_STREAMINGRECORDER_H
@@ -309,9 +309,34 @@ public class RecordV2Activity
 
         }
 
+        @Override
+        public void onTrackPrepared(int index, float progress) {
+
+        }
+
+        @Override
+        public void onPrepareFailed(int index, int errorCode) {
+
+        }
+
         @Override
         public void onRecordFinished() {
 
         }
+
+        @Override
+        public void onLatencyMeasured(int samples) {
+
+        }
+
+        @Override
+        public void onBounceProgress(float progress) {
+
+        }
+
+        @Override
+        public void onBounceFinished(boolean success) {
+
+        }
     }
 }
@@ -11,10 +11,18 @@ import java.io.File;
 
 public class AudioEngine {
 
+    private static final int STATS_HISTOGRAM_BUCKETS = 20;
+
+    /** Sample formats of a take, see {@link #setRecordingFormat(int)}. */
+    public static final int RECORDING_FORMAT_PCM16 = 0;
+    public static final int RECORDING_FORMAT_PCM24 = 1;
+    public static final int RECORDING_FORMAT_FLOAT = 2;
+
 
 
     private OnPlayerEventsListener mOnPlayerEventsListener;
     private OnRecorderEventsListener mOnRecorderEventsListener;
+    private OnBounceEventsListener mOnBounceEventsListener;
 
     public AudioEngine(int sampleRate, int bufferSize) {
         AudioEngine(sampleRate, bufferSize);
@@ -23,6 +31,7 @@ public class AudioEngine {
     public void setAudioEngineListener(AudioEngineListener audioEngineListener) {
         setOnPlayerEventsListener(audioEngineListener);
         setOnRecorderEventsListener(audioEngineListener);
+        setOnBounceEventsListener(audioEngineListener);
     }
 
     public void setOnPlayerEventsListener(OnPlayerEventsListener onPlayerEventsListener) {
@@ -33,6 +42,14 @@ public class AudioEngine {
         mOnRecorderEventsListener = onRecorderEventsListener;
     }
 
+    public void setOnBounceEventsListener(OnBounceEventsListener onBounceEventsListener) {
+        mOnBounceEventsListener = onBounceEventsListener;
+    }
+
+    /**
+     * @param numberOfChannels 1 records mono takes from a mono input, 2 stereo. Changing it reopens
+     *                         the input, so call with audio stopped.
+     */
     public void init(int numberOfChannels, int playersCount, boolean loop, int mainPlayerIndex) {
         initNative(numberOfChannels, playersCount, loop, mainPlayerIndex);
     }
@@ -45,14 +62,211 @@ public class AudioEngine {
         preparePlayer(file.getAbsolutePath(), 0, (int) file.length());
     }
 
+    /**
+     * Opens every file of the session at once, file i as track i, after {@link #init}. Returns
+     * without waiting: each loaded track is reported to
+     * {@link OnPlayerEventsListener#onTrackPrepared(int, float)}, then the session to
+     * {@link OnPlayerEventsListener#onPlayersPrepared()}. A file that fails to load, the timeout
+     * passing or {@link #cancelPrepare()} ends the batch with
+     * {@link OnPlayerEventsListener#onPrepareFailed(int, int)}.
+     *
+     * @param timeoutMs how long the whole session may take, 0 to wait for as long as it takes
+     */
+    public void prepareTracks(File[] files, int timeoutMs) {
+        String[] paths = new String[files.length];
+        int[] offsets = new int[files.length];
+        int[] sizes = new int[files.length];
+        for (int i = 0; i < files.length; i++) {
+            paths[i] = files[i].getAbsolutePath();
+            sizes[i] = (int) files[i].length();
+        }
+        prepareTracksNative(paths, offsets, sizes, timeoutMs);
+    }
+
+    public void cancelPrepare() {
+        cancelPrepareNative();
+    }
+
+    /**
+     * Adds a track while the session may be playing. It joins playback in sync once loaded.
+     *
+     * @return the track index, or -1 if every track slot is taken
+     */
+    public int addTrack(File file) {
+        return addTrackNative(file.getAbsolutePath(), 0, (int) file.length());
+    }
+
+    /**
+     * Swaps the track at index for another file, without a gap, once the new file has loaded.
+     */
+    public int replaceTrack(int index, File file) {
+        return replaceTrackNative(index, file.getAbsolutePath(), 0, (int) file.length());
+    }
+
+    /**
+     * Plays the track at index from clips of other files, mixed where they overlap, so takes can
+     * be comped without rendering them. Call again after every edit: the running track plays on
+     * until the new clips are open. The files must be 16-bit WAVs at the engine sample rate, or
+     * short enough to be decoded whole (see {@link #setDecodedAudioBudget(long)}).
+     *
+     * @param index the track to replace, or -1 for a free one
+     * @return the track index, or -1 if every track slot is taken
+     */
+    public int setTrackClips(int index, Clip[] clips) {
+        String[] paths = new String[clips.length];
+        long[] positions = new long[clips.length * 3];
+        int[] fades = new int[clips.length];
+        for (int i = 0; i < clips.length; i++) {
+            paths[i] = clips[i].file.getAbsolutePath();
+            positions[i * 3] = clips[i].sourceOffset;
+            positions[i * 3 + 1] = clips[i].timelineStart;
+            positions[i * 3 + 2] = clips[i].length;
+            fades[i] = clips[i].fade;
+        }
+        return setTrackClipsNative(index, paths, positions, fades);
+    }
+
+    public void removeTrack(int index) {
+        removeTrackNative(index);
+    }
+
+    /**
+     * Runs the track at index through these insert effects, in order, before it is mixed. The
+     * chain replaces the previous one between two buffers and stays with the track when it is
+     * replaced. Pass no effects to remove it.
+     *
+     * @return false if there is no track at index
+     */
+    public boolean setTrackEffects(int index, Effect... effects) {
+        int[] types = new int[effects.length];
+        boolean[] enabled = new boolean[effects.length];
+        float[] parameters = new float[effects.length * Effect.PARAMETERS];
+        for (int i = 0; i < effects.length; i++) {
+            types[i] = effects[i].type;
+            enabled[i] = effects[i].enabled;
+            System.arraycopy(effects[i].parameters, 0, parameters, i * Effect.PARAMETERS,
+                    Math.min(effects[i].parameters.length, Effect.PARAMETERS));
+        }
+        return setTrackEffectsNative(index, types, enabled, parameters);
+    }
+
+    public void setTrackEffectParameter(int index, int effect, int parameter, float value) {
+        setTrackEffectParameterNative(index, effect, parameter, value);
+    }
+
+    /**
+     * Bypasses an effect of the track's chain, or puts it back in. A bypassed effect costs nothing.
+     */
+    public void setTrackEffectEnabled(int index, int effect, boolean enabled) {
+        setTrackEffectEnabledNative(index, effect, enabled);
+    }
+
+    /**
+     * Replaces the session with one saved by {@link #saveSession(File)}: tracks, clips, volumes,
+     * pans, loop and record latency. The tracks are reported like a prepared session's, to
+     * {@link OnPlayerEventsListener#onPlayersPrepared()}.
+     *
+     * @return false if the file is damaged or was saved at another sample rate; the running
+     * session is kept then
+     */
+    public boolean loadSession(File file) {
+        return loadSessionNative(file.getAbsolutePath());
+    }
+
+    /**
+     * Saves the session to one file, replacing it only once the whole session is written.
+     */
+    public boolean saveSession(File file) {
+        return saveSessionNative(file.getAbsolutePath());
+    }
+
+    /**
+     * Keeps data with the track at index, e.g. a waveform overview, so it is saved with the
+     * session and need not be computed again.
+     *
+     * @return false if there is no track at index
+     */
+    public boolean setTrackAnalysis(int index, byte[] data) {
+        return setTrackAnalysisNative(index, data);
+    }
+
+    /**
+     * @return the data kept with the track at index, empty if none, null if there is no track
+     */
+    public byte[] getTrackAnalysis(int index) {
+        return getTrackAnalysisNative(index);
+    }
+
     public void startRecording(File fileTemp, File fileDestination) {
-        startRecordingNative(fileTemp.getAbsolutePath(), fileDestination.getAbsolutePath());
+        startRecording(fileTemp, fileDestination, false);
+    }
+
+    /**
+     * @param withHistory start the take with up to the last 10 s of input heard before this call,
+     *                    see {@link #getRecordHistoryFrames()}
+     */
+    public void startRecording(File fileTemp, File fileDestination, boolean withHistory) {
+        startRecordingNative(fileTemp.getAbsolutePath(), fileDestination.getAbsolutePath(), withHistory);
     }
 
     public void stopRecording() {
         stopRecordingNative();
     }
 
+    /**
+     * Sets the sample format of the takes started from now on: {@link #RECORDING_FORMAT_PCM16},
+     * the default, or {@link #RECORDING_FORMAT_PCM24} or {@link #RECORDING_FORMAT_FLOAT}, which keep
+     * the input as it came from the device. Only 16-bit takes are comped from memory without
+     * decoding them first.
+     */
+    public void setRecordingFormat(int format) {
+        setRecordingFormatNative(format);
+    }
+
+    /**
+     * Records the following takes only between two sample positions of the session, engaging and
+     * disengaging on those samples. A take also holds 5 ms on either side, faded, to crossfade
+     * with what it replaces, so it starts 5 ms before punchInSample. Pass an empty region
+     * (punchOutSample <= punchInSample) to record freely again.
+     */
+    public void setPunchRegion(long punchInSample, long punchOutSample) {
+        setPunchRegionNative(punchInSample, punchOutSample);
+    }
+
+    /**
+     * Measures the round trip from speaker to mic with a few clicks; the result arrives in
+     * {@link OnRecorderEventsListener#onLatencyMeasured(int)} and aligns every following take.
+     */
+    public void measureLatency() {
+        measureLatencyNative();
+    }
+
+    /**
+     * Restores a round trip measured earlier, in samples, so takes line up without calibrating again.
+     */
+    public void setRecordLatency(int samples) {
+        setRecordLatencyNative(samples);
+    }
+
+    public int getRecordLatency() {
+        return getRecordLatencyNative();
+    }
+
+    /**
+     * Samples of input the audio IO currently holds back against callback jitter. It grows after
+     * dropouts and shrinks on a steady device; takes stay lined up as it does.
+     */
+    public int getIoLatency() {
+        return getIoLatencyNative();
+    }
+
+    /**
+     * Samples of history the last take started with; the take lines up with the players from there.
+     */
+    public int getRecordHistoryFrames() {
+        return getRecordHistoryFramesNative();
+    }
+
     public void startPlaying() {
         startPlayingNative(true);
     }
@@ -61,6 +275,50 @@ public class AudioEngine {
         setPlayNative(shouldPlay);
     }
 
+    public void setPlayerVolume(int indexOfPlayer, float volume) {
+        setPlayerVolumeNative(indexOfPlayer, volume);
+    }
+
+    /**
+     * @param pan -1 for left only, 0 for centre, 1 for right only
+     */
+    public void setPlayerPan(int indexOfPlayer, float pan) {
+        setPlayerPanNative(indexOfPlayer, pan);
+    }
+
+    /**
+     * Short files (up to 30 s) are decoded whole when prepared and play from RAM while they fit in
+     * this many bytes, 32 MB by default; longer files stream. 0 streams every file.
+     */
+    public void setDecodedAudioBudget(long bytes) {
+        setDecodedAudioBudgetNative(bytes);
+    }
+
+    /**
+     * Loops playback between two sample positions of the session, all players wrapping together.
+     * Pass an empty region (endSample <= startSample) to stop looping.
+     */
+    public void setLoopRegion(long startSample, long endSample) {
+        setLoopRegionNative(startSample, endSample);
+    }
+
+    /**
+     * Runs the mix through a limiter and a soft clipper, so loud tracks summed together don't
+     * hard-clip. It is cheap enough to leave on, and delays the output by 32 samples, which takes
+     * and bounces are compensated for. Off by default.
+     */
+    public void setMasterBus(boolean enabled) {
+        setMasterBusNative(enabled);
+    }
+
+    /**
+     * Renders the prepared session to a WAV file faster than real time.
+     * Progress and completion are reported to {@link OnBounceEventsListener}.
+     */
+    public boolean bounce(File fileDestination) {
+        return bounceNative(fileDestination.getAbsolutePath());
+    }
+
     public void release() {
         releaseNative();
     }
@@ -79,6 +337,20 @@ public class AudioEngine {
         }
     }
 
+    @Keep
+    public void onTrackPrepared(int index, float progress) {
+        if (mOnPlayerEventsListener != null) {
+            mOnPlayerEventsListener.onTrackPrepared(index, progress);
+        }
+    }
+
+    @Keep
+    public void onPrepareFailed(int index, int errorCode) {
+        if (mOnPlayerEventsListener != null) {
+            mOnPlayerEventsListener.onPrepareFailed(index, errorCode);
+        }
+    }
+
     @Keep
     public void onPlayerEnded(int indexOfPlayer) {
         if (mOnPlayerEventsListener != null) {
@@ -93,20 +365,136 @@ public class AudioEngine {
         }
     }
 
+    @Keep
+    public void onLatencyMeasured(int samples) {
+        if (mOnRecorderEventsListener != null) {
+            mOnRecorderEventsListener.onLatencyMeasured(samples);
+        }
+    }
+
+    @Keep
+    public void onBounceProgress(float progress) {
+        if (mOnBounceEventsListener != null) {
+            mOnBounceEventsListener.onBounceProgress(progress);
+        }
+    }
+
+    @Keep
+    public void onBounceFinished(boolean success) {
+        if (mOnBounceEventsListener != null) {
+            mOnBounceEventsListener.onBounceFinished(success);
+        }
+    }
+
     public interface OnPlayerEventsListener {
         void onPlayersPrepared();
 
         void onError(int errorCode);
 
         void onPlayerEnded(int indexOfPlayer);
+
+        /**
+         * @param progress part of the session prepared so far, from 0 to 1
+         */
+        void onTrackPrepared(int index, float progress);
+
+        /**
+         * @param index the track that failed or was still loading, -1 when cancelled
+         */
+        void onPrepareFailed(int index, int errorCode);
     }
 
     public interface OnRecorderEventsListener {
         void onRecordFinished();
+
+        /**
+         * @param samples round-trip latency, or -1 if the clicks were not heard
+         */
+        void onLatencyMeasured(int samples);
+    }
+
+    public interface OnBounceEventsListener {
+        void onBounceProgress(float progress);
+
+        void onBounceFinished(boolean success);
+    }
+
+    /**
+     * Audio callback timing and dropout counters since the engine was created.
+     * histogram[i] counts callbacks that took from 2^i up to 2^(i+1) microseconds.
+     */
+    public static class Stats {
+        public long callbacks;
+        public long overBudget;
+        public long nearBudget;
+        public long inputUnderruns;
+        public long outputUnderruns;
+        public long silenceSubstitutions;
+        public long inputOverruns;
+        public double budgetMicros;
+        public double meanMicros;
+        public double maxMicros;
+        public double lastMicros;
+        public final long[] histogram = new long[STATS_HISTOGRAM_BUCKETS];
+    }
+
+    /**
+     * Part of a file placed on the session timeline, in samples at the engine sample rate.
+     */
+    public static class Clip {
+        public final File file;
+        public final long sourceOffset;
+        public final long timelineStart;
+        public final long length;
+        public final int fade;
+
+        /**
+         * @param sourceOffset  first sample of the file played
+         * @param timelineStart where that sample plays in the session
+         * @param fade          samples faded in at the start and out at the end
+         */
+        public Clip(File file, long sourceOffset, long timelineStart, long length, int fade) {
+            this.file = file;
+            this.sourceOffset = sourceOffset;
+            this.timelineStart = timelineStart;
+            this.length = length;
+            this.fade = fade;
+        }
+    }
+
+    /**
+     * An insert effect of a track. What the parameters mean depends on the type.
+     */
+    public static class Effect {
+        /** frequency in Hz, resonance from 0.1 to 1 */
+        public static final int LOWPASS = 0;
+        /** frequency in Hz, resonance from 0.1 to 1 */
+        public static final int HIGHPASS = 1;
+        /** frequency in Hz, width in octaves, gain in dB */
+        public static final int PARAMETRIC = 2;
+        /** threshold in dB, ratio of 1.5, 2, 3, 4, 5 or 10, attack in s, release in s, output gain in dB, wet from 0 to 1 */
+        public static final int COMPRESSOR = 3;
+        /** gain in dB of the bands at 31.25, 62.5, 125, 250, 500, 1k, 2k, 4k, 8k and 16k Hz */
+        public static final int EQ = 4;
+        /** mix, room size, damp and width, each from 0 to 1 */
+        public static final int REVERB = 5;
+
+        static final int PARAMETERS = 10;
+
+        public final int type;
+        public final boolean enabled;
+        public final float[] parameters;
+
+        public Effect(int type, boolean enabled, float... parameters) {
+            this.type = type;
+            this.enabled = enabled;
+            this.parameters = parameters;
+        }
     }
 
     public interface AudioEngineListener
-            extends AudioEngine.OnPlayerEventsListener, AudioEngine.OnRecorderEventsListener {
+            extends AudioEngine.OnPlayerEventsListener, AudioEngine.OnRecorderEventsListener,
+            AudioEngine.OnBounceEventsListener {
 
     }
 
@@ -119,12 +507,62 @@ public class AudioEngine {
     private native void releaseNative();
     private native void initNative(int numberOfChannels, int playersCount, boolean loop, int mainPlayerIndex);
     private native void preparePlayer(String path, int fileOffset, int fileSize);
-    private native void startRecordingNative(String tempPath, String destinationPath);
+    private native void prepareTracksNative(String[] paths, int[] fileOffsets, int[] fileSizes, int timeoutMs);
+    private native void cancelPrepareNative();
+    private native int addTrackNative(String path, int fileOffset, int fileSize);
+    private native int replaceTrackNative(int index, String path, int fileOffset, int fileSize);
+    private native int setTrackClipsNative(int index, String[] paths, long[] positions, int[] fades);
+    private native void removeTrackNative(int index);
+    private native boolean setTrackEffectsNative(int index, int[] types, boolean[] enabled, float[] parameters);
+    private native void setTrackEffectParameterNative(int index, int effect, int parameter, float value);
+    private native void setTrackEffectEnabledNative(int index, int effect, boolean enabled);
+    private native boolean loadSessionNative(String path);
+    private native boolean saveSessionNative(String path);
+    private native boolean setTrackAnalysisNative(int index, byte[] data);
+    private native byte[] getTrackAnalysisNative(int index);
+    private native void startRecordingNative(String tempPath, String destinationPath, boolean withHistory);
     private native void stopRecordingNative();
+    private native void setRecordingFormatNative(int format);
     private native void startPlayingNative(boolean fromBeginning);
     private native void setPlayNative(boolean shouldPlay);
+    private native void setPlayerVolumeNative(int indexOfPlayer, float volume);
+    private native void setPlayerPanNative(int indexOfPlayer, float pan);
+    private native void setLoopRegionNative(long startSample, long endSample);
+    private native void setPunchRegionNative(long punchInSample, long punchOutSample);
+    private native void setMasterBusNative(boolean enabled);
+    private native void setDecodedAudioBudgetNative(long bytes);
     private native void resetNative();
+    private native boolean bounceNative(String path);
 
     public native boolean isPrepared();
 
+    /**
+     * Reads the counters without blocking the audio thread, cheap enough to poll from the UI.
+     */
+    public Stats getStats() {
+        Stats stats = new Stats();
+        long[] counters = new long[7];
+        double[] times = new double[4];
+        getStatsNative(counters, times, stats.histogram);
+        stats.callbacks = counters[0];
+        stats.overBudget = counters[1];
+        stats.nearBudget = counters[2];
+        stats.inputUnderruns = counters[3];
+        stats.outputUnderruns = counters[4];
+        stats.silenceSubstitutions = counters[5];
+        stats.inputOverruns = counters[6];
+        stats.budgetMicros = times[0];
+        stats.meanMicros = times[1];
+        stats.maxMicros = times[2];
+        stats.lastMicros = times[3];
+        return stats;
+    }
+
+    private native void measureLatencyNative();
+    private native void setRecordLatencyNative(int samples);
+    private native int getRecordLatencyNative();
+    private native int getIoLatencyNative();
+    private native int getRecordHistoryFramesNative();
+    private native void getStatsNative(long[] counters, double[] times, long[] histogram);
+
 }